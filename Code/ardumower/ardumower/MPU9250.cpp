@@ -29,37 +29,32 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define AK8963_RA_CNTL1 0x0A
 #define AK8963_RA_ASAX  0x10
 
+#define MPU9250_ADDR_SMPLRT_DIV   0x19
+#define MPU9250_ADDR_CONFIG       0x1A
 #define MPU9250_ADDR_ACCELCONFIG  0x1C
+#define MPU9250_ADDR_ACCELCONFIG2 0x1D
+#define MPU9250_ADDR_FIFO_EN      0x23
+#define MPU9250_ADDR_I2C_MST_CTRL 0x24
+#define MPU9250_ADDR_I2C_SLV0_ADDR 0x25
+#define MPU9250_ADDR_I2C_SLV0_REG 0x26
+#define MPU9250_ADDR_I2C_SLV0_CTRL 0x27
 #define MPU9250_ADDR_INT_PIN_CFG  0x37
 #define MPU9250_ADDR_ACCEL_XOUT_H 0x3B
 #define MPU9250_ADDR_GYRO_XOUT_H  0x43
+#define MPU9250_ADDR_EXT_SENS_DATA_00 0x49
+#define MPU9250_ADDR_USER_CTRL    0x6A
 #define MPU9250_ADDR_PWR_MGMT_1   0x6B
+#define MPU9250_ADDR_FIFO_COUNTH  0x72
+#define MPU9250_ADDR_FIFO_R_W     0x74
 #define MPU9250_ADDR_WHOAMI       0x75
 
+// blocking register access via the I2C transfer queue (i2c.h), 0 = success
 uint8_t MPU9250::i2cRead(uint8_t Address, uint8_t Register, uint8_t Nbytes, uint8_t* Data) {
-  myWire->beginTransmission(Address);
-  myWire->write(Register);
-  uint8_t result = myWire->endTransmission();
-  if (result != 0) {
-    return result;
-  }
-
-  myWire->requestFrom(Address, Nbytes);
-  uint8_t index = 0;
-  while (myWire->available()) {
-    uint8_t d = myWire->read();
-    if (index < Nbytes) {
-      Data[index++] = d;
-    }
-  }
-  return 0;
+  return (I2Ctransfer(Address, Register, 1, Nbytes, Data, true)) ? 0 : 1;
 }
 
 uint8_t MPU9250::i2cWriteByte(uint8_t Address, uint8_t Register, uint8_t Data) {
-  myWire->beginTransmission(Address);
-  myWire->write(Register);
-  myWire->write(Data);
-  return myWire->endTransmission();
+  return (I2Ctransfer(Address, Register, 1, 1, &Data, false)) ? 0 : 1;
 }
 
 MPU9250::MPU9250(uint8_t address):
@@ -69,26 +64,13 @@ MPU9250::MPU9250(uint8_t address):
   magXOffset = 0;
   magYOffset = 0;
   magZOffset = 0;
-  myWire = NULL;
-}
-
-void MPU9250::setWire(TwoWire* wire) {
-  myWire = wire;
 }
 
 uint8_t MPU9250::readId(uint8_t *id) {
   return i2cRead(address, MPU9250_ADDR_WHOAMI, 1, id);
 }
 
-void MPU9250::beginWireIfNull() {
-  if (myWire == NULL) {
-    myWire = &Wire;
-    myWire->begin();
-  }
-}
-
 void MPU9250::beginAccel(uint8_t mode) {
-  beginWireIfNull();
   switch(mode) {
   case ACC_FULL_SCALE_2_G:
     accelRange = 2.0;
@@ -120,7 +102,6 @@ void MPU9250::magReadAdjustValues() {
 }
 
 void MPU9250::beginMag(uint8_t mode) {
-  beginWireIfNull();
   magWakeup();
   magEnableSlaveMode();
 
@@ -130,6 +111,112 @@ void MPU9250::beginMag(uint8_t mode) {
   delay(10);
 }
 
+// AK8963 is read by the MPU's own I2C master into EXT_SENS_DATA_00..06,
+// so motionUpdate() gets accel, gyro and mag in one burst
+void MPU9250::beginMagSlave(uint8_t mode) {
+  beginMag(mode);
+  magEnableMasterRead();
+}
+
+void MPU9250::magEnableMasterRead() {
+  unsigned char bits;
+  i2cRead(address, MPU9250_ADDR_INT_PIN_CFG, 1, &bits);
+  bits &= ~B00000010; // Deactivate BYPASS_EN (AK8963 now on auxiliary bus)
+  i2cWriteByte(address, MPU9250_ADDR_INT_PIN_CFG, bits);
+  i2cWriteByte(address, MPU9250_ADDR_I2C_MST_CTRL, 0x0D); // 400 kHz
+  i2cRead(address, MPU9250_ADDR_USER_CTRL, 1, &bits);
+  bits |= B00100000; // I2C_MST_EN
+  i2cWriteByte(address, MPU9250_ADDR_USER_CTRL, bits);
+  i2cWriteByte(address, MPU9250_ADDR_I2C_SLV0_ADDR, 0x80 | AK8963_ADDRESS); // read
+  i2cWriteByte(address, MPU9250_ADDR_I2C_SLV0_REG, AK8963_RA_HXL);
+  i2cWriteByte(address, MPU9250_ADDR_I2C_SLV0_CTRL, 0x80 | MPU9250_BUFF_LEN_MAG); // enable, HXL..ST2 (ST2 read releases data latch)
+  delay(10);
+}
+
+// one burst: ACCEL_XOUT_H..GYRO_ZOUT_L and EXT_SENS_DATA (requires beginMagSlave for magnetometer)
+uint8_t MPU9250::motionUpdate() {
+  uint8_t buff[MPU9250_BUFF_LEN_MOTION];
+  uint8_t result = i2cRead(address, MPU9250_ADDR_ACCEL_XOUT_H, MPU9250_BUFF_LEN_MOTION, buff);
+  if (result != 0) return result;
+  motionSample(buff);
+  return 0;
+}
+
+// queued motionUpdate: buff (MPU9250_BUFF_LEN_MOTION bytes) is loaded by motionSample in the callback
+boolean MPU9250::motionSubmit(i2ctransfer_t *t, uint8_t *buff, i2ccallback_t callback, void *context) {
+  I2Cprepare(t, address, MPU9250_ADDR_ACCEL_XOUT_H, MPU9250_BUFF_LEN_MOTION, buff, true, callback, context);
+  return I2Csubmit(t);
+}
+
+void MPU9250::motionSample(const uint8_t *buff) {
+  memcpy(accelBuff, buff, MPU9250_BUFF_LEN_ACCEL);
+  memcpy(gyroBuff, buff + 8, MPU9250_BUFF_LEN_GYRO);  // skip TEMP_OUT
+  memcpy(magBuff, buff + 14, MPU9250_BUFF_LEN_MAG);
+}
+
+// magnetometer only (EXT_SENS_DATA, requires beginMagSlave)
+uint8_t MPU9250::magSlaveUpdate() {
+  return i2cRead(address, MPU9250_ADDR_EXT_SENS_DATA_00, MPU9250_BUFF_LEN_MAG, magBuff);
+}
+
+// queued magSlaveUpdate (reads into magBuff)
+boolean MPU9250::magSlaveSubmit(i2ctransfer_t *t, i2ccallback_t callback, void *context) {
+  I2Cprepare(t, address, MPU9250_ADDR_EXT_SENS_DATA_00, MPU9250_BUFF_LEN_MAG, magBuff, true, callback, context);
+  return I2Csubmit(t);
+}
+
+// sample accel and gyro at 'rate' Hz (4..1000) into the on-chip FIFO
+void MPU9250::beginFifo(uint16_t rate) {
+  rate = constrain(rate, 4, 1000);
+  i2cWriteByte(address, MPU9250_ADDR_SMPLRT_DIV, 1000 / rate - 1);  // internal rate 1 kHz (DLPF enabled)
+  i2cWriteByte(address, MPU9250_ADDR_CONFIG, 0x40 | 0x02);  // FIFO_MODE: stop when full (keeps samples aligned), gyro DLPF 92 Hz
+  i2cWriteByte(address, MPU9250_ADDR_ACCELCONFIG2, 0x02);   // accel DLPF 99 Hz
+  i2cWriteByte(address, MPU9250_ADDR_FIFO_EN, 0x78);        // GYRO_XOUT..GYRO_ZOUT, ACCEL
+  fifoReset();
+}
+
+void MPU9250::fifoReset() {
+  unsigned char bits;
+  i2cRead(address, MPU9250_ADDR_USER_CTRL, 1, &bits);
+  bits &= ~B01000000; // FIFO_EN off
+  i2cWriteByte(address, MPU9250_ADDR_USER_CTRL, bits);
+  i2cWriteByte(address, MPU9250_ADDR_USER_CTRL, bits | B00000100); // FIFO_RST
+  i2cWriteByte(address, MPU9250_ADDR_USER_CTRL, bits | B01000000); // FIFO_EN on
+}
+
+// number of bytes in FIFO (-1 on bus error)
+int16_t MPU9250::fifoCount() {
+  uint8_t buff[2];
+  if (i2cRead(address, MPU9250_ADDR_FIFO_COUNTH, 2, buff) != 0) return -1;
+  return fifoCountFrom(buff);
+}
+
+// queued fifoCount: buff (2 bytes) is converted by fifoCountFrom in the callback
+boolean MPU9250::fifoCountSubmit(i2ctransfer_t *t, uint8_t *buff, i2ccallback_t callback, void *context) {
+  I2Cprepare(t, address, MPU9250_ADDR_FIFO_COUNTH, 2, buff, true, callback, context);
+  return I2Csubmit(t);
+}
+
+int16_t MPU9250::fifoCountFrom(const uint8_t *buff) {
+  return (((int16_t) (buff[0] & 0x1F)) << 8) | buff[1];
+}
+
+uint8_t MPU9250::fifoRead(uint8_t *buff, uint8_t len) {
+  return i2cRead(address, MPU9250_ADDR_FIFO_R_W, len, buff);
+}
+
+// queued fifoRead (whole samples only, see fifoSample)
+boolean MPU9250::fifoReadSubmit(i2ctransfer_t *t, uint8_t *buff, uint8_t len, i2ccallback_t callback, void *context) {
+  I2Cprepare(t, address, MPU9250_ADDR_FIFO_R_W, len, buff, true, callback, context);
+  return I2Csubmit(t);
+}
+
+// load one FIFO sample, so that accelX()..gyroZ() return it
+void MPU9250::fifoSample(const uint8_t *buff) {
+  memcpy(accelBuff, buff, MPU9250_BUFF_LEN_ACCEL);
+  memcpy(gyroBuff, buff + MPU9250_BUFF_LEN_ACCEL, MPU9250_BUFF_LEN_GYRO);
+}
+
 void MPU9250::magSetMode(uint8_t mode) {
   i2cWriteByte(AK8963_ADDRESS, AK8963_RA_CNTL1, mode);
   delay(10);
@@ -209,7 +296,6 @@ float MPU9250::accelSqrt() {
 }
 
 void MPU9250::beginGyro(uint8_t mode) {
-  beginWireIfNull();
   switch (mode) {
   case GYRO_FULL_SCALE_250_DPS:
     gyroRange = 250.0;
@@ -24,7 +24,7 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef MPU9250_H
 #define MPU9250_H
 #include <Arduino.h>
-#include <Wire.h>
+#include "i2c.h"
 
 #define MPU9250_ADDRESS_AD0_LOW  0x68
 #define MPU9250_ADDRESS_AD0_HIGH 0x69
@@ -50,6 +50,11 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define MPU9250_BUFF_LEN_ACCEL 6
 #define MPU9250_BUFF_LEN_GYRO  6
 #define MPU9250_BUFF_LEN_MAG   7
+// ACCEL_XOUT_H..GYRO_ZOUT_L (14 bytes) + EXT_SENS_DATA_00..06 (AK8963 HXL..ST2)
+#define MPU9250_BUFF_LEN_MOTION 21
+// FIFO: 512 bytes, one sample = ACCEL_XOUT_H..ACCEL_ZOUT_L + GYRO_XOUT_H..GYRO_ZOUT_L
+#define MPU9250_FIFO_SIZE        512
+#define MPU9250_FIFO_SAMPLE_LEN  12
 
 class MPU9250 {
   public:
@@ -60,7 +65,6 @@ class MPU9250 {
   uint8_t magBuff[MPU9250_BUFF_LEN_MAG];
 
   MPU9250(uint8_t address = MPU9250_ADDRESS_AD0_LOW);
-  void setWire(TwoWire *wire);
   uint8_t readId(uint8_t *id);
 
   void beginAccel(uint8_t mode = ACC_FULL_SCALE_16_G);
@@ -77,6 +81,22 @@ class MPU9250 {
   float gyroZ();
 
   void beginMag(uint8_t mode = MAG_MODE_CONTINUOUS_8HZ);
+  void beginMagSlave(uint8_t mode = MAG_MODE_CONTINUOUS_100HZ);
+  uint8_t motionUpdate();
+  uint8_t magSlaveUpdate();
+
+  void beginFifo(uint16_t rate = 200);
+  void fifoReset();
+  int16_t fifoCount();
+  uint8_t fifoRead(uint8_t *buff, uint8_t len);
+  void fifoSample(const uint8_t *buff);
+  // queued reads (i2c.h): submitted in background, data is taken in the callback
+  boolean motionSubmit(i2ctransfer_t *t, uint8_t *buff, i2ccallback_t callback, void *context);
+  void motionSample(const uint8_t *buff);
+  boolean magSlaveSubmit(i2ctransfer_t *t, i2ccallback_t callback, void *context);
+  boolean fifoCountSubmit(i2ctransfer_t *t, uint8_t *buff, i2ccallback_t callback, void *context);
+  int16_t fifoCountFrom(const uint8_t *buff);
+  boolean fifoReadSubmit(i2ctransfer_t *t, uint8_t *buff, uint8_t len, i2ccallback_t callback, void *context);
   void magSetMode(uint8_t mode);
   uint8_t magUpdate();
   float magX();
@@ -85,15 +105,14 @@ class MPU9250 {
   float magHorizDirection();
 
   private:
-  TwoWire* myWire;
   float accelRange;
   float gyroRange;
   uint8_t magXAdjust, magYAdjust, magZAdjust;
-  void beginWireIfNull();
   float accelGet(uint8_t highIndex, uint8_t lowIndex);
   float gyroGet(uint8_t highIndex, uint8_t lowIndex);
   int16_t magGet(uint8_t highIndex, uint8_t lowIndex);
   void magEnableSlaveMode();
+  void magEnableMasterRead();
   void magReadAdjustValues();
   void magWakeup();
   uint8_t i2cRead(uint8_t Address, uint8_t Register, uint8_t Nbytes, uint8_t* Data);
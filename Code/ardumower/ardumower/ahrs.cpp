@@ -0,0 +1,137 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+  
+*/
+
+#include "ahrs.h"
+#include "fastmath.h"
+
+// max. gyro bias estimate (rad/s)
+#define AHRS_MAX_GYRO_BIAS 0.2
+
+
+MahonyAHRS::MahonyAHRS(){
+  twoKp = 2.0 * 0.5;
+  twoKi = 2.0 * 0.01;
+  gyroBiasX = gyroBiasY = gyroBiasZ = 0;
+  reset();
+}
+
+// gyro bias estimate is kept
+void MahonyAHRS::reset(){
+  initialized = false;
+  q0 = 1; q1 = q2 = q3 = 0;
+}
+
+// attitude from accel (roll, pitch) and tilt-compensated compass (yaw)
+void MahonyAHRS::init(float ax, float ay, float az, float mx, float my, float mz){
+  float roll  = fastAtan2(ay, az);
+  float pitch = fastAtan2(-ax, sqrt(ay*ay + az*az));
+  float yaw = 0;
+  if ((mx != 0) || (my != 0) || (mz != 0)){
+    float sr, cr, sp, cp;
+    fastSinCos(roll, sr, cr);
+    fastSinCos(pitch, sp, cp);
+    float hx = mx * cp + (my * sr + mz * cr) * sp;
+    float hy = my * cr - mz * sr;
+    yaw = fastAtan2(-hy, hx);
+  }
+  float cr2, sr2, cp2, sp2, cy2, sy2;
+  fastSinCos(roll/2, sr2, cr2);
+  fastSinCos(pitch/2, sp2, cp2);
+  fastSinCos(yaw/2, sy2, cy2);
+  q0 = cr2 * cp2 * cy2 + sr2 * sp2 * sy2;
+  q1 = sr2 * cp2 * cy2 - cr2 * sp2 * sy2;
+  q2 = cr2 * sp2 * cy2 + sr2 * cp2 * sy2;
+  q3 = cr2 * cp2 * sy2 - sr2 * sp2 * cy2;
+  initialized = true;
+}
+
+void MahonyAHRS::update(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, float dt){
+  float norm = sqrt(ax*ax + ay*ay + az*az);
+  if (norm == 0) {
+    // no gravity reference: integrate gyro only
+    ax = ay = az = 0;
+  } else {
+    norm = 1.0 / norm;
+    ax *= norm; ay *= norm; az *= norm;
+  }
+  boolean useCom = ((mx != 0) || (my != 0) || (mz != 0));
+  if (!initialized){
+    if (norm == 0) return;
+    init(ax, ay, az, mx, my, mz);
+    return;
+  }
+  float q0q0 = q0*q0, q0q1 = q0*q1, q0q2 = q0*q2, q0q3 = q0*q3;
+  float q1q1 = q1*q1, q1q2 = q1*q2, q1q3 = q1*q3;
+  float q2q2 = q2*q2, q2q3 = q2*q3;
+  float q3q3 = q3*q3;
+  float ex = 0, ey = 0, ez = 0;
+  if (norm != 0){
+    // estimated gravity direction (sensor frame)
+    float vx = 2 * (q1q3 - q0q2);
+    float vy = 2 * (q0q1 + q2q3);
+    float vz = q0q0 - q1q1 - q2q2 + q3q3;
+    ex = ay * vz - az * vy;
+    ey = az * vx - ax * vz;
+    ez = ax * vy - ay * vx;
+  }
+  if (useCom){
+    norm = 1.0 / sqrt(mx*mx + my*my + mz*mz);
+    mx *= norm; my *= norm; mz *= norm;
+    // earth frame magnetic field, reference has no east component
+    float hx = 2 * (mx * (0.5 - q2q2 - q3q3) + my * (q1q2 - q0q3) + mz * (q1q3 + q0q2));
+    float hy = 2 * (mx * (q1q2 + q0q3) + my * (0.5 - q1q1 - q3q3) + mz * (q2q3 - q0q1));
+    float bx = sqrt(hx*hx + hy*hy);
+    float bz = 2 * (mx * (q1q3 - q0q2) + my * (q2q3 + q0q1) + mz * (0.5 - q1q1 - q2q2));
+    // estimated magnetic field direction (sensor frame)
+    float wx = 2 * (bx * (0.5 - q2q2 - q3q3) + bz * (q1q3 - q0q2));
+    float wy = 2 * (bx * (q1q2 - q0q3) + bz * (q0q1 + q2q3));
+    float wz = 2 * (bx * (q0q2 + q1q3) + bz * (0.5 - q1q1 - q2q2));
+    ex += my * wz - mz * wy;
+    ey += mz * wx - mx * wz;
+    ez += mx * wy - my * wx;
+  }
+  if (twoKi > 0){
+    gyroBiasX = constrain(gyroBiasX - twoKi * ex * dt, -AHRS_MAX_GYRO_BIAS, AHRS_MAX_GYRO_BIAS);
+    gyroBiasY = constrain(gyroBiasY - twoKi * ey * dt, -AHRS_MAX_GYRO_BIAS, AHRS_MAX_GYRO_BIAS);
+    gyroBiasZ = constrain(gyroBiasZ - twoKi * ez * dt, -AHRS_MAX_GYRO_BIAS, AHRS_MAX_GYRO_BIAS);
+  }
+  gx += twoKp * ex - gyroBiasX;
+  gy += twoKp * ey - gyroBiasY;
+  gz += twoKp * ez - gyroBiasZ;
+  // integrate rate of change of quaternion
+  gx *= 0.5 * dt;
+  gy *= 0.5 * dt;
+  gz *= 0.5 * dt;
+  float qa = q0, qb = q1, qc = q2;
+  q0 += (-qb * gx - qc * gy - q3 * gz);
+  q1 += ( qa * gx + qc * gz - q3 * gy);
+  q2 += ( qa * gy - qb * gz + q3 * gx);
+  q3 += ( qa * gz + qb * gy - qc * gx);
+  norm = 1.0 / sqrt(q0*q0 + q1*q1 + q2*q2 + q3*q3);
+  q0 *= norm; q1 *= norm; q2 *= norm; q3 *= norm;
+}
+
+void MahonyAHRS::getYawPitchRoll(float &yaw, float &pitch, float &roll){
+  roll  = fastAtan2(q0*q1 + q2*q3, 0.5 - q1*q1 - q2*q2);
+  pitch = fastAsin(-2.0 * (q1*q3 - q0*q2));
+  yaw   = fastAtan2(q1*q2 + q0*q3, 0.5 - q2*q2 - q3*q3);
+}
@@ -0,0 +1,54 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+
+*/
+
+#ifndef AHRS_H
+#define AHRS_H
+
+#include <Arduino.h>
+
+
+/*
+  quaternion attitude estimation (Mahony complementary filter on SO(3))
+  gyro (rad/s) is integrated per sample; the error between measured and estimated gravity
+  (and magnetic field) direction corrects the attitude (Kp) and the gyro bias estimate (Ki).
+  sensor frame: x forward, y left, z up (accelerometer reads +1g on z when level)
+*/
+
+class MahonyAHRS
+{
+  public:
+    MahonyAHRS();
+    void reset();    // next update initializes attitude from accel/compass
+    // dt = sample time (sec), compass (mx,my,mz) all zero: accel only
+    void update(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, float dt);
+    void getYawPitchRoll(float &yaw, float &pitch, float &roll);  // yaw counter-clockwise (radiant)
+    boolean initialized;
+    float twoKp;  // 2 * proportional gain
+    float twoKi;  // 2 * integral gain (gyro bias)
+    float q0, q1, q2, q3;  // attitude (sensor to earth)
+    float gyroBiasX, gyroBiasY, gyroBiasZ;  // gyro bias estimate (rad/s)
+  private:
+    void init(float ax, float ay, float az, float mx, float my, float mz);
+};
+
+
+#endif
@@ -34,7 +34,6 @@
 
  */
 #include <Arduino.h>
-#include <Wire.h>
 //#include <Servo.h>
 #ifdef __AVR_ATmega2560__
   // Arduino Mega
@@ -0,0 +1,95 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+  
+*/
+
+#include "autotune.h"
+
+
+RelayAutotune::RelayAutotune(){
+  running = done = false;
+  Ku = Tu = 0;
+}
+
+void RelayAutotune::start(float setValue, float outputBase, float amplitude, float hysteresis, byte cycles){
+  w = setValue;
+  base = outputBase;
+  d = amplitude;
+  hyst = hysteresis;
+  cyclesMax = cycles;
+  this->cycles = 0;
+  relayHigh = true;
+  lastUpTime = 0;
+  peakMax = -1e9;
+  peakMin = 1e9;
+  periodSum = amplitudeSum = 0;
+  Ku = Tu = 0;
+  done = false;
+  running = true;
+}
+
+void RelayAutotune::stop(){
+  running = false;
+}
+
+float RelayAutotune::run(float x, unsigned long timeMicros){
+  if (!running) return base;
+  if (x > peakMax) peakMax = x;
+  if (x < peakMin) peakMin = x;
+
+  if ((relayHigh) && (x > w + hyst)) {
+    relayHigh = false;
+  }
+  else if ((!relayHigh) && (x < w - hyst)) {
+    // one full oscillation since last switch up
+    relayHigh = true;
+    if (lastUpTime != 0) {
+      // first oscillation is ignored (transient)
+      if (cycles > 0) {
+        periodSum += (timeMicros - lastUpTime) / 1000000.0;
+        amplitudeSum += (peakMax - peakMin) / 2;
+      }
+      cycles++;
+    }
+    lastUpTime = timeMicros;
+    peakMax = -1e9;
+    peakMin = 1e9;
+    if (cycles > cyclesMax) {
+      float a = amplitudeSum / cyclesMax;
+      Tu = periodSum / cyclesMax;
+      // describing function of relay with hysteresis
+      if (a > hyst) a = sqrt(a * a - hyst * hyst);
+      if (a > 0) Ku = 4.0 * d / (PI * a);
+      running = false;
+      done = (Ku > 0) && (Tu > 0);
+      return base;
+    }
+  }
+  return (relayHigh) ? base + d : base - d;
+}
+
+// Ziegler-Nichols (classic PID): Kp = 0.6 Ku, Ti = Tu/2, Td = Tu/8
+void RelayAutotune::apply(PID &pid){
+  if (!done) return;
+  pid.Kp = 0.6 * Ku;
+  pid.Ki = 1.2 * Ku / Tu;
+  pid.Kd = 0.075 * Ku * Tu;
+  pid.reset();
+}
@@ -0,0 +1,65 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+
+*/
+
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <Arduino.h>
+#include "pid.h"
+
+
+/*
+  relay feedback PID autotuner (Astrom-Hagglund)
+  the output is switched between base+amplitude and base-amplitude whenever the process value
+  crosses the set value (with hysteresis). The resulting oscillation gives ultimate gain Ku and
+  period Tu, PID gains are computed by Ziegler-Nichols rules.
+*/
+
+class RelayAutotune
+{
+  public:
+    RelayAutotune();
+    void start(float setValue, float outputBase, float amplitude, float hysteresis, byte cycles);
+    void stop();
+    float run(float x, unsigned long timeMicros); // returns control output
+    void apply(PID &pid);    // set Kp, Ki, Kd (Ziegler-Nichols)
+    boolean running;
+    boolean done;
+    float Ku; // ultimate gain
+    float Tu; // ultimate period (sec)
+  private:
+    float w;
+    float base;
+    float d;
+    float hyst;
+    byte cyclesMax;
+    byte cycles;
+    boolean relayHigh;
+    unsigned long lastUpTime;
+    float peakMax;
+    float peakMin;
+    float periodSum;
+    float amplitudeSum;
+};
+
+
+#endif
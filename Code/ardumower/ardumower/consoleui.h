@@ -92,6 +92,7 @@ void Robot::printMenu() {
   Console.println(F("p=test EEPROM module"));
   Console.println(F("c=test RTC module"));
   Console.println(F("i=scan for I2C devices"));
+  Console.println(F("b=measure PID compute() time (float/fixed)"));
   Console.println(F("1=test motors"));
   Console.println(F("2=test odometry"));
   Console.println(F("3=communications menu (setup Bluetooth & WIFI)"));
@@ -214,6 +215,47 @@ void Robot::testRTC() {
   }
 }
 
+static void resetPIDState(PID &pid) { pid.reset(); }
+static void resetPIDState(VelocityPID &pid) { pid.y = pid.yold = 0; pid.eold1 = pid.eold2 = 0; }
+
+// average compute() time (microseconds) of a PID controller, best of 5 runs
+// (interrupts stay enabled, so the minimum is taken to skip runs hit by the control tick)
+template <class T> float measurePIDTime(T &pid) {
+  const int n = 1000;
+  volatile float sum = 0;
+  unsigned long best = 0xFFFFFFFF;
+  pid.Kp = 1.5; pid.Ki = 0.29; pid.Kd = 0.25;
+  pid.y_min = -255; pid.y_max = 255; pid.max_output = 255;
+  resetPIDState(pid);
+  for (int run = 0; run < 5; run++) {
+    unsigned long start = micros();
+    for (int i = 0; i < n; i++) {
+      pid.w = 20;
+      pid.x = (i % 50) * 0.4;
+      sum += pid.compute(0.005);
+    }
+    unsigned long duration = micros() - start;
+    if (duration < best) best = duration;
+  }
+  return ((float)best) / n;
+}
+
+void Robot::testPIDTiming() {
+  PID floatPID;
+  FixedPID<> fixedPID;
+  VelocityPID floatVelocityPID;
+  FixedVelocityPID<> fixedVelocityPID;
+  Console.println(F("measuring PID compute() time..."));
+  Console.print(F("PID                 (us): "));
+  Console.println(measurePIDTime(floatPID), 2);
+  Console.print(F("FixedPID            (us): "));
+  Console.println(measurePIDTime(fixedPID), 2);
+  Console.print(F("VelocityPID         (us): "));
+  Console.println(measurePIDTime(floatVelocityPID), 2);
+  Console.print(F("FixedVelocityPID    (us): "));
+  Console.println(measurePIDTime(fixedVelocityPID), 2);
+}
+
 void Robot::testMotors() {
   motorLeftPWMCurr = 0; motorRightPWMCurr = 0;
   setMotorPWM(motorLeftPWMCurr, motorRightPWMCurr, false);
@@ -323,6 +365,10 @@ void Robot::menu() {
         case 'i':
           I2CScanner();
           break;
+        case 'b':
+          testPIDTiming();
+          printMenu();
+          break;
         case 'r':
           //printSettingSerial();
           deleteRobotStats();
@@ -27,7 +27,6 @@
 #include "pinman.h"
 #include "i2c.h"
 //#include "ardumower.h"
-#include <Wire.h>  
 #ifdef __AVR_ATmega2560__
   #include <avr/wdt.h>
 #endif  
@@ -226,6 +225,11 @@ boolean readDS1307(datetime_t &dt){
     //addErrorCounter(ERR_RTC_COMM);
     return false;
   }      
+  return decodeDS1307(buf, dt);
+}
+
+// decode DS1307 registers 0x00..0x07
+boolean decodeDS1307(byte buf[8], datetime_t &dt){
   if (   ((buf[0] >> 7) != 0) || ((buf[1] >> 7) != 0) || ((buf[2] >> 7) != 0) || ((buf[3] >> 3) != 0) 
       || ((buf[4] >> 6) != 0) || ((buf[5] >> 5) != 0) || ((buf[7] & B01101100) != 0) ) {    
     Console.println("DS1307 data1 error");    
@@ -270,60 +274,52 @@ boolean setDS1307(datetime_t &dt){
 }
 
 bool checkAT24C32() {
-	byte b = 0;
-	int r = 0;
-	unsigned int address = 0;
-	Wire.beginTransmission(AT24C32_ADDRESS);
-  if (Wire.endTransmission() == 0) {
-    Wire.beginTransmission(AT24C32_ADDRESS);
-    Wire.write(address >> 8);
-    Wire.write(address & 0xFF);
-    if (Wire.endTransmission() == 0) {
-      Wire.requestFrom(AT24C32_ADDRESS, 1);
-      while (Wire.available() > 0 && r < 1) {        
-        b = (byte)Wire.read();        
-				r++;
-      }
-    }
-  }
-	return (r == 1);
+  byte b = 0;
+  return I2Ctransfer(AT24C32_ADDRESS, 0, 2, 1, &b, true);
 }
 
 //bb add to read byte into the Tiny RTC memory
 byte readAT24C32(unsigned int address) {
   byte b = 0;
-  int r = 0;
-  //unsigned int address = 1021;
-  Wire.beginTransmission(AT24C32_ADDRESS);
-  if (Wire.endTransmission() == 0) {
-    Wire.beginTransmission(AT24C32_ADDRESS);
-    Wire.write(address >> 8);
-    Wire.write(address & 0xFF);
-    if (Wire.endTransmission() == 0) {
-      Wire.requestFrom(AT24C32_ADDRESS, 1);
-      while (Wire.available() > 0 && r < 1) {
-        b = (byte)Wire.read();
-        r++;
-      }
-    }
-  }
+  I2Ctransfer(AT24C32_ADDRESS, address, 2, 1, &b, true);
   return b;
 }
+// sequential read: the device increments the address (whole chip), one transfer per chunk
+bool readAT24C32Block(unsigned int address, byte *data, unsigned int len) {
+  while (len > 0) {
+    byte n = min(len, AT24C32_READ_CHUNK);
+    if (!I2Ctransfer(AT24C32_ADDRESS, address, 2, n, data, true)) return false;
+    address += n;
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
 //bb add to write byte into the Tiny RTC memory
 //bb1
-byte writeAT24C32(unsigned int address,byte data) {
-   //unsigned int address = 1021;
-  Wire.beginTransmission(AT24C32_ADDRESS);
-  if (Wire.endTransmission() == 0) {
-    Wire.beginTransmission(AT24C32_ADDRESS);
-    Wire.write(address >> 8);
-    Wire.write(address & 0xFF);
-    Wire.write(data);
-    Wire.endTransmission();
-    delay(5);
-  }
+bool writeAT24C32(unsigned int address,byte data) {
+  if (!I2Ctransfer(AT24C32_ADDRESS, address, 2, 1, &data, false)) return false;
+  delay(5);  // write cycle
 	return true;
 }
+
+// page write (data must not cross a 32 byte page), one write cycle per page instead of one per byte
+bool writeAT24C32Page(unsigned int address, const byte *data, byte len) {
+  while (len > 0) {
+    byte n = min(len, AT24C32_WRITE_CHUNK);
+    if (!I2Ctransfer(AT24C32_ADDRESS, address, 2, n, (byte*)data, false)) return false;
+    // acknowledge polling: device does not acknowledge until write cycle is completed
+    unsigned long start = millis();
+    while (!I2Cprobe(AT24C32_ADDRESS)) {
+      if (millis() - start > AT24C32_WRITE_TIMEOUT) return false;
+    }
+    address += n;
+    data += n;
+    len -= n;
+  }
+  return true;
+}
  
 
 // measure lawn sensor capacity 
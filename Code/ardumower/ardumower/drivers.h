@@ -29,6 +29,7 @@
 #define DRIVERS_H
 
 #include <Arduino.h>
+#include "fastmath.h"
 #ifdef __AVR__
   // Arduino Mega
   #include <EEPROM.h>  
@@ -83,6 +84,17 @@ template <typename T> int sign(T val) {
     return (T(0) < val) - (val < T(0));
 }
 
+// disables interrupts and returns the previous state (nestable, safe inside interrupt handlers)
+#ifdef __AVR__
+  typedef uint8_t irqstate_t;
+  inline irqstate_t irqLock(){ irqstate_t state = SREG; cli(); return state; }
+  inline void irqUnlock(irqstate_t state){ SREG = state; }
+#else
+  typedef uint32_t irqstate_t;
+  inline irqstate_t irqLock(){ irqstate_t state = __get_PRIMASK(); __disable_irq(); return state; }
+  inline void irqUnlock(irqstate_t state){ __set_PRIMASK(state); }
+#endif
+
 // ---------- driver functions ----------------------------------
 
 int freeRam();
@@ -123,10 +135,13 @@ int measureLawnCapacity(int pinSend, int pinReceive);
 
 // real time drivers
 boolean readDS1307(datetime_t &dt);
+boolean decodeDS1307(byte buf[8], datetime_t &dt);
 boolean setDS1307(datetime_t &dt);
 bool checkAT24C32();
 byte readAT24C32(unsigned int address);
-byte writeAT24C32(unsigned int address,byte data);
+bool writeAT24C32(unsigned int address,byte data);
+bool writeAT24C32Page(unsigned int address, const byte *data, byte len);
+bool readAT24C32Block(unsigned int address, byte *data, unsigned int len);
 
 // Returns the day of week (0=Sunday, 6=Saturday) for a given date
 int getDayOfWeek(int month, int day, int year, int CalendarSystem);
@@ -0,0 +1,167 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+  
+*/
+
+#include "ellipsoid.h"
+
+
+EllipsoidFit::EllipsoidFit(){
+  reset();
+}
+
+void EllipsoidFit::reset(){
+  for (byte i=0; i < 55; i++) m[i] = 0;
+  count = 0;
+}
+
+void EllipsoidFit::add(float x, float y, float z){
+  float d[10] = { x*x, y*y, z*z, 2*x*y, 2*x*z, 2*y*z, 2*x, 2*y, 2*z, 1 };
+  byte idx = 0;
+  for (byte i=0; i < 10; i++){
+    for (byte j=i; j < 10; j++){
+      m[idx++] += d[i] * d[j];
+    }
+  }
+  count++;
+}
+
+void EllipsoidFit::decay(float f){
+  for (byte i=0; i < 55; i++) m[i] *= f;
+  count *= f;
+}
+
+float EllipsoidFit::get(byte i, byte j){
+  if (i > j) { byte t = i; i = j; j = t; }
+  // row i of upper triangle starts at i*10 - i*(i-1)/2
+  return m[i*10 - i*(i-1)/2 + (j-i)];
+}
+
+// eigen decomposition of symmetric 3x3 matrix (cyclic Jacobi), a is diagonalized, v = eigenvectors (columns)
+static void jacobi3(float a[3][3], float v[3][3]){
+  for (byte i=0; i < 3; i++)
+    for (byte j=0; j < 3; j++) v[i][j] = (i == j) ? 1 : 0;
+  for (byte sweep=0; sweep < 10; sweep++){
+    float off = fabs(a[0][1]) + fabs(a[0][2]) + fabs(a[1][2]);
+    if (off < 1e-9) break;
+    for (byte p=0; p < 2; p++){
+      for (byte q=p+1; q < 3; q++){
+        if (fabs(a[p][q]) < 1e-12) continue;
+        float theta = (a[q][q] - a[p][p]) / (2 * a[p][q]);
+        float t = ((theta >= 0) ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta*theta + 1));
+        float c = 1.0 / sqrt(t*t + 1);
+        float s = t * c;
+        for (byte k=0; k < 3; k++){
+          // columns p, q
+          float akp = a[k][p], akq = a[k][q];
+          a[k][p] = c * akp - s * akq;
+          a[k][q] = s * akp + c * akq;
+        }
+        for (byte k=0; k < 3; k++){
+          // rows p, q
+          float apk = a[p][k], aqk = a[q][k];
+          a[p][k] = c * apk - s * aqk;
+          a[q][k] = s * apk + c * aqk;
+        }
+        for (byte k=0; k < 3; k++){
+          float vkp = v[k][p], vkq = v[k][q];
+          v[k][p] = c * vkp - s * vkq;
+          v[k][q] = s * vkp + c * vkq;
+        }
+      }
+    }
+  }
+}
+
+boolean invert3x3(float a[3][3], float inv[3][3]){
+  float det = a[0][0]*(a[1][1]*a[2][2] - a[1][2]*a[2][1])
+            - a[0][1]*(a[1][0]*a[2][2] - a[1][2]*a[2][0])
+            + a[0][2]*(a[1][0]*a[2][1] - a[1][1]*a[2][0]);
+  if (fabs(det) < 1e-12) return false;
+  inv[0][0] =  (a[1][1]*a[2][2] - a[1][2]*a[2][1]) / det;
+  inv[0][1] = -(a[0][1]*a[2][2] - a[0][2]*a[2][1]) / det;
+  inv[0][2] =  (a[0][1]*a[1][2] - a[0][2]*a[1][1]) / det;
+  inv[1][0] = -(a[1][0]*a[2][2] - a[1][2]*a[2][0]) / det;
+  inv[1][1] =  (a[0][0]*a[2][2] - a[0][2]*a[2][0]) / det;
+  inv[1][2] = -(a[0][0]*a[1][2] - a[0][2]*a[1][0]) / det;
+  inv[2][0] =  (a[1][0]*a[2][1] - a[1][1]*a[2][0]) / det;
+  inv[2][1] = -(a[0][0]*a[2][1] - a[0][1]*a[2][0]) / det;
+  inv[2][2] =  (a[0][0]*a[1][1] - a[0][1]*a[1][0]) / det;
+  return true;
+}
+
+boolean EllipsoidFit::solve(float ofs[3], float corr[3][3]){
+  if (count < 10) return false;
+  // normal equations (9x9, right side in column 9), gaussian elimination with partial pivoting
+  float n[9][10];
+  float maxDiag = 0;
+  for (byte i=0; i < 9; i++){
+    for (byte j=0; j < 10; j++) n[i][j] = get(i, j);
+    maxDiag = max(maxDiag, fabs(n[i][i]));
+  }
+  for (byte col=0; col < 9; col++){
+    byte piv = col;
+    for (byte r=col+1; r < 9; r++) if (fabs(n[r][col]) > fabs(n[piv][col])) piv = r;
+    if (fabs(n[piv][col]) < 1e-6 * maxDiag) return false;  // samples do not span an ellipsoid
+    if (piv != col){
+      for (byte j=col; j < 10; j++) { float t = n[col][j]; n[col][j] = n[piv][j]; n[piv][j] = t; }
+    }
+    for (byte r=col+1; r < 9; r++){
+      float f = n[r][col] / n[col][col];
+      for (byte j=col; j < 10; j++) n[r][j] -= f * n[col][j];
+    }
+  }
+  float p[9];
+  for (int i=8; i >= 0; i--){
+    float sum = n[i][9];
+    for (byte j=i+1; j < 9; j++) sum -= n[i][j] * p[j];
+    p[i] = sum / n[i][i];
+  }
+  float a[3][3] = { {p[0], p[3], p[4]}, {p[3], p[1], p[5]}, {p[4], p[5], p[2]} };
+  // center = -A^-1 * g
+  float inv[3][3];
+  if (!invert3x3(a, inv)) return false;
+  float g[3] = { p[6], p[7], p[8] };
+  float c[3];
+  for (byte i=0; i < 3; i++) c[i] = -(inv[i][0]*g[0] + inv[i][1]*g[1] + inv[i][2]*g[2]);
+  // (x-c)' A (x-c) = 1 + c' A c
+  float k = 1;
+  for (byte i=0; i < 3; i++)
+    for (byte j=0; j < 3; j++) k += c[i] * a[i][j] * c[j];
+  if (k <= 0) return false;
+  for (byte i=0; i < 3; i++)
+    for (byte j=0; j < 3; j++) a[i][j] /= k;
+  // corr = sqrt(A) = V * sqrt(L) * V'
+  float v[3][3];
+  jacobi3(a, v);
+  float l[3] = { a[0][0], a[1][1], a[2][2] };
+  float lmin = min(l[0], min(l[1], l[2]));
+  float lmax = max(l[0], max(l[1], l[2]));
+  if (lmin <= 0) return false;  // not an ellipsoid
+  if (lmax / lmin > ELLIPSOID_MAX_AXIS_RATIO * ELLIPSOID_MAX_AXIS_RATIO) return false;
+  for (byte i=0; i < 3; i++) l[i] = sqrt(l[i]);
+  for (byte i=0; i < 3; i++){
+    for (byte j=0; j < 3; j++){
+      corr[i][j] = v[i][0]*l[0]*v[j][0] + v[i][1]*l[1]*v[j][1] + v[i][2]*l[2]*v[j][2];
+    }
+    ofs[i] = c[i];
+  }
+  return true;
+}
@@ -0,0 +1,59 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+
+*/
+
+#ifndef ELLIPSOID_H
+#define ELLIPSOID_H
+
+#include <Arduino.h>
+
+
+/*
+  incremental least-squares ellipsoid fit (magnetometer hard/soft-iron calibration)
+  each sample adds to the normal matrix of the quadric
+    a*x^2 + b*y^2 + c*z^2 + 2d*xy + 2e*xz + 2f*yz + 2g*x + 2h*y + 2i*z = 1
+  (55 floats, O(1) memory), solve() gives center and the symmetric matrix mapping the
+  ellipsoid onto the unit sphere:  corrected = corr * (sample - ofs)
+  samples should be normalized to about unit size (float precision)
+*/
+
+// max. ratio of longest to shortest ellipsoid axis for a valid fit
+#define ELLIPSOID_MAX_AXIS_RATIO 3.0
+
+class EllipsoidFit
+{
+  public:
+    EllipsoidFit();
+    void reset();
+    void add(float x, float y, float z);
+    void decay(float f);  // weight older samples by f (0..1)
+    boolean solve(float ofs[3], float corr[3][3]);
+    float count;  // (weighted) number of samples
+  private:
+    float m[55];  // normal matrix (upper triangle of 10x10), row = x2,y2,z2,2xy,2xz,2yz,2x,2y,2z,1
+    float get(byte i, byte j);
+};
+
+// inverse of 3x3 matrix (false if singular)
+boolean invert3x3(float a[3][3], float inv[3][3]);
+
+
+#endif
@@ -0,0 +1,100 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+  
+*/
+
+#include "fastmath.h"
+
+// radiant to 16 bit binary angle (65536 = 2*PI)
+#define RAD_TO_BAM16 10430.378
+
+
+// quarter sine wave in Q15 (65 entries, 0..PI/2)
+const int sinQ15Table[65] PROGMEM = {
+  0, 804, 1608, 2410, 3212, 4011, 4808, 5602,
+  6393, 7179, 7962, 8739, 9512, 10278, 11039, 11793,
+  12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530,
+  18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+  23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790,
+  27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+  30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971,
+  32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757,
+  32767
+};
+
+// table lookup with linear interpolation (max. error ~1e-4)
+int sinQ15(unsigned int angle)
+{
+  byte quadrant = angle >> 14;
+  unsigned int a = angle & 0x3FFF;
+  if (quadrant & 1) a = 0x4000 - a;
+  byte idx = a >> 8;
+  int v = (int)pgm_read_word(&sinQ15Table[idx]);
+  if (idx < 64) {
+    int next = (int)pgm_read_word(&sinQ15Table[idx + 1]);
+    v += (int)(((long)(next - v) * (a & 0xFF)) >> 8);
+  }
+  if (quadrant & 2) v = -v;
+  return v;
+}
+
+int cosQ15(unsigned int angle)
+{
+  return sinQ15((angle + 0x4000) & 0xFFFF);
+}
+
+// minimax polynomial for atan on 0..1
+static float atanUnit(float z){
+  float z2 = z * z;
+  return z * (0.99997726 + z2 * (-0.33262347 + z2 * (0.19354346 + z2 * (-0.11643287 + z2 * (0.05265332 + z2 * -0.01172120)))));
+}
+
+float fastAtan2(float y, float x){
+  float ax = fabs(x);
+  float ay = fabs(y);
+  if ((ax == 0) && (ay == 0)) return 0;
+  float a;
+  if (ay <= ax) a = atanUnit(ay / ax);
+    else a = PI/2 - atanUnit(ax / ay);
+  if (x < 0) a = PI - a;
+  if (y < 0) a = -a;
+  return a;
+}
+
+float fastAsin(float x){
+  x = constrain(x, -1.0, 1.0);
+  return fastAtan2(x, sqrt(1.0 - x * x));
+}
+
+void fastSinCos(float angle, float &s, float &c){
+  unsigned int bam = ((unsigned long)((long)(angle * RAD_TO_BAM16))) & 0xFFFF;
+  s = ((float)sinQ15(bam)) / 32767.0;
+  c = ((float)cosQ15(bam)) / 32767.0;
+}
+
+float wrapPI(float v){
+#ifdef FASTMATH_FIXED_POINT_ANGLES
+  // 16 bit binary angle wraps by integer overflow
+  int16_t bam = (int16_t)((long)(v * RAD_TO_BAM16));
+  return ((float)bam) / RAD_TO_BAM16;
+#else
+  return v - 2*PI * floor((v + PI) / (2*PI));
+#endif
+}
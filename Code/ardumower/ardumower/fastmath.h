@@ -0,0 +1,49 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+
+*/
+
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+#include <Arduino.h>
+
+
+/*
+  fast math for the IMU path (both Mega and Due have no FPU)
+  max. errors:  fastAtan2, fastAsin 1e-5 radiant, fastSinCos 2e-4, wrapPI fixed point 1e-4 radiant
+*/
+
+// wrap angles in fixed point (16 bit binary angle, resolution 1e-4 radiant) instead of float
+//#define FASTMATH_FIXED_POINT_ANGLES
+
+float fastAtan2(float y, float x);
+float fastAsin(float x);
+// sine and cosine with one binary angle conversion
+void fastSinCos(float angle, float &s, float &c);
+// rescale to -PI..+PI (without loops)
+float wrapPI(float v);
+
+// fixed point sine/cosine: angle as 16 bit binary angle (65536 = 2*PI), result Q15 (32767 = 1.0)
+int sinQ15(unsigned int angle);
+int cosQ15(unsigned int angle);
+
+
+#endif
@@ -7,9 +7,6 @@
 #else
 #endif  
 
-// size we use (actual size is 4K)
-#define EEPROM_SIZE 1024
-
 FlashClass Flash;
 
 
@@ -34,19 +31,29 @@ int eereadwriteString(boolean readflag, int &ee, String& value)
 
 FlashClass::FlashClass() {
   verboseOutput = false;
-#ifdef __AVR__  
-#else
+  readValue = 0;
+#ifdef FLASH_MIRROR
+  mirrorLoaded = false;
 #endif
 }
 
 
+#ifdef FLASH_MIRROR
+// loads mirror on first access (I2C must be initialized)
+boolean FlashClass::loadMirror(){
+  if (!mirrorLoaded) mirrorLoaded = readDevice(0, mirror, EEPROM_SIZE);
+  return mirrorLoaded;
+}
+#endif
+
+
 void FlashClass::test(){	  
 	Console.println(F("EEPROM test - Please wait..."));
 	bool success = true;
-	for (int i=0; i < EEPROM_SIZE; i++){ // test 1024 addresses
-	  byte temp = read(i);	// read original value
+	for (int i=0; i < EEPROM_SIZE; i++){ // test all addresses
+	  byte temp = readDevice(i);	// read original value
     write(i, ((byte)i));  // write test value
-	  byte v = read(i); // get test value
+	  byte v = readDevice(i); // get test value
   	write(i, temp); // write back original value
 	  if (v != ((byte)i)){ // incorrect read or write or both
 	    Console.println(F("EEPROM error - RTC module missing?"));
@@ -58,6 +65,31 @@ void FlashClass::test(){
 }
 
 byte FlashClass::read(uint32_t address) {
+#ifdef FLASH_MIRROR
+  if ((address < EEPROM_SIZE) && (loadMirror())) return mirror[address];
+#endif
+  return readDevice(address);
+}
+
+boolean FlashClass::read(uint32_t address, byte *data, uint32_t dataLength) {
+#ifdef FLASH_MIRROR
+  if ((address + dataLength <= EEPROM_SIZE) && (loadMirror())) {
+    memcpy(data, mirror + address, dataLength);
+    return true;
+  }
+#endif
+  return readDevice(address, data, dataLength);
+}
+
+byte* FlashClass::readAddress(uint32_t address) {
+#ifdef FLASH_MIRROR
+  if ((address < EEPROM_SIZE) && (loadMirror())) return &mirror[address];
+#endif
+  readValue = readDevice(address);
+  return &readValue;
+}
+
+byte FlashClass::readDevice(uint32_t address) {
 #ifdef __AVR__  
   return EEPROM.read(address);
 #else
@@ -65,13 +97,12 @@ byte FlashClass::read(uint32_t address) {
 #endif
 }
 
-byte* FlashClass::readAddress(uint32_t address) {
+boolean FlashClass::readDevice(uint32_t address, byte *data, uint32_t dataLength) {
 #ifdef __AVR__  
-  byte d = EEPROM.read(address);
-  return &d;
+  for (uint32_t i=0; i < dataLength; i++) data[i] = EEPROM.read(address + i);
+  return true;
 #else
-	byte d = readAT24C32(address);
-  return &d;
+	return readAT24C32Block(address, data, dataLength);
 #endif
 }
 
@@ -153,17 +184,56 @@ boolean FlashClass::write(uint32_t address, byte value) {
   EEPROM.write(address, value);
   return true;
 #else  
-	writeAT24C32(address, value);
-  return true;
+#ifdef FLASH_MIRROR
+  if ((address < EEPROM_SIZE) && (mirrorLoaded)) {
+    if (mirror[address] == value) return true;
+    // mirror follows device only if write succeeded
+    if (!writeAT24C32(address, value)) {
+      mirrorLoaded = false;
+      return false;
+    }
+    mirror[address] = value;
+    return true;
+  }
+#endif
+	return writeAT24C32(address, value);
 #endif  
 }
 
 
 boolean FlashClass::write(uint32_t address, byte *data, uint32_t dataLength) {
-  for (int i=0; i < dataLength; i++){
-    write(address + i, data[i]);
+  boolean res = true;
+  while (dataLength > 0){
+    // split at page boundaries
+    byte n = min(dataLength, AT24C32_PAGE_SIZE - (address % AT24C32_PAGE_SIZE));
+    if (!writePage(address, data, n)) res = false;
+    address += n;
+    data += n;
+    dataLength -= n;
   }
+  return res;
+}
+
+
+boolean FlashClass::writePage(uint32_t address, const byte *data, byte len) {
+#ifdef __AVR__  
+  for (byte i=0; i < len; i++) EEPROM.update(address + i, data[i]);
   return true;
+#else  
+#ifdef FLASH_MIRROR
+  if ((address + len <= EEPROM_SIZE) && (mirrorLoaded)) {
+    if (memcmp(mirror + address, data, len) == 0) return true;
+    // mirror follows device only if write succeeded
+    if (!writeAT24C32Page(address, data, len)) {
+      mirrorLoaded = false;
+      return false;
+    }
+    memcpy(mirror + address, data, len);
+    return true;
+  }
+#endif
+	return writeAT24C32Page(address, data, len);
+#endif  
 }
 
 
@@ -2,6 +2,16 @@
 #define FLASHMEM_H
 
 #include <Arduino.h>
+#include "journal.h"
+
+// size we use: fixed address data and settings journal (actual size is 4K)
+#define EEPROM_SIZE (JOURNAL_START + JOURNAL_PAGES * JOURNAL_PAGE_SIZE)
+
+// Due: EEPROM (AT24C32 on I2C) is mirrored in RAM, loaded once with sequential reads, 
+// reads are served from RAM, writes go through (unchanged bytes are not written)
+#ifndef __AVR__
+  #define FLASH_MIRROR
+#endif
 
 
 class FlashClass
@@ -10,12 +20,26 @@ class FlashClass
     boolean verboseOutput;
     FlashClass();
     byte read(uint32_t address);
+    // sequential read
+    boolean read(uint32_t address, byte *data, uint32_t dataLength);
+    // pointer to value (mirror, otherwise valid until next call)
     byte* readAddress(uint32_t address);
     boolean write(uint32_t address, byte value);
     boolean write(uint32_t address, byte *data, uint32_t dataLength);    
+    // write within one 32 byte page (AT24C32 page write)
+    boolean writePage(uint32_t address, const byte *data, byte len);
     void dump();
     void restore();
 		void test();
+  private:
+    byte readDevice(uint32_t address);
+    boolean readDevice(uint32_t address, byte *data, uint32_t dataLength);
+    byte readValue;
+#ifdef FLASH_MIRROR
+    boolean mirrorLoaded;
+    byte mirror[EEPROM_SIZE];
+    boolean loadMirror();
+#endif
 };
 
 
@@ -23,93 +23,275 @@
 
 #include "gps.h"
 
-#define _GPRMC_TERM   "GPRMC"
-#define _GPGGA_TERM   "GPGGA"
+// sentence types, talker ID (first two characters) is ignored
+static const char *nmeaSentenceNames[GPS::GPS_SENTENCE_COUNT] = { "GGA", "RMC", "GSA", "VTG" };
+
+// fields parsed from NMEA sentences
+enum { NMEA_TIME, NMEA_VALID, NMEA_LAT, NMEA_NS, NMEA_LON, NMEA_EW, NMEA_QUALITY, NMEA_SATS, NMEA_HDOP,
+  NMEA_ALT, NMEA_SPEED, NMEA_COURSE, NMEA_DATE, NMEA_FIXTYPE, NMEA_PDOP, NMEA_VDOP, NMEA_FIELD_COUNT };
+
+// term number of each field per sentence type (0 = not in sentence)
+// $GPGGA,HHMMSS.ss,BBBB.BBBB,b,LLLLL.LLLL,l,Q,NN,D.D,H.H,h,G.G,g,A.A,RRRR*PP
+// $GPRMC,HHMMSS,A,BBBB.BBBB,b,LLLLL.LLLL,l,GG.G,RR.R,DDMMYY,M.M,m,F*PP
+// $GPGSA,A,F,SV,SV,SV,SV,SV,SV,SV,SV,SV,SV,SV,SV,P.P,H.H,V.V*PP
+// $GPVTG,RR.R,T,RR.R,M,GG.G,N,K.K,K,F*PP
+// BBBB.BBBB 	= Breitengrad in Grad und Minuten (ddmm.mmmmmm)
+// LLLLL.LLLL 	Längengrad in Grad und Minuten (dddmm.mmmmmm)
+static const byte nmeaTermNumber[GPS::GPS_SENTENCE_COUNT][NMEA_FIELD_COUNT] = {
+  // TIME VALID LAT NS LON EW QUALITY SATS HDOP ALT SPEED COURSE DATE FIXTYPE PDOP VDOP
+  {  1,   0,    2,  3, 4,  5, 6,      7,   8,   9,  0,    0,     0,   0,      0,   0  },  // GGA
+  {  1,   2,    3,  4, 5,  6, 0,      0,   0,   0,  7,    8,     9,   0,      0,   0  },  // RMC
+  {  0,   0,    0,  0, 0,  0, 0,      0,   16,  0,  0,    0,     0,   2,      15,  17 },  // GSA
+  {  0,   0,    0,  0, 0,  0, 0,      0,   0,   0,  5,    1,     0,   0,      0,   0  },  // VTG
+};
+
+// UBX frame: sync 0xB5 0x62, class, id, length (2 bytes), payload, checksum (2 bytes)
+#define UBX_SYNC1 0xB5
+#define UBX_SYNC2 0x62
+#define UBX_CLASS_NAV 0x01
+#define UBX_CLASS_CFG 0x06
+#define UBX_NAV_PVT 0x07
+#define UBX_CFG_PRT 0x00
+#define UBX_CFG_MSG 0x01
+#define UBX_CFG_RATE 0x08
+
+enum { UBX_IDLE, UBX_SYNC, UBX_CLASS, UBX_ID, UBX_LEN1, UBX_LEN2, UBX_PAYLOAD, UBX_CK_A, UBX_CK_B };
 
 GPS::GPS()
   :  _time(GPS_INVALID_TIME)
   ,  _date(GPS_INVALID_DATE)
-  ,  _latitude(GPS_INVALID_ANGLE)
-  ,  _longitude(GPS_INVALID_ANGLE)
+  ,  _latitude(GPS_INVALID_ANGLE_E7)
+  ,  _longitude(GPS_INVALID_ANGLE_E7)
   ,  _altitude(GPS_INVALID_ALTITUDE)
   ,  _speed(GPS_INVALID_SPEED)
   ,  _course(GPS_INVALID_ANGLE)
   ,  _hdop(GPS_INVALID_HDOP)
   ,  _numsats(GPS_INVALID_SATELLITES)
+  ,  _pdop(GPS_INVALID_HDOP)
+  ,  _vdop(GPS_INVALID_HDOP)
+  ,  _fixtype(GPS_INVALID_FIX_TYPE)
+  ,  _hacc(GPS_INVALID_ACCURACY)
+  ,  _vacc(GPS_INVALID_ACCURACY)
+  ,  _origin_lat(GPS_INVALID_ANGLE_E7)
+  ,  _origin_lon(GPS_INVALID_ANGLE_E7)
+  ,  _enu_scale_east(0)
+  ,  _enu_scale_north(0)
   ,  _last_time_fix(GPS_INVALID_FIX_TIME)
   ,  _last_position_fix(GPS_INVALID_FIX_TIME)
-  ,  _parity(0)
-  ,  _is_checksum_term(false)
-  ,  _sentence_type(_GPS_SENTENCE_OTHER)
-  ,  _term_number(0)
-  ,  _term_offset(0)
-  ,  _gps_data_good(false)
+  ,  _line_len(0)
+  ,  _term_count(0)
+  ,  _ubx_state(UBX_IDLE)
 #ifndef _GPS_NO_STATS
   ,  _encoded_characters(0)
   ,  _good_sentences(0)
   ,  _failed_checksum(0)
+  ,  _passed_checksum(0)
 #endif
 {
-  _term[0] = '\0';
+  _line[0] = '\0';
+  memset(&pvt, 0, sizeof pvt);
+  sentenceFilter = (1 << GPS_SENTENCE_COUNT) - 1;
 }
 
 //
 // public methods
 //
 
-void GPS::init(){
-  Serial3.begin(9600);
+void GPS::init(boolean ubx){
+  Serial3.begin(GPS_NMEA_BAUDRATE);
+  if (!ubx) return;
+  // UART1: 8N1, GPS_UBX_BAUDRATE, input UBX+NMEA, output UBX only
+  const unsigned long baud = GPS_UBX_BAUDRATE;
+  const byte prt[20] = { 1, 0, 0, 0,  0xD0, 0x08, 0, 0,
+    (byte)baud, (byte)(baud >> 8), (byte)(baud >> 16), (byte)(baud >> 24),
+    0x03, 0, 0x01, 0,  0, 0, 0, 0 };
+  // the module keeps its port settings over an Arduino reset, so configure it at both baudrates
+  send_ubx(UBX_CLASS_CFG, UBX_CFG_PRT, prt, sizeof prt);
+  Serial3.flush();
+  delay(100);
+  Serial3.begin(GPS_UBX_BAUDRATE);
+  send_ubx(UBX_CLASS_CFG, UBX_CFG_PRT, prt, sizeof prt);
+  Serial3.flush();
+  delay(100);
+  // measurement rate (ms), one solution per measurement, GPS time
+  const byte rate[6] = { (byte)GPS_UBX_RATE, (byte)(GPS_UBX_RATE >> 8), 1, 0, 1, 0 };
+  send_ubx(UBX_CLASS_CFG, UBX_CFG_RATE, rate, sizeof rate);
+  // NAV-PVT on every solution (current port)
+  const byte msg[3] = { UBX_CLASS_NAV, UBX_NAV_PVT, 1 };
+  send_ubx(UBX_CLASS_CFG, UBX_CFG_MSG, msg, sizeof msg);
+  // drop anything received during reconfiguration
+  while (Serial3.available()) Serial3.read();
 }
 
+void GPS::send_ubx(byte msgClass, byte msgId, const byte *payload, unsigned short len){
+  byte header[6] = { UBX_SYNC1, UBX_SYNC2, msgClass, msgId, (byte)len, (byte)(len >> 8) };
+  byte ck_a = 0, ck_b = 0;
+  for (int i=2; i < 6; i++){
+    ck_a += header[i];
+    ck_b += ck_a;
+  }
+  for (int i=0; i < len; i++){
+    ck_a += payload[i];
+    ck_b += ck_a;
+  }
+  Serial3.write(header, sizeof header);
+  Serial3.write(payload, len);
+  Serial3.write(ck_a);
+  Serial3.write(ck_b);
+}
+
+// reads all received characters in chunks, returns true if a valid sentence was parsed
 boolean GPS::feed(){
-  while (Serial3.available())
+  boolean res = false;
+  char buf[GPS_READ_CHUNK];
+  int n;
+  while ((n = Serial3.available()) > 0)
   {
-    if (encode(Serial3.read()))
-      return true;
+    n = Serial3.readBytes(buf, min(n, GPS_READ_CHUNK));
+    for (int i=0; i < n; i++)
+    {
+      // UBX frames start with 0xB5 which never appears in NMEA text
+      if ((_ubx_state != UBX_IDLE) || ((byte)buf[i] == UBX_SYNC1))
+      {
+        if (encodeUBX(buf[i]))
+          res = true;
+      }
+      else if (encode(buf[i]))
+        res = true;
+    }
   }  
-  return false;
+  return res;
 }
 
+// collects one sentence, the complete sentence is parsed at end of line
 bool GPS::encode(char c)
 {
-  bool valid_sentence = false;
-
 #ifndef _GPS_NO_STATS
   ++_encoded_characters;
 #endif
   switch(c)
   {
-  case ',': // term terminators
-    _parity ^= c;
+  case '$': // sentence begin
+    _line_len = 0;
+    break;
   case '\r':
   case '\n':
-  case '*':
-    if (_term_offset < sizeof(_term))
+    if (_line_len == 0) return false;
+    _line[_line_len] = 0;
+    _line_len = 0;
+    return parse_sentence();
+  }
+  if (_line_len < GPS_LINE_SIZE - 1)
+    _line[_line_len++] = c;
+  else
+    _line[0] = 0;  // too long, invalid until next '$'
+  return false;
+}
+
+// UBX receiver, payload of NAV-PVT is received directly into its struct
+bool GPS::encodeUBX(byte c)
+{
+#ifndef _GPS_NO_STATS
+  ++_encoded_characters;
+#endif
+  if ((_ubx_state >= UBX_CLASS) && (_ubx_state <= UBX_PAYLOAD))
+  {
+    _ubx_ck_a += c;
+    _ubx_ck_b += _ubx_ck_a;
+  }
+  switch (_ubx_state)
+  {
+  case UBX_IDLE:
+    if (c == UBX_SYNC1) _ubx_state = UBX_SYNC;
+    break;
+  case UBX_SYNC:
+    _ubx_state = (c == UBX_SYNC2) ? UBX_CLASS : UBX_IDLE;
+    _ubx_ck_a = _ubx_ck_b = 0;
+    break;
+  case UBX_CLASS:
+    _ubx_class = c;
+    _ubx_state = UBX_ID;
+    break;
+  case UBX_ID:
+    _ubx_id = c;
+    _ubx_state = UBX_LEN1;
+    break;
+  case UBX_LEN1:
+    _ubx_len = c;
+    _ubx_state = UBX_LEN2;
+    break;
+  case UBX_LEN2:
+    _ubx_len |= (unsigned short)c << 8;
+    _ubx_pos = 0;
+    if (_ubx_len > GPS_UBX_MAX_LEN) _ubx_state = UBX_IDLE;  // corrupt length
+    else _ubx_state = (_ubx_len == 0) ? UBX_CK_A : UBX_PAYLOAD;
+    break;
+  case UBX_PAYLOAD:
+    // other messages are skipped (only checksummed)
+    if (_ubx_pos < sizeof _ubx_payload.raw) _ubx_payload.raw[_ubx_pos] = c;
+    if (++_ubx_pos == _ubx_len) _ubx_state = UBX_CK_A;
+    break;
+  case UBX_CK_A:
+    _ubx_state = (c == _ubx_ck_a) ? UBX_CK_B : UBX_IDLE;
+#ifndef _GPS_NO_STATS
+    if (_ubx_state == UBX_IDLE) ++_failed_checksum;
+#endif
+    break;
+  case UBX_CK_B:
+    _ubx_state = UBX_IDLE;
+    if (c != _ubx_ck_b)
     {
-      _term[_term_offset] = 0;
-      valid_sentence = term_complete();
+#ifndef _GPS_NO_STATS
+      ++_failed_checksum;
+#endif
+      return false;
     }
-    ++_term_number;
-    _term_offset = 0;
-    _is_checksum_term = c == '*';
-    return valid_sentence;
-
-  case '$': // sentence begin
-    _term_number = _term_offset = 0;
-    _parity = 0;
-    _sentence_type = _GPS_SENTENCE_OTHER;
-    _is_checksum_term = false;
-    _gps_data_good = false;
-    return valid_sentence;
+#ifndef _GPS_NO_STATS
+    ++_passed_checksum;
+#endif
+    if ((_ubx_class == UBX_CLASS_NAV) && (_ubx_id == UBX_NAV_PVT) && (_ubx_len >= GPS_UBX_NAV_PVT_MIN_LEN))
+      return parse_nav_pvt();
+    break;
   }
+  return false;
+}
 
-  // ordinary characters
-  if (_term_offset < sizeof(_term) - 1)
-    _term[_term_offset++] = c;
-  if (!_is_checksum_term)
-    _parity ^= c;
-
-  return valid_sentence;
+// takes over a checksum tested NAV-PVT message
+bool GPS::parse_nav_pvt()
+{
+  if (_ubx_len < GPS_UBX_NAV_PVT_LEN)
+    memset(_ubx_payload.raw + _ubx_len, 0, GPS_UBX_NAV_PVT_LEN - _ubx_len);
+  pvt = _ubx_payload.pvt;
+#ifndef _GPS_NO_STATS
+  ++_good_sentences;
+#endif
+  unsigned long now = millis();
+  if ((pvt.valid & 0x03) == 0x03)
+  {
+    // nano may be negative (rounded time), then hundredths are 0
+    long hundredths = pvt.nano / 10000000L;
+    if (hundredths < 0) hundredths = 0;
+    _time = ((pvt.hour * 100UL + pvt.min) * 100UL + pvt.sec) * 100UL + hundredths;
+    _date = (pvt.day * 100UL + pvt.month) * 100UL + (pvt.year % 100);
+    _last_time_fix = now;
+  }
+  _numsats = pvt.numSV;
+  _pdop = pvt.pDOP;
+  _hacc = pvt.hAcc;
+  _vacc = pvt.vAcc;
+  if (((pvt.flags & 0x01) == 0) || (pvt.fixType < 2) || (pvt.fixType > 4))
+  {
+    _fixtype = 1;
+    return false;
+  }
+  _fixtype = (pvt.fixType == 2) ? 2 : 3;
+  _latitude = pvt.lat;
+  _longitude = pvt.lon;
+  _altitude = pvt.hMSL / 10;              // cm
+  _speed = ((unsigned long)pvt.gSpeed * 3600 + 9260) / 18520; // 100ths of a knot (1852 m/h)
+  _course = (pvt.headMot + 500) / 1000;   // 100ths of a degree
+  _last_position_fix = now;
+  return true;
 }
 
 #ifndef _GPS_NO_STATS
@@ -134,9 +316,8 @@ int GPS::from_hex(char a)
     return a - '0';
 }
 
-unsigned long GPS::parse_decimal()
+unsigned long GPS::parse_decimal(const char *p)
 {
-  char *p = _term;
   bool isneg = *p == '-';
   if (isneg) ++p;  // skip heading '-'
     
@@ -154,151 +335,110 @@ unsigned long GPS::parse_decimal()
   return isneg ? -ret : ret; // negate result if isneg is set
 }
 
-unsigned long GPS::parse_degrees()  // term=5000.0095 (50° 00' 0.0095*60'')
-{                                        // (D)DDMM.MMMM is the format
-  char *p;
-  unsigned long left = gpsatol(_term); // get (D)DDMM in left 
-  unsigned long tenk_minutes = (left % 100UL) * 10000UL; // get MM*10000
-  for (p=_term; gpsisdigit(*p); ++p);  // advance to '.'
+unsigned long GPS::parse_degrees(const char *p)  // term=5000.0095 (50° 00' 0.0095*60'')
+{                                                 // (D)DDMM.MMMMMM is the format
+  unsigned long left = gpsatol(p); // get (D)DDMM in left 
+  unsigned long minutes_e6 = (left % 100UL) * 1000000UL; // get MM*1000000
+  while (gpsisdigit(*p)) ++p;  // advance to '.'
   if (*p == '.')
   {
-    unsigned long mult = 1000;
-    while (gpsisdigit(*++p))
+    unsigned long mult = 100000;
+    while ((mult > 0) && (gpsisdigit(*++p)))
     {
-      tenk_minutes += mult * (*p - '0');
+      minutes_e6 += mult * (*p - '0');
       mult /= 10;
     }
   }    
-  return (left / 100) * 100000 + tenk_minutes / 6; // DDD * 100000 + tenk_minutes/6=°*10*10000 
+  return (left / 100) * 10000000UL + (minutes_e6 + 3) / 6; // DDD * 1e7 + minutes * 1e6 / 60 * 10
 }
 
-// Sample sentences:
-// $GPRMC,HHMMSS,A,BBBB.BBBB,b,LLLLL.LLLL,l,GG.G,RR.R,DDMMYY,M.M,m,F*PP
-// $GPGGA,HHMMSS.ss,BBBB.BBBB,b,LLLLL.LLLL,l,Q,NN,D.D,H.H,h,G.G,g,A.A,RRRR*PP
-// BBBB.BBBB 	= Breitengrad in Grad und Minuten (ddmm.mmmmmm)
-// LLLLL.LLLL 	Längengrad in Grad und Minuten (dddmm.mmmmmm)
-
-#define COMBINE(sentence_type, term_number) (((unsigned)(sentence_type) << 5) | term_number)
+// term of a field in the current sentence (NULL if not in sentence or empty)
+const char *GPS::field(byte sentence, byte field)
+{
+  byte idx = nmeaTermNumber[sentence][field];
+  if ((idx == 0) || (idx >= _term_count) || (_terms[idx][0] == 0)) return NULL;
+  return _terms[idx];
+}
 
-// Processes a just-completed term
-// Returns true if new sentence has just passed checksum test and is validated
-bool GPS::term_complete()
+// Validates and parses the sentence in _line ($...*PP), terms are split in place (no copies)
+// Returns true if the sentence passed the checksum test and is validated
+bool GPS::parse_sentence()
 {
-  //Console.println("compl");
-  if (_is_checksum_term)
+  if (_line[0] != '$') return false;
+  // checksum: XOR of all characters between '$' and '*'
+  byte parity = 0;
+  char *p = _line + 1;
+  while ((*p) && (*p != '*')) parity ^= *p++;
+  if ((*p != '*') || (16 * from_hex(p[1]) + from_hex(p[2]) != parity))
   {
-    byte checksum = 16 * from_hex(_term[0]) + from_hex(_term[1]);
-    //Console.print(checksum);
-    //Console.print(",");
-    //Console.println(_parity);
-    if (checksum == _parity)
-    {
-      //if (1==1) 
-      if (_gps_data_good)
-      {
-#ifndef _GPS_NO_STATS
-        ++_good_sentences;
-#endif
-        _last_time_fix = _new_time_fix;
-        _last_position_fix = _new_position_fix;
-
-        switch(_sentence_type)
-        {
-        case _GPS_SENTENCE_GPRMC:
-          _time      = _new_time;
-          _date      = _new_date;
-          _latitude  = _new_latitude;
-          _longitude = _new_longitude;
-          _speed     = _new_speed;
-          _course    = _new_course;
-          break;
-        case _GPS_SENTENCE_GPGGA:
-          _altitude  = _new_altitude;
-          _time      = _new_time;
-          _latitude  = _new_latitude;
-          _longitude = _new_longitude;
-          _numsats   = _new_numsats;
-          _hdop      = _new_hdop;
-          break;
-        }
-
-        return true;
-      }
-    }
-
 #ifndef _GPS_NO_STATS
-    else
-      ++_failed_checksum;
+    ++_failed_checksum;
 #endif
     return false;
   }
+  *p = 0;
+#ifndef _GPS_NO_STATS
+  ++_passed_checksum;
+#endif
 
   // the first term determines the sentence type
-  if (_term_number == 0)
+  const char *name = _line + 1;
+  if (strlen(name) < 5) return false;
+  byte sentence = 0;
+  while ((sentence < GPS_SENTENCE_COUNT) && (strncmp(name + 2, nmeaSentenceNames[sentence], 3) != 0)) sentence++;
+  if (sentence == GPS_SENTENCE_COUNT) return false;
+  if ((sentenceFilter & (1 << sentence)) == 0) return false;
+
+  // split terms
+  _term_count = 0;
+  p = _line + 1;
+  _terms[_term_count++] = p;
+  while ((*p) && (_term_count < GPS_MAX_TERMS))
   {
-    if (!gpsstrcmp(_term, _GPRMC_TERM))
-      _sentence_type = _GPS_SENTENCE_GPRMC;
-    else if (!gpsstrcmp(_term, _GPGGA_TERM))
-      _sentence_type = _GPS_SENTENCE_GPGGA;
-    else
-      _sentence_type = _GPS_SENTENCE_OTHER;
-    return false;
+    if (*p == ',')
+    {
+      *p = 0;
+      _terms[_term_count++] = p + 1;
+    }
+    p++;
   }
 
-  if (_sentence_type != _GPS_SENTENCE_OTHER && _term[0])
-    switch(COMBINE(_sentence_type, _term_number))
+  // RMC: A=valid, GGA: fix quality 0=invalid, 1=GPS fix, 2=DGPS fix, 6=estimation
+  const char *t;
+  if ((t = field(sentence, NMEA_VALID)) && (*t != 'A')) return false;
+  if ((t = field(sentence, NMEA_QUALITY)) && (*t <= '0')) return false;
+#ifndef _GPS_NO_STATS
+  ++_good_sentences;
+#endif
+
+  unsigned long now = millis();
+  if ((t = field(sentence, NMEA_TIME)))
   {
-    case COMBINE(_GPS_SENTENCE_GPRMC, 1): // Time in both sentences
-    case COMBINE(_GPS_SENTENCE_GPGGA, 1):
-      _new_time = parse_decimal();
-      _new_time_fix = millis();
-      break;
-    case COMBINE(_GPS_SENTENCE_GPRMC, 2): // GPRMC validity
-      _gps_data_good = _term[0] == 'A';
-      break;
-    case COMBINE(_GPS_SENTENCE_GPRMC, 3): // Latitude
-    case COMBINE(_GPS_SENTENCE_GPGGA, 2):
-      _new_latitude = parse_degrees();
-      _new_position_fix = millis();
-      break;
-    case COMBINE(_GPS_SENTENCE_GPRMC, 4): // N/S
-    case COMBINE(_GPS_SENTENCE_GPGGA, 3):
-      if (_term[0] == 'S')
-        _new_latitude = -_new_latitude;
-      break;
-    case COMBINE(_GPS_SENTENCE_GPRMC, 5): // Longitude
-    case COMBINE(_GPS_SENTENCE_GPGGA, 4):
-      _new_longitude = parse_degrees();
-      break;
-    case COMBINE(_GPS_SENTENCE_GPRMC, 6): // E/W
-    case COMBINE(_GPS_SENTENCE_GPGGA, 5):
-      if (_term[0] == 'W')
-        _new_longitude = -_new_longitude;
-      break;
-    case COMBINE(_GPS_SENTENCE_GPRMC, 7): // Speed (GPRMC)
-      _new_speed = parse_decimal();
-      break;
-    case COMBINE(_GPS_SENTENCE_GPRMC, 8): // Course (GPRMC)
-      _new_course = parse_decimal();
-      break;
-    case COMBINE(_GPS_SENTENCE_GPRMC, 9): // Date (GPRMC)
-      _new_date = gpsatol(_term);
-      break;
-    case COMBINE(_GPS_SENTENCE_GPGGA, 6): // Fix data (GPGGA) ; 0=invalid, 1=GPS fix, 2=DGPS fix, 6=estimation
-      _gps_data_good = _term[0] > '0';
-      break;
-    case COMBINE(_GPS_SENTENCE_GPGGA, 7): // NN-Satellites used (GPGGA): 00-12
-      _new_numsats = (unsigned char)atoi(_term);
-      break;
-    case COMBINE(_GPS_SENTENCE_GPGGA, 8): // D.D - HDOP (GPGGA) - horizontal deviation
-      _new_hdop = parse_decimal();
-      break;
-    case COMBINE(_GPS_SENTENCE_GPGGA, 9): // H.H - Altitude (GPGGA)
-      _new_altitude = parse_decimal();
-      break;
+    _time = parse_decimal(t);
+    _last_time_fix = now;
   }
-
-  return false;
+  const char *lat = field(sentence, NMEA_LAT);
+  const char *lon = field(sentence, NMEA_LON);
+  if ((lat) && (lon))
+  {
+    _latitude = parse_degrees(lat);
+    if ((t = field(sentence, NMEA_NS)) && (*t == 'S'))
+      _latitude = -_latitude;
+    _longitude = parse_degrees(lon);
+    if ((t = field(sentence, NMEA_EW)) && (*t == 'W'))
+      _longitude = -_longitude;
+    _last_position_fix = now;
+  }
+  if ((t = field(sentence, NMEA_SATS)))    _numsats = (unsigned char)atoi(t);
+  if ((t = field(sentence, NMEA_HDOP)))    _hdop = parse_decimal(t);
+  if ((t = field(sentence, NMEA_ALT)))     _altitude = parse_decimal(t);
+  if ((t = field(sentence, NMEA_SPEED)))   _speed = parse_decimal(t);
+  if ((t = field(sentence, NMEA_COURSE)))  _course = parse_decimal(t);
+  if ((t = field(sentence, NMEA_DATE)))    _date = gpsatol(t);
+  if ((t = field(sentence, NMEA_FIXTYPE))) _fixtype = *t - '0';
+  if ((t = field(sentence, NMEA_PDOP)))    _pdop = parse_decimal(t);
+  if ((t = field(sentence, NMEA_VDOP)))    _vdop = parse_decimal(t);
+  return true;
 }
 
 long GPS::gpsatol(const char *str) // convert string to long - does only work for unsigned ints!
@@ -318,6 +458,25 @@ int GPS::gpsstrcmp(const char *str1, const char *str2)
   return *str1;
 }
 
+void GPS::set_origin(long lat_e7, long lon_e7)
+{
+  _origin_lat = lat_e7;
+  _origin_lon = lon_e7;
+  // meters per degree on WGS84 ellipsoid at origin latitude
+  float lat = radians(lat_e7 / 10000000.0);
+  float northPerDeg = 111132.92 - 559.82 * cos(2 * lat) + 1.175 * cos(4 * lat);
+  float eastPerDeg = 111412.84 * cos(lat) - 93.5 * cos(3 * lat) + 0.118 * cos(5 * lat);
+  // m per degree => mm per 1e-7 degree (Q16): * 1000 / 1e7 * 65536
+  _enu_scale_north = (long)(northPerDeg * 6.5536 + 0.5);
+  _enu_scale_east = (long)(eastPerDeg * 6.5536 + 0.5);
+}
+
+void GPS::to_enu(long lat_e7, long lon_e7, long *east, long *north)
+{
+  if (east) *east = ((int64_t)(lon_e7 - _origin_lon) * _enu_scale_east) >> 16;
+  if (north) *north = ((int64_t)(lat_e7 - _origin_lat) * _enu_scale_north) >> 16;
+}
+
 /* static */
 float GPS::distance_between (float lat1, float long1, float lat2, float long2) 
 { 
@@ -377,6 +536,14 @@ const char *GPS::cardinal (float course)
 
 // lat/long in hundred thousandths of a degree and age of fix in milliseconds
 void GPS::get_position(long *latitude, long *longitude, unsigned long *fix_age)
+{
+  get_position_e7(latitude, longitude, fix_age);
+  if (latitude) *latitude = _latitude == GPS_INVALID_ANGLE_E7 ? GPS_INVALID_ANGLE : _latitude / 100;
+  if (longitude) *longitude = _longitude == GPS_INVALID_ANGLE_E7 ? GPS_INVALID_ANGLE : _longitude / 100;
+}
+
+// lat/long in 1e-7 degree and age of fix in milliseconds
+void GPS::get_position_e7(long *latitude, long *longitude, unsigned long *fix_age)
 {
   if (latitude) *latitude = _latitude;
   if (longitude) *longitude = _longitude;
@@ -396,9 +563,9 @@ GPS_INVALID_AGE : millis() - _last_time_fix;
 void GPS::f_get_position(float *latitude, float *longitude, unsigned long *fix_age)
 {
   long lat, lon;
-  get_position(&lat, &lon, fix_age);
-  *latitude = lat == GPS_INVALID_ANGLE ? GPS_INVALID_F_ANGLE : (lat / 100000.0);
-  *longitude = lon == GPS_INVALID_ANGLE ? GPS_INVALID_F_ANGLE : (lon / 100000.0);
+  get_position_e7(&lat, &lon, fix_age);
+  *latitude = lat == GPS_INVALID_ANGLE_E7 ? GPS_INVALID_F_ANGLE : (lat / 10000000.0);
+  *longitude = lon == GPS_INVALID_ANGLE_E7 ? GPS_INVALID_F_ANGLE : (lon / 10000000.0);
 }
 
 void GPS::crack_datetime(int *year, byte *month, byte *day, 
@@ -23,6 +23,7 @@
 */
 
 //  GPS neo6m  (NMEA-0183 protocol)
+//  u-blox 7/M8 or newer (UBX binary protocol, NAV-PVT message)
 
 
 #ifndef GPS_H
@@ -37,6 +38,61 @@
 #define _GPS_KM_PER_METER 0.001
 // #define _GPS_NO_STATS
 
+// NMEA sentence buffer (max. 82 characters) and max. terms per sentence
+#define GPS_LINE_SIZE 84
+#define GPS_MAX_TERMS 20
+// UART bulk read size
+#define GPS_READ_CHUNK 32
+
+// UBX: baudrate and navigation rate (ms) configured at startup (module default is 9600 baud NMEA)
+#define GPS_NMEA_BAUDRATE 9600
+#define GPS_UBX_BAUDRATE 115200
+#define GPS_UBX_RATE 200
+
+// UBX NAV-PVT payload (u-blox protocol 15+, little-endian like AVR and ARM)
+#define GPS_UBX_NAV_PVT_LEN 92
+// protocol 14 (u-blox 7) sends the first 84 bytes only
+#define GPS_UBX_NAV_PVT_MIN_LEN 84
+// longer messages are treated as corrupt
+#define GPS_UBX_MAX_LEN 512
+
+struct ubx_nav_pvt_t {
+  uint32_t iTOW;     // GPS time of week (ms)
+  uint16_t year;
+  uint8_t  month;
+  uint8_t  day;
+  uint8_t  hour;
+  uint8_t  min;
+  uint8_t  sec;
+  uint8_t  valid;    // bit0: date valid, bit1: time valid
+  uint32_t tAcc;     // time accuracy (ns)
+  int32_t  nano;     // fraction of second (ns), may be negative
+  uint8_t  fixType;  // 0=no fix, 1=dead reckoning, 2=2D, 3=3D, 4=GNSS+DR, 5=time only
+  uint8_t  flags;    // bit0: gnssFixOK
+  uint8_t  flags2;
+  uint8_t  numSV;
+  int32_t  lon;      // 1e-7 degree
+  int32_t  lat;      // 1e-7 degree
+  int32_t  height;   // above ellipsoid (mm)
+  int32_t  hMSL;     // above mean sea level (mm)
+  uint32_t hAcc;     // horizontal accuracy estimate (mm)
+  uint32_t vAcc;     // vertical accuracy estimate (mm)
+  int32_t  velN;     // mm/s
+  int32_t  velE;
+  int32_t  velD;
+  int32_t  gSpeed;   // ground speed (mm/s)
+  int32_t  headMot;  // heading of motion (1e-5 degree)
+  uint32_t sAcc;     // speed accuracy (mm/s)
+  uint32_t headAcc;  // heading accuracy (1e-5 degree)
+  uint16_t pDOP;     // 0.01
+  uint8_t  flags3;
+  uint8_t  reserved1[5];
+  int32_t  headVeh;  // heading of vehicle (1e-5 degree)
+  int16_t  magDec;
+  uint16_t magAcc;
+} __attribute__((packed));
+typedef struct ubx_nav_pvt_t ubx_nav_pvt_t;
+
 class GPS
 {
 public:
@@ -45,20 +101,31 @@ public:
     GPS_INVALID_ALTITUDE = 999999999,  GPS_INVALID_DATE = 0,
     GPS_INVALID_TIME = 0xFFFFFFFF,		 GPS_INVALID_SPEED = 999999999, 
     GPS_INVALID_FIX_TIME = 0xFFFFFFFF, GPS_INVALID_SATELLITES = 0xFF,
-    GPS_INVALID_HDOP = 0xFFFFFFFF
+    GPS_INVALID_HDOP = 0xFFFFFFFF,     GPS_INVALID_ANGLE_E7 = 0x7FFFFFFF,
+    GPS_INVALID_FIX_TYPE = 0,          GPS_INVALID_ACCURACY = 0xFFFFFFFF
   };
 
+  // supported NMEA sentences (any talker: GP, GN, GL, GA, ...)
+  enum { GPS_SENTENCE_GGA, GPS_SENTENCE_RMC, GPS_SENTENCE_GSA, GPS_SENTENCE_VTG, GPS_SENTENCE_COUNT };
+  // sentence filter bits (1 << GPS_SENTENCE_xxx), other sentences are skipped after checksum test
+  byte sentenceFilter;
+
   static const float GPS_INVALID_F_ANGLE, GPS_INVALID_F_ALTITUDE, GPS_INVALID_F_SPEED;
 
   GPS();
   bool encode(char c); // process one character received from GPS
-  void init();
+  bool encodeUBX(byte c); // process one character of a UBX message
+  // ubx=true: configure u-blox module for UBX NAV-PVT at GPS_UBX_BAUDRATE, otherwise NMEA at GPS_NMEA_BAUDRATE
+  void init(boolean ubx = false);
   boolean feed();
   GPS &operator << (char c) {encode(c); return *this;}
 
   // lat/long in hundred thousandths of a degree and age of fix in milliseconds
   void get_position(long *latitude, long *longitude, unsigned long *fix_age = 0);
 
+  // lat/long in 1e-7 degree and age of fix in milliseconds
+  void get_position_e7(long *latitude, long *longitude, unsigned long *fix_age = 0);
+
   // date as ddmmyy, time as hhmmsscc, and age in milliseconds
   void get_datetime(unsigned long *date, unsigned long *time, unsigned long *age = 0);
 
@@ -77,6 +144,20 @@ public:
   // horizontal dilution of precision in 100ths
   inline unsigned long hdop() { return _hdop; }
 
+  // position and vertical dilution of precision in 100ths (from GSA sentence)
+  inline unsigned long pdop() { return _pdop; }
+  inline unsigned long vdop() { return _vdop; }
+
+  // fix type 1=no fix, 2=2D, 3=3D (from GSA sentence or NAV-PVT)
+  inline byte fix_type() { return _fixtype; }
+
+  // horizontal/vertical accuracy estimate in mm (from NAV-PVT)
+  inline unsigned long h_accuracy() { return _hacc; }
+  inline unsigned long v_accuracy() { return _vacc; }
+
+  // last valid NAV-PVT message
+  ubx_nav_pvt_t pvt;
+
   void f_get_position(float *latitude, float *longitude, unsigned long *fix_age = 0);
   void crack_datetime(int *year, byte *month, byte *day, 
     byte *hour, byte *minute, byte *second, byte *hundredths = 0, unsigned long *fix_age = 0);
@@ -89,6 +170,13 @@ public:
 
   //static int library_version() { return _GPS_VERSION; }
 
+  // local tangent plane (east/north/up) around an origin, flat-earth error is below 1 cm within 1 km
+  void set_origin(long lat_e7, long lon_e7);
+  inline boolean origin_valid() { return _origin_lat != GPS_INVALID_ANGLE_E7; }
+  // east/north in mm relative to origin
+  void to_enu(long lat_e7, long lon_e7, long *east, long *north);
+
+  // great-circle distance (m) and course (degree), use for long range only (trigonometry per call)
   static float distance_between (float lat1, float long1, float lat2, float long2);
   static float course_to (float lat1, float long1, float lat2, float long2);
   static const char *cardinal(float course);
@@ -98,30 +186,43 @@ public:
 #endif
 
 private:
-  enum {_GPS_SENTENCE_GPGGA, _GPS_SENTENCE_GPRMC, _GPS_SENTENCE_OTHER};
-
   // properties
-  unsigned long _time, _new_time;
-  unsigned long _date, _new_date;
-  long _latitude, _new_latitude;
-  long _longitude, _new_longitude;
-  long _altitude, _new_altitude;
-  unsigned long  _speed, _new_speed;
-  unsigned long  _course, _new_course;
-  unsigned long  _hdop, _new_hdop;
-  unsigned short _numsats, _new_numsats;
-
-  unsigned long _last_time_fix, _new_time_fix;
-  unsigned long _last_position_fix, _new_position_fix;
-
-  // parsing state variables
-  byte _parity;
-  bool _is_checksum_term;
-  char _term[15];
-  byte _sentence_type;
-  byte _term_number;
-  byte _term_offset;
-  bool _gps_data_good;
+  // sentences are parsed after the checksum test, so values are set directly
+  unsigned long _time;
+  unsigned long _date;
+  long _latitude;   // 1e-7 degree
+  long _longitude;  // 1e-7 degree
+  long _altitude;
+  unsigned long  _speed;
+  unsigned long  _course;
+  unsigned long  _hdop;
+  unsigned short _numsats;
+  unsigned long  _pdop, _vdop;
+  byte _fixtype;
+  unsigned long  _hacc, _vacc;
+
+  // ENU projection: origin (1e-7 degree) and mm per 1e-7 degree (Q16), computed once per origin
+  long _origin_lat, _origin_lon;
+  long _enu_scale_east, _enu_scale_north;
+
+  unsigned long _last_time_fix;
+  unsigned long _last_position_fix;
+
+  // sentence buffer (terms are split in place)
+  char _line[GPS_LINE_SIZE];
+  byte _line_len;
+  char *_terms[GPS_MAX_TERMS];
+  byte _term_count;
+
+  // UBX message receiver (payload received in place, copied to pvt after checksum test)
+  byte _ubx_state;
+  byte _ubx_class, _ubx_id;
+  unsigned short _ubx_len, _ubx_pos;
+  byte _ubx_ck_a, _ubx_ck_b;
+  union {
+    ubx_nav_pvt_t pvt;
+    byte raw[GPS_UBX_NAV_PVT_LEN];
+  } _ubx_payload;
 
 #ifndef _GPS_NO_STATS
   // statistics
@@ -133,9 +234,12 @@ private:
 
   // internal utilities
   int from_hex(char a);
-  unsigned long parse_decimal();
-  unsigned long parse_degrees();
-  bool term_complete();
+  unsigned long parse_decimal(const char *p);
+  unsigned long parse_degrees(const char *p);
+  const char *field(byte sentence, byte field);
+  bool parse_sentence();
+  bool parse_nav_pvt();
+  void send_ubx(byte msgClass, byte msgId, const byte *payload, unsigned short len);
   bool gpsisdigit(char c) { return c >= '0' && c <= '9'; }
   long gpsatol(const char *str);
   int gpsstrcmp(const char *str1, const char *str2);
@@ -1,6 +1,9 @@
 #include "i2c.h"
-#include <Wire.h>
 #include "config.h"
+#include "drivers.h"
+#ifdef __AVR__
+  #include <util/twi.h>
+#endif
 
 #if defined(__AVR_ATmega328P__)  
   // Nano pins  
@@ -16,7 +19,7 @@
 /**
  * This routine turns off the I2C bus and clears it
  * on return SCA and SCL pins are tri-state inputs.
- * You need to call Wire.begin() after this to re-enable I2C
+ * You need to call I2Cbegin() after this to re-enable I2C
  * This routine does NOT use the Wire library at all.
  *
  * returns 0 if bus cleared
@@ -24,7 +27,7 @@
  *         2 if SDA held low by slave clock stretch for > 2sec
  *         3 if SDA held low after 20 clocks.
  */
-int I2CclearBus() {
+int I2CclearBus(boolean powerUp) {
 #if defined(TWCR) && defined(TWEN)
   TWCR &= ~(_BV(TWEN)); //Disable the Atmel 2-Wire interface so we can control the SDA and SCL pins directly
 #endif
@@ -32,7 +35,7 @@ int I2CclearBus() {
   pinMode(SDA, INPUT_PULLUP); // Make SDA (data) and SCL (clock) pins Inputs with pullup.
   pinMode(SCL, INPUT_PULLUP);
 
-  delay(2500);  // Wait 2.5 secs. This is strictly only necessary on the first power
+  if (powerUp) delay(2500);  // Wait 2.5 secs. This is strictly only necessary on the first power
   // up of the DS3231 module to allow it to initialize properly,
   // but is also assists in reliable programming of FioV3 boards as it gives the
   // IDE a chance to start uploaded the program
@@ -93,7 +96,7 @@ void I2Creset(){
   #endif 
   unsigned long timeout = millis() + 10000;
   while (millis() < timeout){
-    int rtn = I2CclearBus(); // clear the I2C bus first before calling Wire.begin()
+    int rtn = I2CclearBus(true); // clear the I2C bus first before calling I2Cbegin()
     if (rtn == 0) return;
     Console.println(F("I2C bus error. Could not clear (PCB not powered ON or RTC module missing or JCx jumper set for missing I2C module)"));
     if (rtn == 1) {
@@ -106,60 +109,417 @@ void I2Creset(){
   }
 }
 
+// ------ per-device error counters ----------------------------
+struct i2cdevice_t {
+  uint8_t device;
+  uint8_t consecutiveErrors;
+  unsigned int errors;
+};
+
+i2cdevice_t i2cDevices[I2C_MAX_DEVICES];
+volatile uint8_t i2cDeviceCount = 0;  // set after the new entry (read by loop while counted in interrupt)
+
+// lookup only (NULL if device had no transfers yet)
+i2cdevice_t *I2CfindDevice(uint8_t device){
+  for (uint8_t i=0; i < i2cDeviceCount; i++){
+    if (i2cDevices[i].device == device) return &i2cDevices[i];
+  }
+  return NULL;
+}
+
+// counts result of a transfer (TWI interrupt), device gets a counter on its first transfer
+static void I2CcountResult(uint8_t device, boolean ok){
+  i2cdevice_t *d = I2CfindDevice(device);
+  if (d == NULL) {
+    if (i2cDeviceCount == I2C_MAX_DEVICES) return;
+    d = &i2cDevices[i2cDeviceCount];
+    d->device = device;
+    d->consecutiveErrors = 0;
+    d->errors = 0;
+    i2cDeviceCount++;
+  }
+  if (ok) {
+    d->consecutiveErrors = 0;
+    return;
+  }
+  if (d->consecutiveErrors < 255) d->consecutiveErrors++;
+  if (d->errors < 65535) d->errors++;
+}
+
+unsigned int I2CgetErrorCounter(uint8_t device){
+  i2cdevice_t *d = I2CfindDevice(device);
+  return (d == NULL) ? 0 : d->errors;
+}
+
+uint8_t I2CgetConsecutiveErrors(uint8_t device){
+  i2cdevice_t *d = I2CfindDevice(device);
+  return (d == NULL) ? 0 : d->consecutiveErrors;
+}
+
+uint8_t I2CgetDeviceCount(){
+  return i2cDeviceCount;
+}
+
+uint8_t I2CgetDevice(uint8_t index){
+  return (index < i2cDeviceCount) ? i2cDevices[index].device : 0;
+}
+
+
+// ------ transfer engine ----------------------------
+// queue: waiting for the bus, done: finished with callback pending (dispatched by I2Cservice)
+i2ctransfer_t *i2cQueue[I2C_QUEUE_SIZE];
+uint8_t i2cQueueHead = 0;
+volatile uint8_t i2cQueueCount = 0;
+i2ctransfer_t *i2cDone[I2C_QUEUE_SIZE];
+uint8_t i2cDoneHead = 0;
+volatile uint8_t i2cDoneCount = 0;
+i2ctransfer_t * volatile i2cActive = NULL;   // transfer on the bus
+unsigned long i2cActiveStart = 0;
+unsigned long i2cActiveTimeout = 0;
+volatile uint8_t i2cIndex = 0;               // data byte of active transfer
+boolean i2cStarted = false;                  // TWI initialized (I2Cbegin)
+boolean i2cSuspended = false;                // no transfers during bus recovery
+
+static void i2cHwInit();
+static void i2cHwStart(i2ctransfer_t *t);
+static void i2cHwAbort();
+
+// starts next queued transfer if bus is free (interrupts locked)
+static void i2cStartNext(){
+  if ((i2cActive != NULL) || (i2cQueueCount == 0) || (i2cSuspended)) return;
+  i2ctransfer_t *t = i2cQueue[i2cQueueHead];
+  i2cQueueHead = (i2cQueueHead + 1) % I2C_QUEUE_SIZE;
+  i2cQueueCount--;
+  i2cActive = t;
+  i2cIndex = 0;
+  i2cActiveStart = micros();
+  i2cActiveTimeout = I2C_TIMEOUT_US + (unsigned long)t->num * I2C_BYTE_TIMEOUT_US;
+  i2cHwStart(t);
+}
+
+// active transfer finished (TWI interrupt or interrupts locked)
+static void i2cFinish(boolean ok){
+  i2ctransfer_t *t = i2cActive;
+  i2cActive = NULL;
+  t->time = micros();
+  // probes (scanner, device detection) are expected to fail for missing devices
+  if ((t->num != 0) || (t->addressLen != 0)) I2CcountResult(t->device, ok);
+  t->status = (ok) ? I2C_DONE : I2C_FAILED;
+  if (t->callback != NULL){
+    i2cDone[(i2cDoneHead + i2cDoneCount) % I2C_QUEUE_SIZE] = t;
+    i2cDoneCount++;
+  }
+  i2cStartNext();
+}
+
+// aborts a transfer that did not complete in time (slave holding the bus, lost interrupt)
+static void i2cCheckTimeout(){
+  irqstate_t irq = irqLock();
+  if ((i2cActive != NULL) && (micros() - i2cActiveStart > i2cActiveTimeout)) {
+    i2cHwAbort();
+    i2cHwInit();
+    i2cFinish(false);
+  }
+  irqUnlock(irq);
+}
+
+#ifdef __AVR__
+
+  // Mega: TWI state machine, one interrupt per bus event
+  #define TWCR_RUN (_BV(TWEN) | _BV(TWIE) | _BV(TWINT))
+  uint8_t i2cAddrIndex = 0;   // register address byte
+  boolean i2cReadPhase = false;
+
+  static void i2cHwInit(){
+    TWCR = 0;
+    digitalWrite(SDA, HIGH);  // internal pull-ups
+    digitalWrite(SCL, HIGH);
+    TWSR = 0;  // prescaler 1
+    TWBR = ((F_CPU / I2C_CLOCK) - 16) / 2;
+    TWCR = _BV(TWEN);
+  }
+
+  static void i2cHwStart(i2ctransfer_t *t){
+    i2cAddrIndex = 0;
+    i2cReadPhase = (t->read) && (t->addressLen == 0);
+    TWCR = TWCR_RUN | _BV(TWSTA);
+  }
+
+  static void i2cHwAbort(){
+    TWCR = 0;  // releases the bus
+  }
+
+  static void i2cHwStop(){
+    TWCR = _BV(TWEN) | _BV(TWINT) | _BV(TWSTO);
+    // stop condition takes about 10 us, next transfer may not start before
+    for (uint16_t i=0; (TWCR & _BV(TWSTO)) && (i < 2000); i++);
+  }
+
+  ISR(TWI_vect){
+    i2ctransfer_t *t = i2cActive;
+    if (t == NULL) {
+      i2cHwStop();
+      return;
+    }
+    switch (TW_STATUS){
+      case TW_START:
+      case TW_REP_START:
+        TWDR = (t->device << 1) | ((i2cReadPhase) ? TW_READ : TW_WRITE);
+        TWCR = TWCR_RUN;
+        break;
+      case TW_MT_SLA_ACK:
+      case TW_MT_DATA_ACK:
+        if (i2cAddrIndex < t->addressLen) {
+          // register address, MSB first
+          TWDR = (i2cAddrIndex + 1 < t->addressLen) ? (t->address >> 8) : (t->address & 0xFF);
+          i2cAddrIndex++;
+          TWCR = TWCR_RUN;
+        } else if (t->read) {
+          i2cReadPhase = true;
+          TWCR = TWCR_RUN | _BV(TWSTA);  // repeated start
+        } else if (i2cIndex < t->num) {
+          TWDR = t->buff[i2cIndex++];
+          TWCR = TWCR_RUN;
+        } else {
+          i2cHwStop();
+          i2cFinish(true);
+        }
+        break;
+      case TW_MR_SLA_ACK:
+        TWCR = TWCR_RUN | ((t->num > 1) ? _BV(TWEA) : 0);
+        break;
+      case TW_MR_DATA_ACK:
+        t->buff[i2cIndex++] = TWDR;
+        TWCR = TWCR_RUN | ((i2cIndex + 1 < t->num) ? _BV(TWEA) : 0);
+        break;
+      case TW_MR_DATA_NACK:
+        // last byte
+        t->buff[i2cIndex++] = TWDR;
+        i2cHwStop();
+        i2cFinish(true);
+        break;
+      default:
+        // address or data not acknowledged, arbitration lost, bus error
+        i2cHwStop();
+        i2cFinish(false);
+        break;
+    }
+  }
+
+#else
+
+  // Due: TWI1 (SDA/SCL pins 20/21), data moved by the PDC; interrupts at end of PDC transfer,
+  // for the last bytes (stop condition must be set before the last byte) and on completion
+  static void i2cHwInit(){
+    Twi *twi = WIRE_INTERFACE;
+    pmc_enable_periph_clk(WIRE_INTERFACE_ID);
+    PIO_Configure(g_APinDescription[PIN_WIRE_SDA].pPort, g_APinDescription[PIN_WIRE_SDA].ulPinType,
+      g_APinDescription[PIN_WIRE_SDA].ulPin, g_APinDescription[PIN_WIRE_SDA].ulPinConfiguration);
+    PIO_Configure(g_APinDescription[PIN_WIRE_SCL].pPort, g_APinDescription[PIN_WIRE_SCL].ulPinType,
+      g_APinDescription[PIN_WIRE_SCL].ulPin, g_APinDescription[PIN_WIRE_SCL].ulPinConfiguration);
+    NVIC_DisableIRQ(WIRE_ISR_ID);
+    NVIC_ClearPendingIRQ(WIRE_ISR_ID);
+    twi->TWI_PTCR = TWI_PTCR_RXTDIS | TWI_PTCR_TXTDIS;
+    TWI_ConfigureMaster(twi, I2C_CLOCK, VARIANT_MCK);
+    twi->TWI_IDR = 0xFFFFFFFF;
+    NVIC_EnableIRQ(WIRE_ISR_ID);
+  }
+
+  static void i2cHwStart(i2ctransfer_t *t){
+    Twi *twi = WIRE_INTERFACE;
+    // register address is sent by the TWI itself (internal address), reads with repeated start
+    twi->TWI_MMR = 0;
+    twi->TWI_MMR = TWI_MMR_DADR(t->device) | ((uint32_t)t->addressLen << TWI_MMR_IADRSZ_Pos) | ((t->read) ? TWI_MMR_MREAD : 0);
+    twi->TWI_IADR = 0;
+    twi->TWI_IADR = t->address;
+    if (t->read) {
+      if (t->num >= 3) {
+        twi->TWI_RPR = (uint32_t)t->buff;
+        twi->TWI_RCR = t->num - 2;
+        twi->TWI_PTCR = TWI_PTCR_RXTEN;
+        twi->TWI_CR = TWI_CR_START;
+        twi->TWI_IER = TWI_IER_ENDRX | TWI_IER_NACK;
+      } else {
+        twi->TWI_CR = (t->num == 1) ? (TWI_CR_START | TWI_CR_STOP) : TWI_CR_START;
+        twi->TWI_IER = TWI_IER_RXRDY | TWI_IER_NACK;
+      }
+    } else if (t->num == 0) {
+      twi->TWI_CR = TWI_CR_QUICK;  // probe: device address only
+      twi->TWI_IER = TWI_IER_TXCOMP | TWI_IER_NACK;
+    } else if (t->num == 1) {
+      twi->TWI_THR = t->buff[0];
+      twi->TWI_CR = TWI_CR_STOP;
+      twi->TWI_IER = TWI_IER_TXCOMP | TWI_IER_NACK;
+    } else {
+      twi->TWI_TPR = (uint32_t)t->buff;
+      twi->TWI_TCR = t->num - 1;
+      twi->TWI_PTCR = TWI_PTCR_TXTEN;
+      twi->TWI_IER = TWI_IER_ENDTX | TWI_IER_NACK;
+    }
+  }
+
+  static void i2cHwAbort(){
+    Twi *twi = WIRE_INTERFACE;
+    twi->TWI_IDR = 0xFFFFFFFF;
+    twi->TWI_PTCR = TWI_PTCR_RXTDIS | TWI_PTCR_TXTDIS;
+  }
+
+  void WIRE_ISR_HANDLER(void){
+    Twi *twi = WIRE_INTERFACE;
+    uint32_t sr = twi->TWI_SR & twi->TWI_IMR;  // NACK is cleared by reading
+    i2ctransfer_t *t = i2cActive;
+    if (t == NULL) {
+      i2cHwAbort();
+      return;
+    }
+    if (sr & TWI_SR_NACK) {
+      i2cHwAbort();
+      i2cFinish(false);
+    } else if (sr & TWI_SR_ENDRX) {
+      // PDC received all but the last two bytes
+      twi->TWI_PTCR = TWI_PTCR_RXTDIS;
+      i2cIndex = t->num - 2;
+      twi->TWI_IDR = TWI_IDR_ENDRX;
+      twi->TWI_IER = TWI_IER_RXRDY;
+    } else if (sr & TWI_SR_RXRDY) {
+      if (i2cIndex + 2 == t->num) twi->TWI_CR = TWI_CR_STOP;
+      t->buff[i2cIndex++] = twi->TWI_RHR;
+      if (i2cIndex == t->num) {
+        twi->TWI_IDR = TWI_IDR_RXRDY;
+        twi->TWI_IER = TWI_IER_TXCOMP;
+      }
+    } else if (sr & TWI_SR_ENDTX) {
+      // PDC sent all but the last byte
+      twi->TWI_PTCR = TWI_PTCR_TXTDIS;
+      twi->TWI_IDR = TWI_IDR_ENDTX;
+      twi->TWI_IER = TWI_IER_TXRDY;
+    } else if (sr & TWI_SR_TXRDY) {
+      twi->TWI_CR = TWI_CR_STOP;
+      twi->TWI_THR = t->buff[t->num - 1];
+      twi->TWI_IDR = TWI_IDR_TXRDY;
+      twi->TWI_IER = TWI_IER_TXCOMP;
+    } else if (sr & TWI_SR_TXCOMP) {
+      twi->TWI_IDR = 0xFFFFFFFF;
+      i2cFinish(true);
+    }
+  }
+
+#endif
+
+void I2Cbegin(){
+  irqstate_t irq = irqLock();
+  i2cStarted = true;
+  i2cHwInit();
+  i2cSuspended = false;
+  i2cStartNext();
+  irqUnlock(irq);
+}
+
+// quick bus recovery at runtime (no power-up wait): active transfer fails, queued ones are continued
+void I2Crecover(){
+  irqstate_t irq = irqLock();
+  i2cSuspended = true;
+  i2cHwAbort();
+  if (i2cActive != NULL) i2cFinish(false);
+  irqUnlock(irq);
+  I2CclearBus(false);
+  I2Cbegin();
+}
+
+void I2Cprepare(i2ctransfer_t *t, uint8_t device, uint8_t address, uint8_t num, uint8_t *buff, boolean read,
+    i2ccallback_t callback, void *context){
+  t->device = device;
+  t->address = address;
+  t->addressLen = 1;
+  t->num = num;
+  t->buff = buff;
+  t->read = read;
+  t->callback = callback;
+  t->context = context;
+  t->status = I2C_IDLE;
+}
+
+boolean I2Csubmit(i2ctransfer_t *t){
+  if (t->status == I2C_QUEUED) return false;
+  if ((t->num == 0) && ((t->read) || (t->addressLen != 0))) return false;
+  if (!i2cStarted) I2Cbegin();
+  irqstate_t irq = irqLock();
+  // done list must hold every transfer with a pending callback
+  if (i2cQueueCount + i2cDoneCount + ((i2cActive != NULL) ? 1 : 0) >= I2C_QUEUE_SIZE) {
+    irqUnlock(irq);
+    return false;
+  }
+  t->status = I2C_QUEUED;
+  i2cQueue[(i2cQueueHead + i2cQueueCount) % I2C_QUEUE_SIZE] = t;
+  i2cQueueCount++;
+  i2cStartNext();
+  irqUnlock(irq);
+  return true;
+}
+
+// waits for a submitted transfer, returns true if done
+boolean I2Cwait(i2ctransfer_t *t){
+  while (t->status == I2C_QUEUED) i2cCheckTimeout();
+  return (t->status == I2C_DONE);
+}
+
+// calls the callbacks of finished transfers (called by loop)
+boolean I2Cservice(){
+  i2cCheckTimeout();
+  uint8_t n = i2cDoneCount;  // callbacks of transfers finishing meanwhile are called next time
+  for (uint8_t i=0; i < n; i++){
+    irqstate_t irq = irqLock();
+    i2ctransfer_t *t = i2cDone[i2cDoneHead];
+    i2cDoneHead = (i2cDoneHead + 1) % I2C_QUEUE_SIZE;
+    i2cDoneCount--;
+    irqUnlock(irq);
+    t->callback(t);
+  }
+  return (n > 0);
+}
+
+
+// ------ blocking transfers (queued, waiting for completion) ----------------------------
+boolean I2Ctransfer(uint8_t device, uint16_t address, uint8_t addressLen, uint8_t num, uint8_t buff[], boolean read){
+  i2ctransfer_t t;
+  I2Cprepare(&t, device, 0, num, buff, read);
+  t.address = address;
+  t.addressLen = addressLen;
+  if (!I2Csubmit(&t)) return false;
+  return I2Cwait(&t);
+}
+
+// true if device acknowledges its address
+boolean I2Cprobe(uint8_t device){
+  return I2Ctransfer(device, 0, 0, 0, NULL, false);
+}
+
 void I2CwriteTo(uint8_t device, uint8_t address, uint8_t val) {
-   Wire.beginTransmission(device); //start transmission to device 
-   Wire.write(address);        // send register address
-   Wire.write(val);        // send value to write
-   Wire.endTransmission(); //end transmission
+  I2Ctransfer(device, address, 1, 1, &val, false);
 }
 
 void I2CwriteToBuf(uint8_t device, uint8_t address, int num, uint8_t buff[]) {
-   Wire.beginTransmission(device); //start transmission to device 
-   Wire.write(address);        // send register address
-   for (int i=0; i < num; i++){
-     Wire.write(buff[i]);        // send value to write
-   }
-   Wire.endTransmission(); //end transmission
+  I2Ctransfer(device, address, 1, num, buff, false);
 }
 
 int I2CreadFrom(uint8_t device, uint8_t address, uint8_t num, uint8_t buff[], int retryCount) {
-  int i = 0;
   for (int j=0; j < retryCount+1; j++){
-    i=0;
-    Wire.beginTransmission(device); //start transmission to device 
-    Wire.write(address);        //sends address to read from
-    Wire.endTransmission(); //end transmission
-  
-    //Wire.beginTransmission(device); //start transmission to device (initiate again)
-    Wire.requestFrom(device, num);    // request 6 bytes from device
-  
-    while(Wire.available())    //device may send less than requested (abnormal)
-    {  
-      buff[i] = Wire.read(); // receive a byte
-      i++;
-    }
-    //Wire.endTransmission(); //end transmission
-    if (num == i) return i;
+    if (I2Ctransfer(device, address, 1, num, buff, true)) return num;
     if (j != retryCount) delay(3);
   }
-  return i;
+  return 0;
 }
 
 
 void I2CScanner(){
-  byte error, address, data;
+  byte address;
   int nDevices = 0;
  
   Console.println("Scanning for I2C devices...");
   for(address = 1; address < 127; address++ )
   {
-      // The i2c_scanner uses the return value of
-      // the Write.endTransmisstion to see if
-      // a device did acknowledge to the address.
-      Wire.beginTransmission(address);
-      error = Wire.endTransmission();
-   
-      if (error == 0)
+      // a device did acknowledge to the address?
+      if (I2Cprobe(address))
       {
         Console.print("I2C device found at address 0x");
         if (address<16)
@@ -180,13 +540,6 @@ void I2CScanner(){
         }
         Console.println(")");
       }
-      else if (error==4)
-      {
-        Console.print("Unknown error at address 0x");
-        if (address<16)
-          Console.print("0");
-        Console.println(address,HEX);
-      }    
   }
   if (nDevices == 0)
     Console.println("No I2C devices found\n");
@@ -7,10 +7,53 @@
 extern "C"{
 #endif
 
+// interrupt driven I2C master (replaces the Wire library, which owns the same TWI interrupt):
+// - transfers are queued (I2Csubmit) and run in the background by the TWI interrupt
+//   (Mega: one interrupt per byte, Due: PDC moves the data, interrupts only at start/end)
+// - the descriptor must stay valid until finished; callbacks are called by I2Cservice() (loop)
+//   with status I2C_DONE or I2C_FAILED, a transfer may be submitted again from its callback
+// - blocking helpers (I2CreadFrom, I2CwriteTo, ...) queue a transfer and wait for it
+#define I2C_CLOCK 100000        // bus clock (Hz), DS1307 is limited to 100 kHz
+#define I2C_QUEUE_SIZE 8
+#define I2C_TIMEOUT_US 5000     // transfer timeout (us) plus I2C_BYTE_TIMEOUT_US per byte
+#define I2C_BYTE_TIMEOUT_US 200
+#define I2C_MAX_DEVICES 8  // devices with error counters
+
+enum { I2C_IDLE, I2C_QUEUED, I2C_DONE, I2C_FAILED };
+
+typedef struct i2ctransfer_t i2ctransfer_t;
+typedef void (*i2ccallback_t)(i2ctransfer_t *t);
+
+struct i2ctransfer_t {
+  uint8_t device;
+  uint16_t address;  // register address (sent before data, or before repeated start for reads)
+  uint8_t addressLen;  // register address bytes (0..2, MSB first)
+  uint8_t num;       // data bytes (read: 1..255, write: 0..255, 0 without address = probe)
+  uint8_t *buff;
+  boolean read;      // read (true) or write (false)
+  i2ccallback_t callback;
+  void *context;     // for the callback
+  unsigned long time;  // micros() at completion
+  volatile uint8_t status;
+};
+
+void I2Cbegin();
+void I2Cprepare(i2ctransfer_t *t, uint8_t device, uint8_t address, uint8_t num, uint8_t *buff, boolean read,
+  i2ccallback_t callback = NULL, void *context = NULL);
+boolean I2Csubmit(i2ctransfer_t *t);
+boolean I2Cwait(i2ctransfer_t *t);
+boolean I2Cservice();
+boolean I2Ctransfer(uint8_t device, uint16_t address, uint8_t addressLen, uint8_t num, uint8_t buff[], boolean read);
+boolean I2Cprobe(uint8_t device);
 void I2CwriteTo(uint8_t device, uint8_t address, uint8_t val);
 void I2CwriteToBuf(uint8_t device, uint8_t address, int num, uint8_t buff[]);
 int I2CreadFrom(uint8_t device, uint8_t address, uint8_t num, uint8_t buff[], int retryCount = 0);
+unsigned int I2CgetErrorCounter(uint8_t device);      // bus errors since power-on
+uint8_t I2CgetConsecutiveErrors(uint8_t device);     // bus errors since last successful transfer
+uint8_t I2CgetDeviceCount();                // devices with error counters (addressed since power-on)
+uint8_t I2CgetDevice(uint8_t index);        // address of counted device 0..I2CgetDeviceCount()-1
 void I2Creset();
+void I2Crecover();
 void I2CScanner();
 
 #ifdef __cplusplus
@@ -18,4 +61,3 @@ void I2CScanner();
 #endif
 
 #endif
-
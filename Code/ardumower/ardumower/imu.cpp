@@ -23,9 +23,9 @@
 
 #include "imu.h"
 #include <Arduino.h>
-#include <Wire.h>
 #include "drivers.h"
 #include "i2c.h"
+#include "fastmath.h"
 #include "config.h"
 #include "flashmem.h"
 #include "buzzer.h"
@@ -42,7 +42,9 @@
 #endif
 
 #define ADDR 600
-#define MAGIC 6
+#define MAGIC 8
+#define MAGIC_MAGCHIP 7  // MPU9250 compass calibration in magnetometer chip axes
+#define MAGIC_MINMAX 6   // calibration data without compass correction matrix
 
 
 struct {
@@ -63,6 +65,7 @@ IMU::IMU(){
   callCounter = 0;  
   errorCounter = 0;
   resetTryCount = 0;
+  readErrorCount = 0;
   imuResetSuccessCounter = 0;
   
   gyroOfs.x=gyroOfs.y=gyroOfs.z=0;  
@@ -70,12 +73,20 @@ IMU::IMU(){
   gyroCounter = 0; 
   useGyroCalibration = false;
   lastGyroTime = millis();
+  nextTimeFifo = 0;
+  sampleTime = 0;
+  fifoOverflowCounter = 0;
+  fifoBusy = false;
+  motionPending = false;
+  motionResult = I2C_IDLE;
+  nextTimeCalib = 0;
+  calibBatch = 0;
+  calibInfoChanged = false;
+  statReset();
   
   accelCounter = 0;
   calibAccAxisCounter = 0;
   useAccCalibration = true; 
-  accPitch = 0;
-  accRoll = 0;
   ypr.yaw=ypr.pitch=ypr.roll = 0;
   
   accMin.x=accMin.y=accMin.z = 0;
@@ -86,6 +97,11 @@ IMU::IMU(){
   
   comScale.x=comScale.y=comScale.z=2;  
   comOfs.x=comOfs.y=comOfs.z=0;    
+  comCorrFromScale();
+  comRaw.x=comRaw.y=comRaw.z=0;
+  comFitOnline = true;
+  nextTimeComFit = 0;
+  comFitStart(true);
   useComCalibration = true;
   type5588 = -1;
 }
@@ -93,12 +109,7 @@ IMU::IMU(){
 // rescale to -PI..+PI
 float IMU::scalePI(float v)
 {
-  float d = v;
-  while (d < 0) d+=2*PI;
-  while (d >= 2*PI) d-=2*PI;
-  if (d >= PI) return (-2*PI+d); 
-  else if (d < -PI) return (2*PI+d);
-  else return d;  
+  return wrapPI(v);
 }
 
 // rescale to -180..+180
@@ -157,19 +168,33 @@ void IMU::loadSaveCalib(boolean readflag){
   eereadwrite(readflag, addr, accScale);    
   eereadwrite(readflag, addr, comOfs);
   eereadwrite(readflag, addr, comScale);      
+  eereadwrite(readflag, addr, comCorr);
 }
 
 void IMU::loadCalib(){
   short magic = 0;
   int addr = ADDR;
   eeread(addr, magic);
-  if (magic != MAGIC) {
+  if ((magic != MAGIC) && (magic != MAGIC_MAGCHIP) && (magic != MAGIC_MINMAX)) {
     Console.println(F("IMU error: no calib data"));
     return;  
   }
   calibrationAvail = true;
   Console.println(F("IMU: found calib data"));
   loadSaveCalib(true);
+  if (magic == MAGIC_MINMAX) comCorrFromScale();
+  #if defined (IMU_MPU9250)
+    if (magic != MAGIC){
+      // compass offsets were taken in another frame: keep accel calibration only
+      Console.println(F("IMU: compass calib outdated - please calibrate compass"));
+      comOfs.x=comOfs.y=comOfs.z=0;
+      comScale.x=comScale.y=comScale.z=2;
+      comCorrFromScale();
+      comFitStart(true);
+      return;
+    }
+  #endif
+  comFitStart(false);
 }
 
 void IMU::saveCalib(){
@@ -183,6 +208,8 @@ void IMU::deleteCalib(){
   accScale.x=accScale.y=accScale.z=2;  
   comOfs.x=comOfs.y=comOfs.z=0;
   comScale.x=comScale.y=comScale.z=2;  
+  comCorrFromScale();
+  comFitStart(true);
   Console.println("IMU calibration deleted");  
 }
 
@@ -204,53 +231,94 @@ void IMU::printCalib(){
   printPt(comOfs);
   Console.print(F("comScale="));
   printPt(comScale);  
+  Console.println(F("comCorr="));
+  for (int i=0; i < 3; i++){
+    point_float_t row = { comCorr[i][0], comCorr[i][1], comCorr[i][2] };
+    printPt(row);
+  }
   Console.println(F("--------"));
 }
 
 
 
-// calculate gyro offsets
-void IMU::calibGyro(){
-  int calibCount = 0;
-  Console.println(F("---calibGyro---"));    
+void IMU::statReset(){
+  statCount = 0;
+  statMean.x = statMean.y = statMean.z = 0;
+  statM2.x = statM2.y = statM2.z = 0;
+}
+
+void IMU::statAdd(point_float_t p){
+  statCount++;
+  float dx = p.x - statMean.x;
+  float dy = p.y - statMean.y;
+  float dz = p.z - statMean.z;
+  statMean.x += dx / statCount;
+  statMean.y += dy / statCount;
+  statMean.z += dz / statCount;
+  statM2.x += dx * (p.x - statMean.x);
+  statM2.y += dy * (p.y - statMean.y);
+  statM2.z += dz * (p.z - statMean.z);
+}
+
+point_float_t IMU::statVariance(){
+  point_float_t v = {0,0,0};
+  if (statCount < 2) return v;
+  v.x = statM2.x / (statCount - 1);
+  v.y = statM2.y / (statCount - 1);
+  v.z = statM2.z / (statCount - 1);
+  return v;
+}
+
+void IMU::setCalibInfo(String info){
+  calibInfo = info;
+  calibInfoChanged = true;
+}
+
+boolean IMU::calibInfoAvail(){
+  boolean res = calibInfoChanged;
+  calibInfoChanged = false;
+  return res;
+}
+
+// back to sensor fusion after calibration
+void IMU::startRun(){
+  state = IMU_RUN;
+  ahrs.reset();
+  lastAHRSTime = millis();
+  #if defined (IMU_MPU9250)
+    MPU.fifoReset();
+  #endif
+}
+
+// calculate gyro offsets (batches of samples until noise is low enough)
+void IMU::calibGyroStart(){
   useGyroCalibration = false;
   gyroOfs.x = gyroOfs.y = gyroOfs.z = 0;
-  point_float_t ofs;
-  while(true){ 
-    calibCount++;
-       
-    float zmin =  99999;
-    float zmax = -99999;  
-    gyroNoise = 0;
-    ofs.x = ofs.y = ofs.z = 0;      
-    for (int i=0; i < 50; i++){
-      delay(10);
-      readGyro();      
-      zmin = min(zmin, gyro.z);
-      zmax = max(zmax, gyro.z);
-      ofs.x += ((float)gyro.x)/ 50.0;
-      ofs.y += ((float)gyro.y)/ 50.0;
-      ofs.z += ((float)gyro.z)/ 50.0;          
-      gyroNoise += sq(gyro.z-gyroOfs.z) /50.0;   // noise is computed with last offset calculation
-    }
-    Console.print(F("gyro calib min="));
-    Console.print(zmin);
-    Console.print(F("\tmax="));    
-    Console.print(zmax);
-    Console.print(F("\tofs="));        
-    Console.print(ofs.z);    
-    Console.print(F("\tnoise="));                
-    Console.println(gyroNoise);  
-    if (gyroNoise < 20) break; // optimum found    
-    gyroOfs = ofs; // new offset found
-    if (calibCount > 100) break; // nothing found here
-  }  
-  useGyroCalibration = true;
-  Console.print(F("counter="));
-  Console.println(gyroCounter);  
-  Console.print(F("ofs="));
-  printPt(gyroOfs);  
-  Console.println(F("------------"));  
+  calibBatch = 0;
+  statReset();
+  nextTimeCalib = 0;
+  state = IMU_CAL_GYRO;
+  setCalibInfo("IMU gyro calib started");
+}
+
+void IMU::calibGyroUpdate(){
+  if (millis() < nextTimeCalib) return;
+  nextTimeCalib = millis() + IMU_CALIB_GYRO_INTERVAL;
+  if ((!readMotion()) || (!readGyro())) return;
+  statAdd(gyro);
+  if (statCount < IMU_CALIB_GYRO_SAMPLES) return;
+  calibBatch++;
+  gyroOfs = statMean;
+  gyroNoise = statVariance().z;
+  if ((gyroNoise < IMU_CALIB_GYRO_NOISE) || (calibBatch >= IMU_CALIB_GYRO_BATCHES)){
+    useGyroCalibration = true;
+    setCalibInfo("IMU gyro calib completed: ofs=" + String(gyroOfs.x) + "," + String(gyroOfs.y) + "," + String(gyroOfs.z)
+      + " noise=" + String(gyroNoise));
+    startRun();
+  } else {
+    setCalibInfo("IMU gyro calib batch " + String(calibBatch) + ": noise=" + String(gyroNoise));
+    statReset();
+  }
 }      
 
 // Acceleration sensor driver
@@ -273,7 +341,7 @@ bool IMU::readAccel(){
       return false;
     }
   #else if defined (IMU_MPU9250)
-    MPU.accelUpdate();
+    // data read by readMotion
   #endif
   // Convert the accelerometer value to G's. 
   // With 10 bits measuring over a +/-4g range we can find how to convert by using the equation:
@@ -351,7 +419,7 @@ boolean IMU::initGyro(){
     MPU.beginGyro(GYRO_FULL_SCALE_2000_DPS);
   #endif
   delay(250);
-  calibGyro();    
+  calibGyroStart();    
   return true;
 }
 
@@ -382,7 +450,7 @@ boolean IMU::readGyro(){
     I2CreadFrom(L3G4200D, 0xA8, sizeof(gyroFifo[0])*countOfData, (uint8_t *)gyroFifo);         // the first bit of the register address specifies we want automatic address increment
     //I2CreadFrom(L3G4200D, 0x28, sizeof(gyroFifo[0])*countOfData, (uint8_t *)gyroFifo);         // the first bit of the register address specifies we want automatic address increment
   #else if defined (IMU_MPU9250)
-    MPU.gyroUpdate();
+    // data read by readMotion
     uint8_t countOfData = 1;
   #endif
   gyro.x = gyro.y = gyro.z = 0;
@@ -406,9 +474,14 @@ boolean IMU::readGyro(){
       }
   }
   if (useGyroCalibration){
-    gyro.x *= 0.07 * PI/180;  // convert to radiant per second
-    gyro.y *= 0.07 * PI/180; 
-    gyro.z *= 0.07 * PI/180;      
+    #if defined (IMU_GY801)
+      const float scale = 0.07 * PI/180;  // 70 mdps/digit
+    #else if defined (IMU_MPU9250)
+      const float scale = PI/180;  // library returns degree per second
+    #endif
+    gyro.x *= scale;  // convert to radiant per second
+    gyro.y *= scale; 
+    gyro.z *= scale;      
   }
   gyroCounter++;
   return true;
@@ -418,10 +491,7 @@ boolean IMU::readGyro(){
 // Compass sensor driver
 void  IMU::initCom(){
 
-Wire.beginTransmission(HMC5883L);
-  int error = Wire.endTransmission();
-
-  if (!error && type5588 == -1) {
+  if (I2Cprobe(HMC5883L) && type5588 == -1) {
       type5588 = HMC5883L;
       Console.println("Found HMC5883L");
   }
@@ -434,7 +504,7 @@ Wire.beginTransmission(HMC5883L);
     I2CwriteTo(HMC5883L, 0x01, 0x20);   // gain
     I2CwriteTo(HMC5883L, 0x02, 00);    // mode         
   #else if defined (IMU_MPU9250)
-    MPU.beginMag(MAG_MODE_CONTINUOUS_100HZ);
+    MPU.beginMagSlave(MAG_MODE_CONTINUOUS_100HZ);
   #endif
 }
 
@@ -456,31 +526,101 @@ bool IMU::readCom(){
     float y = (int16_t) (((uint16_t)buf[4]) << 8 | buf[5]);
     float z = (int16_t) (((uint16_t)buf[2]) << 8 | buf[3]);  
   #else if defined (IMU_MPU9250)
-    MPU.magUpdate();
+    // data read by readMotion
     // scale +1.3Gauss..-1.3Gauss  (*0.00092)  
-    float x = (int16_t) MPU.magX();
-    float y = (int16_t) MPU.magY();
-    float z = (int16_t) MPU.magZ();
+    // AK8963 axes are X=chipY, Y=chipX, Z=-chipZ; accel/gyro arrive as (-chipX, -chipY, chipZ)
+    float x = -(int16_t) MPU.magY();
+    float y = -(int16_t) MPU.magX();
+    float z = -(int16_t) MPU.magZ();
   #endif
+  applyComCalib(x, y, z);
+  return true;
+}
+
+void IMU::applyComCalib(float x, float y, float z){
+  comRaw.x = x;
+  comRaw.y = y;
+  comRaw.z = z;
   if (useComCalibration){
     x -= comOfs.x;
     y -= comOfs.y;
     z -= comOfs.z;
-    x /= comScale.x*0.5;    
-    y /= comScale.y*0.5;    
-    z /= comScale.z*0.5;
-    com.x = x;
-    //Console.println(z);
-    com.y = y;
-    com.z = z;
+    com.x = comCorr[0][0] * x + comCorr[0][1] * y + comCorr[0][2] * z;
+    com.y = comCorr[1][0] * x + comCorr[1][1] * y + comCorr[1][2] * z;
+    com.z = comCorr[2][0] * x + comCorr[2][1] * y + comCorr[2][2] * z;
   } else {
     com.x = x;
     com.y = y;
     com.z = z;
   }  
+}
+
+// min/max calibration: axis scaling only
+void IMU::comCorrFromScale(){
+  for (int i=0; i < 3; i++)
+    for (int j=0; j < 3; j++) comCorr[i][j] = 0;
+  if (comScale.x != 0) comCorr[0][0] = 2.0 / comScale.x;
+  if (comScale.y != 0) comCorr[1][1] = 2.0 / comScale.y;
+  if (comScale.z != 0) comCorr[2][2] = 2.0 / comScale.z;
+}
+
+// ellipsoid fit samples are normalized by a reference calibration (current one, or raw scale)
+void IMU::comFitStart(boolean fromScratch){
+  for (int i=0; i < 3; i++){
+    for (int j=0; j < 3; j++) comFitRefCorr[i][j] = (fromScratch) ? ((i == j) ? 1.0/IMU_COM_REF_SCALE : 0) : comCorr[i][j];
+  }
+  comFitRefOfs[0] = (fromScratch) ? 0 : comOfs.x;
+  comFitRefOfs[1] = (fromScratch) ? 0 : comOfs.y;
+  comFitRefOfs[2] = (fromScratch) ? 0 : comOfs.z;
+  comFitLast.x = comFitLast.y = comFitLast.z = 0;
+  comFit.reset();
+}
+
+void IMU::comFitAdd(){
+  float x = comRaw.x - comFitRefOfs[0];
+  float y = comRaw.y - comFitRefOfs[1];
+  float z = comRaw.z - comFitRefOfs[2];
+  point_float_t u;
+  u.x = comFitRefCorr[0][0] * x + comFitRefCorr[0][1] * y + comFitRefCorr[0][2] * z;
+  u.y = comFitRefCorr[1][0] * x + comFitRefCorr[1][1] * y + comFitRefCorr[1][2] * z;
+  u.z = comFitRefCorr[2][0] * x + comFitRefCorr[2][1] * y + comFitRefCorr[2][2] * z;
+  // skip samples while the sensor does not turn (would weight one direction only)
+  if (abs(u.x - comFitLast.x) + abs(u.y - comFitLast.y) + abs(u.z - comFitLast.z) < IMU_COM_FIT_MIN_DIST) return;
+  comFitLast = u;
+  comFit.add(u.x, u.y, u.z);
+}
+
+// solve ellipsoid fit and move calibration towards it (weight 0..1)
+boolean IMU::comFitApply(float weight){
+  float c[3], w[3][3], refInv[3][3];
+  if (!comFit.solve(c, w)) return false;
+  if (!invert3x3(comFitRefCorr, refInv)) return false;
+  // u = ref * (raw - refOfs), com = w * (u - c) = (w * ref) * (raw - refOfs - ref^-1 * c)
+  float ofs[3], corr[3][3];
+  for (int i=0; i < 3; i++){
+    ofs[i] = comFitRefOfs[i] + refInv[i][0] * c[0] + refInv[i][1] * c[1] + refInv[i][2] * c[2];
+    for (int j=0; j < 3; j++)
+      corr[i][j] = w[i][0] * comFitRefCorr[0][j] + w[i][1] * comFitRefCorr[1][j] + w[i][2] * comFitRefCorr[2][j];
+  }
+  comOfs.x += weight * (ofs[0] - comOfs.x);
+  comOfs.y += weight * (ofs[1] - comOfs.y);
+  comOfs.z += weight * (ofs[2] - comOfs.z);
+  for (int i=0; i < 3; i++)
+    for (int j=0; j < 3; j++) comCorr[i][j] += weight * (corr[i][j] - comCorr[i][j]);
+  comFitStart(false);
   return true;
 }
 
+// online refinement of compass calibration during normal operation (not saved)
+void IMU::comFitUpdate(){
+  if ((!comFitOnline) || (!calibrationAvail) || (!useComCalibration)) return;
+  if (millis() < nextTimeComFit) return;
+  nextTimeComFit = millis() + IMU_COM_FIT_INTERVAL;
+  comFitAdd();
+  if (comFit.count < IMU_COM_FIT_SAMPLES) return;
+  if (!comFitApply(IMU_COM_FIT_BLEND)) comFit.decay(IMU_COM_FIT_DECAY);  // e.g. robot only turned in plane
+}
+
 float IMU::sermin(float oldvalue, float newvalue){
   if (newvalue < oldvalue) {
     Console.print(".");
@@ -498,6 +638,7 @@ float IMU::sermax(float oldvalue, float newvalue){
 }
 
 void IMU::calibComStartStop(){  
+  if ((state == IMU_CAL_GYRO) || (state == IMU_CAL_ACC)) return;
   while (Console.available()) Console.read();  
   if (state == IMU_CAL_COM){
     // stop 
@@ -512,25 +653,26 @@ void IMU::calibComStartStop(){
     comScale.x = xrange;
     comScale.y = yrange;  
     comScale.z = zrange;
+    comCorrFromScale();
+    // ellipsoid fit (hard and soft iron), min/max if samples do not span an ellipsoid
+    boolean fit = comFitApply(1.0);
+    comFitStart(false);
     saveCalib();  
     printCalib();
     useComCalibration = true; 
-    state = IMU_RUN;    
-    // completed sound
-    Buzzer.tone(600);
-    delay(200); 
-    Buzzer.tone(880);
-    delay(200); 
-    Buzzer.tone(1320);              
-    delay(200); 
     Buzzer.noTone();    
-    delay(500);
+    Buzzer.sound(SND_READY);
+    setCalibInfo((fit) ? "IMU com calib completed (ellipsoid)" : "IMU com calib completed (min/max)");
+    startRun();
   } else {
     // start
     Console.println(F("com calib..."));
     Console.println(F("rotate sensor 360 degree around all three axis"));
     foundNewMinMax = false;  
     useComCalibration = false;
+    nextTimeCalib = 0;
+    comFitStart(true);
+    setCalibInfo("IMU com calib started: rotate sensor 360 degree around all three axis");
     state = IMU_CAL_COM;  
     comMin.x = comMin.y = comMin.z = 9999;
     comMax.x = comMax.y = comMax.z = -9999;
@@ -544,10 +686,10 @@ boolean IMU::newMinMaxFound(){
 }  
   
 void IMU::calibComUpdate(){
+  if (millis() < nextTimeCalib) return;
+  nextTimeCalib = millis() + IMU_CALIB_COM_INTERVAL;
   comLast = com;
-  delay(20);
-  readCom();  
-  readMMC5883MA();
+  if (!read()) return;
   
   boolean newfound = false;
   if ( (abs(com.x-comLast.x)<10) &&  (abs(com.y-comLast.y)<10) &&  (abs(com.z-comLast.z)<10) ){
@@ -575,52 +717,40 @@ void IMU::calibComUpdate(){
       comMax.z = com.z;
       newfound = true;      
     }    
+    comFitAdd();
     if (newfound) {      
       foundNewMinMax = true;
       Buzzer.tone(440);
-      Console.print("x:");
-      Console.print(comMin.x);
-      Console.print(",");
-      Console.print(comMax.x);
-      Console.print("\t  y:");
-      Console.print(comMin.y);
-      Console.print(",");
-      Console.print(comMax.y);
-      Console.print("\t  z:");
-      Console.print(comMin.z);
-      Console.print(",");
-      Console.print(comMax.z);    
-      Console.println("\t");
+      setCalibInfo("IMU com calib x:" + String(comMin.x) + "," + String(comMax.x)
+        + " y:" + String(comMin.y) + "," + String(comMax.y)
+        + " z:" + String(comMin.z) + "," + String(comMax.z));
     } else Buzzer.noTone();   
   }    
 }
 
-// calculate acceleration sensor offsets
-boolean IMU::calibAccNextAxis(){  
-  boolean complete = false;
+// calculate acceleration sensor offsets (sample next side)
+void IMU::calibAccNextAxis(){  
+  if (state == IMU_CAL_ACC) return;  // side still sampling
   Buzzer.tone(440);
   while (Console.available()) Console.read();  
   useAccCalibration = false;  
   if (calibAccAxisCounter >= 6) calibAccAxisCounter = 0;
   if (calibAccAxisCounter == 0){
     // restart
-    Console.println(F("acc calib restart..."));
     accMin.x = accMin.y = accMin.z = 99999;
     accMax.x = accMax.y = accMax.z = -99999;    
   }
-  point_float_t pt = {0,0,0};
-  for (int i=0; i < 100; i++){        
-    readAccel();            
-    pt.x += acc.x / 100.0;
-    pt.y += acc.y / 100.0;
-    pt.z += acc.z / 100.0;                  
-    Console.print(acc.x);
-    Console.print(",");
-    Console.print(acc.y);
-    Console.print(",");
-    Console.println(acc.z);
-    delay(1);
-  }
+  statReset();
+  setCalibInfo("IMU acc calib side " + String(calibAccAxisCounter + 1) + " of 6...");
+  state = IMU_CAL_ACC;
+}
+
+void IMU::calibAccUpdate(){
+  if ((!readMotion()) || (!readAccel())) return;
+  statAdd(acc);
+  if (statCount < IMU_CALIB_ACC_SAMPLES) return;
+  point_float_t pt = statMean;
+  point_float_t var = statVariance();
   accMin.x = min(accMin.x, pt.x);
   accMax.x = max(accMax.x, pt.x);         
   accMin.y = min(accMin.y, pt.y);
@@ -629,9 +759,9 @@ boolean IMU::calibAccNextAxis(){
   accMax.z = max(accMax.z, pt.z);           
   calibAccAxisCounter++;        
   useAccCalibration = true;  
-  Console.print("side ");
-  Console.print(calibAccAxisCounter);
-  Console.println(" of 6 completed");    
+  Buzzer.noTone();
+  setCalibInfo("IMU acc calib side " + String(calibAccAxisCounter) + " of 6 completed: noise="
+    + String(max(var.x, max(var.y, var.z)), 4));
   if (calibAccAxisCounter == 6){    
     // all axis complete 
     float xrange = accMax.x - accMin.x;
@@ -645,137 +775,51 @@ boolean IMU::calibAccNextAxis(){
     accScale.z = zrange;    
     printCalib();
     saveCalib();    
-    Console.println("acc calibration completed");    
-    complete = true;
-    // completed sound
-    Buzzer.tone(600);
-    delay(200); 
-    Buzzer.tone(880);
-    delay(200); 
-    Buzzer.tone(1320);              
-    delay(200); 
-  };
-  Buzzer.noTone();
-  delay(500);
-  return complete;
+    setCalibInfo("IMU acc calib completed");
+    Buzzer.sound(SND_READY);
+  }
+  startRun();
 }      
 
-// first-order complementary filter
-// newAngle = angle measured with atan2 using the accelerometer
-// newRate = angle measured using the gyro
-// looptime = loop time in millis()
-float Complementary2(float newAngle, float newRate,int looptime, float angle) {
-  float k=10;
-  float dtc2=float(looptime)/1000.0;
-  float x1 = (newAngle -   angle)*k*k;
-  float y1 = dtc2*x1 + y1;
-  float x2 = y1 + (newAngle -   angle)*2*k + newRate;
-  angle = dtc2*x2 + angle;
-  return angle;
-}
-
-// second-order complementary filter
-// a=tau / (tau + loop time)
-// newAngle = angle measured with atan2 using the accelerometer
-// newRate = angle measured using the gyro
-// looptime = loop time in millis()
-float Complementary(float newAngle, float newRate,int looptime, float angle) {
-  float tau=0.075;
-  float a=0.0;
-  float dtC = float(looptime)/1000.0;
-  a=tau/(tau+dtC);
-  angle= a* (angle + newRate * dtC) + (1-a) * (newAngle);
-  return angle;
-}
-
-// Kalman filter                                      
-// newAngle = angle measured with atan2 using the accelerometer
-// newRate = angle measured using the gyro
-// looptime = loop time in millis()
-float Kalman(float newAngle, float newRate,int looptime, float x_angle)
-{
-  float Q_angle  =  0.01; //0.001
-  float Q_gyro   =  0.0003;  //0.003
-  float R_angle  =  0.01;  //0.03
-
-  float x_bias = 0;
-  float P_00 = 0, P_01 = 0, P_10 = 0, P_11 = 0;
-  float  y, S;
-  float K_0, K_1;
-
-  float dt = float(looptime)/1000;
-  x_angle += dt * (newRate - x_bias);
-  P_00 +=  - dt * (P_10 + P_01) + Q_angle * dt;
-  P_01 +=  - dt * P_11;
-  P_10 +=  - dt * P_11;
-  P_11 +=  + Q_gyro * dt;
-
-  y = newAngle - x_angle;
-  S = P_00 + R_angle;
-  K_0 = P_00 / S;
-  K_1 = P_10 / S;
-
-  x_angle +=  K_0 * y;
-  x_bias  +=  K_1 * y;
-  P_00 -= K_0 * P_00;
-  P_01 -= K_0 * P_01;
-  P_10 -= K_1 * P_00;
-  P_11 -= K_1 * P_01;
-
-  return x_angle;
-}
-
-// scale setangle, so that both PI angles have the same sign    
-float scalePIangles(float setAngle, float currAngle){
-  if ((setAngle >= PI/2) && (currAngle <= -PI/2)) return (setAngle-2*PI);
-    else if ((setAngle <= -PI/2) && (currAngle >= PI/2)) return (setAngle+2*PI);
-    else return setAngle;
-}
-
 void IMU::update(){
+  switch (state){
+    case IMU_CAL_GYRO: calibGyroUpdate(); return;
+    case IMU_CAL_ACC:  calibAccUpdate();  return;
+    case IMU_CAL_COM:  calibComUpdate();  return;
+  }
+  #if defined (IMU_MPU9250)
+    // samples are buffered in the FIFO, so the bus is only read every IMU_FIFO_DRAIN_INTERVAL
+    if (millis() < nextTimeFifo) return;
+    nextTimeFifo = millis() + IMU_FIFO_DRAIN_INTERVAL;
+    readFifo();
+    return;
+  #endif
   if (!read())
     return;  
   now = millis();
-  int looptime = (now - lastAHRSTime);
+  float dt = ((float)(now - lastAHRSTime)) / 1000.0;
   lastAHRSTime = now;
+  sampleTime = micros();
   
-  if (state == IMU_RUN){
-    // ------ roll, pitch --------------  
-    float forceMagnitudeApprox = abs(acc.x) + abs(acc.y) + abs(acc.z);    
-    //if (forceMagnitudeApprox < 1.2) {
-      //Console.println(forceMagnitudeApprox);      
-      accPitch   = atan2(-acc.x , sqrt(sq(acc.y) + sq(acc.z)));         
-      accRoll    = atan2(acc.y , acc.z);       
-      accPitch = scalePIangles(accPitch, ypr.pitch);
-      accRoll  = scalePIangles(accRoll, ypr.roll);
-      // complementary filter            
-      ypr.pitch = Kalman(accPitch, gyro.x, looptime, ypr.pitch);  
-      ypr.roll  = Kalman(accRoll,  gyro.y, looptime, ypr.roll);            
-    /*} else {
-      //Console.print("too much acceleration ");
-      //Console.println(forceMagnitudeApprox);
-      ypr.pitch = ypr.pitch + gyro.y * ((float)(looptime))/1000.0;
-      ypr.roll  = ypr.roll  + gyro.x * ((float)(looptime))/1000.0;
-    }*/
-    ypr.pitch=scalePI(ypr.pitch);
-    ypr.roll=scalePI(ypr.roll);
-    // ------ yaw --------------
-    // tilt-compensated yaw
-    comTilt.x =  com.x  * cos(ypr.pitch) + com.z * sin(ypr.pitch);
-    comTilt.y =  com.x  * sin(ypr.roll)         * sin(ypr.pitch) + com.y * cos(ypr.roll) - com.z * sin(ypr.roll) * cos(ypr.pitch);
-    comTilt.z = -com.x  * cos(ypr.roll)         * sin(ypr.pitch) + com.y * sin(ypr.roll) + com.z * cos(ypr.roll) * cos(ypr.pitch);     
-    comYaw = scalePI( atan2(comTilt.y, comTilt.x)  );  
-    comYaw = scalePIangles(comYaw, ypr.yaw);
-    //comYaw = atan2(com.y, com.x);  // assume pitch, roll are 0
-    // complementary filter
-    ypr.yaw = Complementary2(comYaw, -gyro.z, looptime, ypr.yaw);
-    ypr.yaw = scalePI(ypr.yaw);
-  } 
-  else if (state == IMU_CAL_COM) {
-    calibComUpdate();
-  }
+  // after a long gap attitude is initialized from accel/compass again
+  if (dt > 0.5) ahrs.reset();
+  fuse(dt);
+  updateYpr();
+  comFitUpdate();
 }  
 
+// sensor fusion of one accel/gyro/compass sample (dt = sample time in seconds)
+void IMU::fuse(float dt){
+  ahrs.update(gyro.x, gyro.y, gyro.z, acc.x, acc.y, acc.z, com.x, com.y, com.z, dt);
+}
+
+// Euler angles are derived once per update (not per sample)
+void IMU::updateYpr(){
+  float yaw;
+  ahrs.getYawPitchRoll(yaw, ypr.pitch, ypr.roll);
+  ypr.yaw = -yaw;  // heading is clockwise (compass)
+}
+
 boolean IMU::init(){    
   loadCalib();
   printCalib();
@@ -786,14 +830,13 @@ boolean IMU::init(){
 }
 
 bool IMU::hwInit(){
-  #if defined (IMU_MPU9250)
-    Wire.begin();
-    MPU.setWire(&Wire);
-  #endif
     initAccel();
     initGyro();
     initCom();
     initMMC5883MA();
+  #if defined (IMU_MPU9250)
+    MPU.beginFifo(IMU_FIFO_RATE);
+  #endif
   return true;
 }
 
@@ -815,37 +858,158 @@ bool IMU::read(){
     return false;
   }
   callCounter++;    
+  if (!readMotion()) return false;  // MPU9250: burst not completed yet (failures are counted by readMotion)
   if (readAccel()
       && readGyro()
       && readCom()
       && readMMC5883MA() ) {
-    if (resetTryCount > 0) {
-      // reset was successful
-      imuResetSuccessCounter++;
-      resetTryCount = 0;
-    }
-    errorCounter = 0;
+    readSuccess();
     return true;
-  } else {
-    if (resetTryCount < 3) {
-      // Try reseting without erroring out
-      I2Creset();
-      Wire.begin();
-      resetTryCount++;
+  } else return readFailure();
+}
+
+void IMU::readSuccess(){
+  if (resetTryCount > 0) {
+    // reset was successful
+    imuResetSuccessCounter++;
+    resetTryCount = 0;
+  }
+  readErrorCount = 0;
+  errorCounter = 0;
+}
+
+bool IMU::readFailure(){
+  // bus errors are counted per device (I2CgetErrorCounter), bus is only recovered if errors persist
+  readErrorCount++;
+  if (readErrorCount < IMU_MAX_READ_ERRORS) return false;
+  readErrorCount = 0;
+  if (resetTryCount < 3) {
+    // Try reseting without erroring out
+    I2Crecover();
+    resetTryCount++;
+    return false;
+  }
+  errorCounter++;
+  return false;
+}
+
+// MPU9250: drain hardware FIFO in the background and fuse every sample with the sensor's sample time:
+// compass and FIFO count are queued, onFifoCount queues the FIFO read, onFifoData fuses the samples
+bool IMU::readFifo(){
+  #if defined (IMU_MPU9250)
+    if (!hardwareInitialized) {
+      errorCounter++;
       return false;
     }
-    errorCounter++;
+    if (fifoBusy) return false;  // last drain not completed yet
+    callCounter++;
+    // compass is slower than the FIFO rate, read once per drain
+    if ((!MPU.magSlaveSubmit(&magTransfer, onMag, this))
+      || (!MPU.fifoCountSubmit(&fifoCountTransfer, fifoCountBuf, onFifoCount, this))) return readFailure();
+    fifoBusy = true;
+    return true;
+  #else
     return false;
-  }
+  #endif
+}
+
+void IMU::onMag(i2ctransfer_t *t){
+  IMU *imu = (IMU*)t->context;
+  if (t->status != I2C_DONE) return;  // counted by onFifoCount/onFifoData
+  imu->readCom();
+  imu->comFitUpdate();
+}
+
+void IMU::onFifoCount(i2ctransfer_t *t){
+  #if defined (IMU_MPU9250)
+    IMU *imu = (IMU*)t->context;
+    if ((t->status != I2C_DONE) || (imu->magTransfer.status != I2C_DONE)) {
+      imu->fifoBusy = false;
+      imu->readFailure();
+      return;
+    }
+    int16_t count = MPU.fifoCountFrom(imu->fifoCountBuf);
+    if (count > MPU9250_FIFO_SIZE - MPU9250_FIFO_SAMPLE_LEN) {
+      // FIFO full (loop stalled), samples were dropped
+      MPU.fifoReset();
+      imu->fifoOverflowCounter++;
+      imu->ahrs.reset();
+      imu->fifoBusy = false;
+      imu->readSuccess();
+      return;
+    }
+    int samples = count / MPU9250_FIFO_SAMPLE_LEN;
+    if (samples == 0) {
+      imu->fifoBusy = false;
+      return;
+    }
+    if (samples > IMU_FIFO_MAX_SAMPLES) {
+      // drain the rest in next loop
+      samples = IMU_FIFO_MAX_SAMPLES;
+      imu->nextTimeFifo = millis();
+    }
+    if (!MPU.fifoReadSubmit(&imu->fifoDataTransfer, imu->fifoBuf, samples * MPU9250_FIFO_SAMPLE_LEN, onFifoData, imu)) {
+      imu->fifoBusy = false;
+      imu->readFailure();
+    }
+  #endif
+}
+
+void IMU::onFifoData(i2ctransfer_t *t){
+  #if defined (IMU_MPU9250)
+    IMU *imu = (IMU*)t->context;
+    imu->fifoBusy = false;
+    if (t->status != I2C_DONE) {
+      // partial read would misalign samples
+      MPU.fifoReset();
+      imu->readFailure();
+      return;
+    }
+    const float dt = 1.0 / IMU_FIFO_RATE;
+    int samples = t->num / MPU9250_FIFO_SAMPLE_LEN;
+    for (int i=0; i < samples; i++){
+      MPU.fifoSample(imu->fifoBuf + i * MPU9250_FIFO_SAMPLE_LEN);
+      imu->readAccel();
+      imu->readGyro();
+      imu->fuse(dt);
+    }
+    imu->updateYpr();
+    imu->lastAHRSTime = millis();
+    imu->sampleTime = t->time;
+    imu->readSuccess();
+  #endif
+}
+
+// MPU9250: accel, gyro and compass in one queued I2C burst (other IMUs are read by readAccel/readGyro/readCom):
+// returns true once a burst has completed (a call submits it, the sample is taken by a later call)
+bool IMU::readMotion(){
+  #if defined (IMU_MPU9250)
+    if (motionPending) return false;
+    if (motionResult != I2C_IDLE) {
+      boolean ok = (motionResult == I2C_DONE);
+      motionResult = I2C_IDLE;
+      if (!ok) return readFailure();
+      MPU.motionSample(motionBuf);
+      return true;
+    }
+    if (!MPU.motionSubmit(&motionTransfer, motionBuf, onMotion, this)) return false;
+    motionPending = true;
+    return false;
+  #else
+    return true;
+  #endif
+}
+
+void IMU::onMotion(i2ctransfer_t *t){
+  IMU *imu = (IMU*)t->context;
+  imu->motionPending = false;
+  imu->motionResult = t->status;
 }
 
 // MMC5883MA compass sensor driver
 void  IMU::initMMC5883MA(){
   uint8_t buf[6];  
-  Wire.beginTransmission(MMC5883MA);
-  int error = Wire.endTransmission();
-
-  if (!error && type5588 == -1) {
+  if (I2Cprobe(MMC5883MA) && type5588 == -1) {
       type5588 = MMC5883MA;
       Console.println("Found MMC5883MA");
   }
@@ -894,22 +1058,7 @@ bool IMU::readMMC5883MA(){
   x -= MMCOffset[0];
   y -= MMCOffset[1];
   z -= MMCOffset[2];
-  if (useComCalibration){
-    x -= comOfs.x;
-    y -= comOfs.y;
-    z -= comOfs.z;
-    x /= comScale.x*0.5;    
-    y /= comScale.y*0.5;    
-    z /= comScale.z*0.5;
-    com.x = x;
-    //Console.println(z);
-    com.y = y;
-    com.z = z;
-  } else {
-    com.x = x;
-    com.y = y;
-    com.z = z;
-  } 
+  applyComCalib(x, y, z);
 
    return true;
 }
@@ -37,9 +37,41 @@ How to use it (example):
 
 #include <Arduino.h>
 #include "MPU9250.h"
+#include "i2c.h"
+#include "ahrs.h"
+#include "ellipsoid.h"
 
 // IMU state
-enum { IMU_RUN, IMU_CAL_COM };
+enum { IMU_RUN, IMU_CAL_COM, IMU_CAL_GYRO, IMU_CAL_ACC };
+
+// consecutive failed reads before I2C bus is recovered
+#define IMU_MAX_READ_ERRORS 10
+
+// MPU9250: accel/gyro sample rate into hardware FIFO (Hz), fusion runs on every sample
+#define IMU_FIFO_RATE 200
+// FIFO drain interval (ms) and max. samples per drain (rest is drained next loop),
+// one queued I2C transfer per drain (max. 255 bytes)
+#define IMU_FIFO_DRAIN_INTERVAL 20
+#define IMU_FIFO_MAX_SAMPLES 16
+
+// calibration advances one sample per update: samples per gyro batch / acc side,
+// max. gyro batches, max. gyro noise (variance), sample intervals (ms)
+#define IMU_CALIB_GYRO_SAMPLES 50
+#define IMU_CALIB_GYRO_BATCHES 100
+#define IMU_CALIB_GYRO_NOISE 20
+#define IMU_CALIB_GYRO_INTERVAL 10
+#define IMU_CALIB_ACC_SAMPLES 100
+#define IMU_CALIB_COM_INTERVAL 20
+
+// compass ellipsoid fit: raw scale for calibration from scratch, online refinement sample
+// interval (ms), min. change between samples (unit field), samples per fit, blend weight of
+// a new fit, weight of old samples if fit fails
+#define IMU_COM_REF_SCALE 500
+#define IMU_COM_FIT_INTERVAL 100
+#define IMU_COM_FIT_MIN_DIST 0.05
+#define IMU_COM_FIT_SAMPLES 300
+#define IMU_COM_FIT_BLEND 0.25
+#define IMU_COM_FIT_DECAY 0.5
 
 
 struct point_int_t {
@@ -86,8 +118,12 @@ public:
   boolean hardwareInitialized;  
   byte state;
   unsigned long lastAHRSTime;
+  unsigned long sampleTime;  // micros() of last fused sample (ROS capture time)
   unsigned long now;  
+  unsigned long nextTimeFifo;
+  int fifoOverflowCounter;
   ypr_t ypr;  // gyro yaw,pitch,roll    
+  MahonyAHRS ahrs;  // attitude estimation (quaternion)
   // --------- gyro state -----------------------------
   point_float_t gyro;   // gyro sensor data (degree)    
   point_float_t gyroOfs; // gyro calibration data
@@ -102,28 +138,31 @@ public:
   point_float_t accMax;
   int accelCounter ;
   boolean useAccCalibration ; 
-  float accPitch ;
-  float accRoll ;
   point_float_t accOfs;
   point_float_t accScale;
   int calibAccAxisCounter;
   // calibrate acceleration sensor  
-  boolean calibAccNextAxis();  
+  void calibAccNextAxis();  
   boolean calibrationAvail;
   // --------- compass state --------------------------  
   point_float_t com; // compass sensor data (raw)
   point_float_t comLast;
   point_float_t comMin; // compass sensor data (raw)
   point_float_t comMax; // compass sensor data (raw)  
-  point_float_t comTilt; // compass sensor data (tilt corrected)
   point_float_t comOfs;
   point_float_t comScale;  
-  float comYaw;         // compass heading (radiant, raw)
+  float comCorr[3][3];  // hard/soft-iron correction: com = comCorr * (raw - comOfs)
+  point_float_t comRaw; // compass sensor data (uncalibrated)
+  EllipsoidFit comFit;
+  boolean comFitOnline; // refine compass calibration during normal operation
   boolean useComCalibration;
   // calibrate compass sensor  
   void calibComStartStop();  
   void calibComUpdate();    
   boolean newMinMaxFound();
+  // calibration progress (for ROS)
+  String calibInfo;
+  boolean calibInfoAvail();
   // --------------------------------------------------
   // helpers
   float scalePI(float v);
@@ -133,8 +172,37 @@ public:
   float fusionPI(float w, float a, float b);    
 private:  
   bool read();
+  bool readFifo();
+  void readSuccess();
+  bool readFailure();
+  void fuse(float dt);
+  void updateYpr();
   void loadSaveCalib(boolean readflag);  
-  void calibGyro();
+  void calibGyroStart();
+  void calibGyroUpdate();
+  void calibAccUpdate();
+  void startRun();
+  // running mean and variance of calibration samples (Welford)
+  void statReset();
+  void statAdd(point_float_t p);
+  point_float_t statVariance();
+  int statCount;
+  point_float_t statMean;
+  point_float_t statM2;
+  int calibBatch;
+  unsigned long nextTimeCalib;
+  boolean calibInfoChanged;
+  void setCalibInfo(String info);
+  void applyComCalib(float x, float y, float z);
+  void comCorrFromScale();
+  void comFitStart(boolean fromScratch);
+  void comFitAdd();
+  boolean comFitApply(float weight);
+  void comFitUpdate();
+  float comFitRefOfs[3];
+  float comFitRefCorr[3][3];
+  point_float_t comFitLast;
+  unsigned long nextTimeComFit;
   void loadCalib();  
   // print IMU values
   void printPt(point_float_t p);
@@ -152,9 +220,26 @@ private:
   bool readAccel();
   bool readCom();
   bool readMMC5883MA();
+  bool readMotion();
+  // MPU9250: queued I2C reads, completed by the callbacks (called by I2Cservice in loop)
+  i2ctransfer_t magTransfer;
+  i2ctransfer_t fifoCountTransfer;
+  i2ctransfer_t fifoDataTransfer;
+  i2ctransfer_t motionTransfer;
+  uint8_t fifoCountBuf[2];
+  uint8_t fifoBuf[IMU_FIFO_MAX_SAMPLES * MPU9250_FIFO_SAMPLE_LEN];
+  uint8_t motionBuf[MPU9250_BUFF_LEN_MOTION];
+  boolean fifoBusy;        // FIFO drain in progress
+  boolean motionPending;   // motion burst submitted
+  byte motionResult;       // I2C_DONE/I2C_FAILED of last burst (I2C_IDLE if taken)
+  static void onMag(i2ctransfer_t *t);
+  static void onFifoCount(i2ctransfer_t *t);
+  static void onFifoData(i2ctransfer_t *t);
+  static void onMotion(i2ctransfer_t *t);
   float MMCOffset[3];
   int type5588;
   int resetTryCount;
+  int readErrorCount;
   boolean foundNewMinMax; 
 };
 
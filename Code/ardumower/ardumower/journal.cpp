@@ -0,0 +1,260 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+  
+*/
+
+#include "journal.h"
+#include "flashmem.h"
+#include "drivers.h"
+#include "config.h"
+
+JournalClass Journal;
+
+
+// CRC32 (IEEE 802.3), bitwise to save flash/RAM
+static uint32_t crc32Update(uint32_t crc, byte b){
+  crc ^= b;
+  for (byte k=0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+  return crc;
+}
+
+
+int jreadwriteString(boolean readflag, int &ofs, String& value)
+{
+  char ch;
+  if (readflag) {
+    value = "";
+    jreadwrite(readflag, ofs, ch);
+    while (ch) {
+      value += ch;
+      jreadwrite(readflag, ofs, ch);
+    }
+  } else {
+    for (unsigned int i=0; i < value.length(); i++) {
+      ch = value.charAt(i);
+      jreadwrite(readflag, ofs, ch);
+    }
+    ch = 0;
+    jreadwrite(readflag, ofs, ch);
+  }
+  return ofs;
+}
+
+
+JournalClass::JournalClass(){
+  scanned = false;
+  mode = MODE_IDLE;
+  writeErrorCounter = 0;
+  skipCounter = 0;
+  nextPage = 0;
+  nextSeq = 1;
+  bufLen = 0;
+  memset(records, 0, sizeof records);
+}
+
+// checks record at page (header and CRC)
+boolean JournalClass::verify(byte page, journal_header_t &h, uint32_t &payloadCrc){
+  uint32_t addr = JOURNAL_START + (uint32_t)page * JOURNAL_PAGE_SIZE;
+  byte *p = (byte*)&h;
+  for (byte i=0; i < JOURNAL_HEADER_SIZE; i++) p[i] = Flash.read(addr + i);
+  if ((h.magic != JOURNAL_MAGIC) || (h.id >= JOURNAL_RECORD_COUNT)) return false;
+  if (h.pages != (JOURNAL_HEADER_SIZE + h.len + JOURNAL_PAGE_SIZE - 1) / JOURNAL_PAGE_SIZE) return false;
+  if (page + h.pages > JOURNAL_PAGES) return false;
+  uint32_t c = 0xFFFFFFFF;
+  addr += JOURNAL_HEADER_SIZE;
+  for (uint16_t i=0; i < h.len; i++) c = crc32Update(c, Flash.read(addr + i));
+  payloadCrc = c;
+  for (byte i=0; i < JOURNAL_HEADER_SIZE - 4; i++) c = crc32Update(c, p[i]);
+  return (~c == h.crc);
+}
+
+// finds newest valid record of each type and the write position
+void JournalClass::scan(){
+  scanned = true;
+  memset(records, 0, sizeof records);
+  nextPage = 0;
+  nextSeq = 1;
+  journal_header_t h;
+  uint32_t payloadCrc;
+  byte page = 0;
+  while (page < JOURNAL_PAGES){
+    if (!verify(page, h, payloadCrc)) {
+      page++;
+      continue;
+    }
+    journal_record_t &r = records[h.id];
+    if ((!r.valid) || (h.seq > r.seq)){
+      r.valid = true;
+      r.page = page;
+      r.pages = h.pages;
+      r.len = h.len;
+      r.seq = h.seq;
+      r.crc = payloadCrc;
+    }
+    if (h.seq >= nextSeq){
+      nextSeq = h.seq + 1;
+      nextPage = (page + h.pages) % JOURNAL_PAGES;
+    }
+    page += h.pages;
+  }
+}
+
+// first free range of pages at/behind write position (live records are skipped, so they are never overwritten)
+int JournalClass::allocate(byte pages){
+  int page = nextPage;
+  for (int tries=0; tries < JOURNAL_PAGES; tries++){
+    if (page + pages > JOURNAL_PAGES) page = 0;
+    byte i;
+    for (i=0; i < JOURNAL_RECORD_COUNT; i++){
+      journal_record_t &r = records[i];
+      if ((r.valid) && (page < r.page + r.pages) && (r.page < page + pages)) break;
+    }
+    if (i == JOURNAL_RECORD_COUNT) return page;
+    page = records[i].page + records[i].pages;
+  }
+  return -1;
+}
+
+boolean JournalClass::openRead(byte id){
+  if (!scanned) scan();
+  journal_record_t &r = records[id];
+  mode = MODE_IDLE;
+  if ((!r.valid) || (r.len == 0)) return false;
+  mode = MODE_READ;
+  pos = JOURNAL_START + (uint32_t)r.page * JOURNAL_PAGE_SIZE + JOURNAL_HEADER_SIZE;
+  end = pos + r.len;
+  return true;
+}
+
+void JournalClass::openLegacy(uint32_t address){
+  mode = MODE_READ;
+  pos = address;
+  end = JOURNAL_START;
+}
+
+void JournalClass::openWrite(byte id){
+  if (!scanned) scan();
+  mode = MODE_COUNT;
+  recordId = id;
+  len = 0;
+  crc = 0xFFFFFFFF;
+}
+
+void JournalClass::erase(byte id){
+  openWrite(id);
+  while (nextPass());
+}
+
+void JournalClass::readWrite(boolean readflag, void *data, unsigned int n){
+  byte *p = (byte*)data;
+  if (readflag){
+    // fields behind record end (shorter record) read as zero
+    for (unsigned int i=0; i < n; i++) p[i] = (pos < end) ? Flash.read(pos++) : 0;
+    return;
+  }
+  if ((mode != MODE_COUNT) && (mode != MODE_WRITE)) return;
+  for (unsigned int i=0; i < n; i++){
+    crc = crc32Update(crc, p[i]);
+    if (mode == MODE_WRITE) put(p[i]);
+  }
+  len += n;
+}
+
+boolean JournalClass::nextPass(){
+  if (mode == MODE_COUNT){
+    journal_record_t &r = records[recordId];
+    if ((r.valid) && (r.len == len) && (r.crc == crc)){
+      // unchanged: no write traffic
+      skipCounter++;
+      mode = MODE_IDLE;
+      return false;
+    }
+    // length and payload CRC known: allocate pages, write header
+    header.magic = JOURNAL_MAGIC;
+    header.id = recordId;
+    header.reserved = 0;
+    header.len = len;
+    header.pages = (JOURNAL_HEADER_SIZE + len + JOURNAL_PAGE_SIZE - 1) / JOURNAL_PAGE_SIZE;
+    header.seq = nextSeq;
+    int page = allocate(header.pages);
+    mode = MODE_IDLE;
+    if (page < 0){
+      writeErrorCounter++;
+      Console.println(F("Journal: no free pages"));
+      return false;
+    }
+    payloadCrc = crc;
+    byte *h = (byte*)&header;
+    for (byte i=0; i < JOURNAL_HEADER_SIZE - 4; i++) crc = crc32Update(crc, h[i]);
+    header.crc = ~crc;
+    writePage = page;
+    writeOk = true;
+    pos = JOURNAL_START + (uint32_t)page * JOURNAL_PAGE_SIZE;
+    bufLen = 0;
+    for (byte i=0; i < JOURNAL_HEADER_SIZE; i++) put(h[i]);
+    mode = MODE_WRITE;
+    len = 0;
+    crc = 0xFFFFFFFF;
+    return true;
+  }
+  if (mode == MODE_WRITE){
+    flush();
+    mode = MODE_IDLE;
+    if ((len != header.len) || (crc != payloadCrc)){
+      // fields changed between passes: record is invalid, previous record stays in use
+      writeErrorCounter++;
+      Console.println(F("Journal: record changed while writing"));
+      return false;
+    }
+    if (!writeOk){
+      Console.println(F("Journal: write failed"));
+      return false;
+    }
+    // commit
+    journal_record_t &r = records[recordId];
+    r.valid = true;
+    r.page = writePage;
+    r.pages = header.pages;
+    r.len = header.len;
+    r.seq = header.seq;
+    r.crc = payloadCrc;
+    nextSeq = header.seq + 1;
+    nextPage = (writePage + header.pages) % JOURNAL_PAGES;
+    return false;
+  }
+  mode = MODE_IDLE;
+  return false;
+}
+
+void JournalClass::put(byte b){
+  buf[bufLen++] = b;
+  if (bufLen == JOURNAL_PAGE_SIZE) flush();
+}
+
+void JournalClass::flush(){
+  if (bufLen == 0) return;
+  if (!Flash.writePage(pos, buf, bufLen)){
+    writeErrorCounter++;
+    writeOk = false;
+  }
+  pos += bufLen;
+  bufLen = 0;
+}
+
@@ -0,0 +1,134 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+
+*/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <Arduino.h>
+
+
+/*
+  log-structured settings store (EEPROM/AT24C32)
+  each save appends a new record (header + payload) at page boundaries behind the last record, 
+  the newest record (sequence number) with valid CRC32 is used. Live records are never overwritten,
+  so a torn write leaves the previous copy intact, and writes rotate through the whole journal area.
+  Records are serialized twice: the first pass counts length and CRC, the second pass writes pages.
+  A record equal to the live record (length and payload CRC) is not written again.
+
+  void Robot::loadSaveXXX(boolean readflag){
+    if (readflag) { if (!Journal.openRead(JOURNAL_XXX)) return; }
+      else Journal.openWrite(JOURNAL_XXX);
+    do {
+      int addr = 0;
+      jreadwrite(readflag, addr, value);
+    } while (Journal.nextPass());
+  }
+*/
+
+// journal area (legacy settings and calibration data use the first 1024 bytes)
+#define JOURNAL_START 1024
+#define JOURNAL_PAGE_SIZE 32
+#define JOURNAL_PAGES 96
+#define JOURNAL_MAGIC 0x4A52
+#define JOURNAL_HEADER_SIZE 16
+
+// record types
+enum { JOURNAL_USER_SETTINGS, JOURNAL_ERR_COUNTERS, JOURNAL_ROBOT_STATS, JOURNAL_RECORD_COUNT };
+
+struct journal_header_t {
+  uint16_t magic;
+  uint8_t  id;
+  uint8_t  reserved;
+  uint16_t len;      // payload bytes
+  uint16_t pages;
+  uint32_t seq;      // increases with every record written
+  uint32_t crc;      // CRC32 of payload and header (without crc)
+} __attribute__((packed));
+typedef struct journal_header_t journal_header_t;
+
+struct journal_record_t {
+  boolean valid;
+  byte page;         // first page
+  byte pages;
+  uint16_t len;
+  uint32_t seq;
+  uint32_t crc;      // payload CRC
+};
+typedef struct journal_record_t journal_record_t;
+
+
+class JournalClass
+{
+  public:
+    JournalClass();
+    // newest valid record for reading (false if none or erased)
+    boolean openRead(byte id);
+    // read from legacy (fixed address) layout
+    void openLegacy(uint32_t address);
+    void openWrite(byte id);
+    // ends a pass, returns true if the fields must be serialized once more
+    boolean nextPass();
+    void readWrite(boolean readflag, void *data, unsigned int len);
+    // appends an empty record
+    void erase(byte id);
+    int writeErrorCounter;
+    int skipCounter;  // unchanged records not written
+  private:
+    enum { MODE_IDLE, MODE_READ, MODE_COUNT, MODE_WRITE };
+    void scan();
+    boolean verify(byte page, journal_header_t &header, uint32_t &payloadCrc);
+    int allocate(byte pages);
+    void put(byte b);
+    void flush();
+    boolean scanned;
+    byte mode;
+    byte recordId;
+    journal_record_t records[JOURNAL_RECORD_COUNT];
+    journal_header_t header;
+    byte nextPage;     // page behind newest record
+    uint32_t nextSeq;
+    uint32_t pos;      // EEPROM address of cursor
+    uint32_t end;
+    uint16_t len;
+    uint32_t crc;
+    uint32_t payloadCrc;  // of first pass
+    byte writePage;
+    boolean writeOk;
+    byte buf[JOURNAL_PAGE_SIZE];
+    byte bufLen;
+};
+
+extern JournalClass Journal;
+
+
+template <class T> int jreadwrite(boolean readflag, int &ofs, T& value)
+{
+    Journal.readWrite(readflag, &value, sizeof(value));
+    ofs += sizeof(value);
+    return sizeof(value);
+}
+
+int jreadwriteString(boolean readflag, int &ofs, String& value);
+
+
+#endif
+
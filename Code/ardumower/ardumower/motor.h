@@ -10,36 +10,108 @@ void Robot::setMotorMowRPMState(boolean motorMowRpmState){
 }
 
 
-//
-//// calculate map position by odometry sensors
-//void Robot::calcOdometry(){
-//  if ( (millis() < nextTimeOdometry)) return;    
-//  nextTimeOdometry = millis() + 100;
-//
-//  static int lastOdoLeft = 0;
-//  static int lastOdoRight = 0;
-//  int odoLeft = odometryLeft;
-//  int odoRight = odometryRight;
-//  int ticksLeft = odoLeft - lastOdoLeft;
-//  int ticksRight = odoRight - lastOdoRight;
-//  lastOdoLeft = odoLeft;
-//  lastOdoRight = odoRight;    
-//  //double left_cm = ((double)ticksLeft) / ((double)odometryTicksPerCm);
-//  //double right_cm = ((double)ticksRight) / ((double)odometryTicksPerCm);  
-//  //double avg_cm  = (left_cm + right_cm) / 2.0;
-//  //double wheel_theta = (left_cm - right_cm) / ((double)odometryWheelBaseCm);    
-//  //odometryTheta = scalePI(odometryTheta - wheel_theta); 
-//  
-//	// calculate RPM 
-// // motorLeftRpmCurr  = double ((( ((double)ticksLeft) / ((double)odometryTicksPerRevolution)) / ((double)(millis() - lastMotorRpmTime))) * 60000.0);
-// // motorRightRpmCurr = double ((( ((double)ticksRight) / ((double)odometryTicksPerRevolution)) / ((double)(millis() - lastMotorRpmTime))) * 60000.0);
-//  lastMotorRpmTime = millis();
-//  
-//  // ROS coordinate system (X+ forward, Y+ left, Z+ up)  
-//  // FIXME: theta should be old theta, not new theta?
-//  //odometryY += avg_cm * sin(odometryTheta); 
-//  //odometryX += avg_cm * cos(odometryTheta); 
-//} 
+// IMU yaw (clockwise, radians) as counter-clockwise binary angle (2^32 = full turn),
+// converted via 32 bit unsigned so that yaw = +-PI wraps instead of overflowing long
+static long imuYawToBam(float yaw){
+  return (long)(0UL - (uint32_t)(int64_t)(yaw * (2147483648.0 / PI)));
+}
+
+// precompute fixed point odometry factors (call after changing odometry settings)
+void Robot::initOdometry(){
+  // two-wire (quadrature) odometry counts every edge of both channels
+  odometryEdgesPerTick = (twoWayOdometrySensorUse) ? 4 : 1;
+  odometryUmPerTick = (long)(10000.0 / (odometryTicksPerCm * odometryEdgesPerTick) + 0.5);
+  // heading change (binary angle) per micrometer wheel distance difference, Q16
+  odometryBamPerUmQ16 = (long)(4294967296.0 / (2.0 * PI * odometryWheelBaseCm * 10000.0) * 65536.0 + 0.5);
+  noInterrupts();
+  odometryLeftLast = odometryLeft;
+  odometryRightLast = odometryRight;
+  interrupts();
+  // wheel circumference (mm) = ticks per revolution / ticks per cm * 10
+  odometryRpmPerMmS = 60.0 * odometryTicksPerCm / (odometryTicksPerRevolution * 10.0);
+  odometryImuThetaLast = imuYawToBam(imu.ypr.yaw);
+  odometryPoseTime = micros();
+}
+
+// calculate map position by odometry sensors (called by motorControlTick, fixed point)
+// ROS coordinate system (X+ forward, Y+ left, Z+ up, theta counter-clockwise)
+void Robot::calcOdometry(){
+  unsigned long now = micros();
+  // Due: runs inside the control timer interrupt, so keep interrupts masked on return
+  irqstate_t irq = irqLock();
+  int odoLeft = odometryLeft;
+  int odoRight = odometryRight;
+  irqUnlock(irq);
+  int ticksLeft = odoLeft - odometryLeftLast;
+  int ticksRight = odoRight - odometryRightLast;
+  odometryLeftLast = odoLeft;
+  odometryRightLast = odoRight;
+  odometryPoseTime = now;
+
+  long leftUm = (long)ticksLeft * odometryUmPerTick;
+  long rightUm = (long)ticksRight * odometryUmPerTick;
+  long avgUm = (leftUm + rightUm) / 2;
+  long dTheta = (long)(((int64_t)(rightUm - leftUm) * odometryBamPerUmQ16) >> 16);
+
+  // IMU yaw is clockwise (compass), ROS heading is counter-clockwise;
+  // last IMU angle is tracked on every tick, so enabling fusion at runtime adds no heading step
+  long imuTheta = imuYawToBam(imu.ypr.yaw);
+  long imuDTheta = (long)((unsigned long)imuTheta - (unsigned long)odometryImuThetaLast);
+  odometryImuThetaLast = imuTheta;
+  if ((imuUse) && (odometryImuFusion > 0)) {
+    dTheta += (long)((((int64_t)imuDTheta - dTheta) * odometryImuFusion) / 100);
+  }
+
+  // integrate along mid heading of this step
+  unsigned int midAngle = ((unsigned long)(odometryTheta + dTheta / 2)) >> 16;
+  odometryX += (long)(((int64_t)avgUm * cosQ15(midAngle)) >> 15);
+  odometryY += (long)(((int64_t)avgUm * sinQ15(midAngle)) >> 15);
+  odometryTheta += dTheta;
+
+  // wheel speeds by edge timestamps, twist
+  float leftRate = odometryEdgeRate(odometryLeftEdges);   // ticks/s
+  float rightRate = odometryEdgeRate(odometryRightEdges);
+  motorLeftRpmCurr = leftRate * 60.0 / (odometryTicksPerRevolution * odometryEdgesPerTick);
+  motorRightRpmCurr = rightRate * 60.0 / (odometryTicksPerRevolution * odometryEdgesPerTick);
+  lastMotorRpmTime = millis();
+  odometrySpeed = (int)((leftRate + rightRate) * odometryUmPerTick / 2000.0);                     // mm/s
+  odometryYawRate = (int)((rightRate - leftRate) * odometryUmPerTick / (odometryWheelBaseCm * 10.0)); // mrad/s
+}
+
+// wheel rate (ticks/s, signed) by odometry edge timestamps:
+// at high speed all edges of the last 50 ms are averaged (count measurement),
+// at low speed the last edge interval is used (period measurement),
+// with quadrature at least one full cycle (4 edges) to cancel phase/duty cycle errors
+float Robot::odometryEdgeRate(odoedges_t &edges){
+  unsigned long t[ODOMETRY_EDGES];
+  byte head, valid;
+  char dir;
+  // copy ring, repeat if an edge arrived meanwhile
+  do {
+    head = edges.head;
+    valid = edges.valid;
+    dir = edges.dir;
+    for (byte i = 0; i < ODOMETRY_EDGES; i++) t[i] = edges.time[i];
+  } while (head != edges.head);
+  if (valid < 2) return 0;
+
+  unsigned long lastEdge = t[(byte)(head - 1) & (ODOMETRY_EDGES - 1)];
+  unsigned long sinceLast = micros() - lastEdge;
+  if (sinceLast > 250000UL) return 0; // no edge for 250 ms: standstill
+
+  byte n = 0;
+  unsigned long span = 0;
+  for (byte k = 1; k < valid; k++) {
+    unsigned long s = lastEdge - t[(byte)(head - 1 - k) & (ODOMETRY_EDGES - 1)];
+    if ((k > odometryEdgesPerTick) && (s > 50000UL)) break;
+    n = k;
+    span = s;
+  }
+  if (span == 0) return 0;
+  // no new edge for longer than the average period: wheel is slowing down
+  if (sinceLast * n > span) return dir * 1000000.0 / sinceLast;
+  return dir * (n * 1000000.0 / span);
+}
 
 
 // sets wheel motor actuators
@@ -234,58 +306,31 @@ void Robot::setMotorMowPWM(int pwm, boolean useAccel){
 //}
 //
 //
-//// PID controller: correct direction during normal driving (requires IMU)
-//void Robot::motorControlImuDir(){
-//  if (millis() < nextTimeMotorImuControl) return;
-//    nextTimeMotorImuControl = millis() + 100;
-//
-//  int correctLeft = 0;
-//  int correctRight = 0;
-//  
-//  // Regelbereich entspricht maximaler Drehzahl am Antriebsrad (motorSpeedMaxRpm)
-//  imuDirPID.x = distancePI(imu.ypr.yaw, imuDriveHeading) / PI * 180.0;            
-//  imuDirPID.w = 0;
-//  imuDirPID.y_min = -motorSpeedMaxRpm;
-//  imuDirPID.y_max = motorSpeedMaxRpm;    
-//  imuDirPID.max_output = motorSpeedMaxRpm;
-//  imuDirPID.compute();                    
-//                 
-//  if (imuDirPID.y < 0) correctRight = abs(imuDirPID.y);
-//  if (imuDirPID.y > 0) correctLeft  = abs(imuDirPID.y);
-//                 
-//  // Korrektur erfolgt über Abbremsen des linken Antriebsrades, falls Kursabweichung nach rechts
-//  // Regelbereich entspricht maximaler PWM am Antriebsrad (motorSpeedMaxPwm), um auch an Steigungen höchstes Drehmoment für die Solldrehzahl zu gewährleisten
-//  motorLeftPID.x = motorLeftRpmCurr;                     // IST 
-//  motorLeftPID.w = motorLeftSpeedRpmSet - correctLeft;     // SOLL 
-//  motorLeftPID.y_min = -motorSpeedMaxPwm;            // Regel-MIN
-//  motorLeftPID.y_max = motorSpeedMaxPwm;       // Regel-MAX
-//  motorLeftPID.max_output = motorSpeedMaxPwm;        // Begrenzung
-//  motorLeftPID.compute();
-//  int leftSpeed = max(-motorSpeedMaxPwm, min(motorSpeedMaxPwm, motorLeftPWMCurr + motorLeftPID.y));
-//  if((motorLeftSpeedRpmSet >= 0 ) && (leftSpeed <0 )) leftSpeed = 0;
-//  if((motorLeftSpeedRpmSet <= 0 ) && (leftSpeed >0 )) leftSpeed = 0;    
-//
-//  // Korrektur erfolgt über Abbremsen des rechten Antriebsrades, falls Kursabweichung nach links 
-//  // Regelbereich entspricht maximaler PWM am Antriebsrad (motorSpeedMaxPwm), um auch an Steigungen höchstes Drehmoment für die Solldrehzahl zu gewährleisten
-//  motorRightPID.Kp = motorLeftPID.Kp;
-//  motorRightPID.Ki = motorLeftPID.Ki;
-//  motorRightPID.Kd = motorLeftPID.Kd;
-//  motorRightPID.x = motorRightRpmCurr;                   // IST 
-//  motorRightPID.w = motorRightSpeedRpmSet - correctRight;  // SOLL 
-//  motorRightPID.y_min = -motorSpeedMaxPwm;           // Regel-MIN
-//  motorRightPID.y_max = motorSpeedMaxPwm;      // Regel-MAX
-//  motorRightPID.max_output = motorSpeedMaxPwm;       // Begrenzung
-//  motorRightPID.compute();            
-//  int rightSpeed = max(-motorSpeedMaxPwm, min(motorSpeedMaxPwm, motorRightPWMCurr + motorRightPID.y));
-//  if((motorRightSpeedRpmSet >= 0 ) && (rightSpeed <0 )) rightSpeed = 0;
-//  if((motorRightSpeedRpmSet <= 0 ) && (rightSpeed >0 )) rightSpeed = 0;         
-//  
-//  if (  ((stateCurr == STATE_OFF) || (stateCurr == STATE_STATION) || (stateCurr == STATE_ERROR)) && (millis()-stateStartTime>1000)  ){
-//    leftSpeed = rightSpeed = 0; // ensures PWM is zero if OFF/CHARGING
-//  }
-//  setMotorPWM( leftSpeed, rightSpeed, false );                   
-//                 
-//}
+
+
+// PID controller: heading hold during closed-loop speed control (requires IMU)
+// outer loop of cascade: runs at IMU rate and sets angular speed (mrad/s) for motorSpeedControl
+void Robot::motorControlImuDir(){
+  if ((!motorHeadingHoldActive) || (!motorSpeedControlActive)) return;
+  if (imu.lastAHRSTime == motorHeadingLastSample) return;   // no new IMU sample
+  unsigned long dt = imu.lastAHRSTime - motorHeadingLastSample;
+  motorHeadingLastSample = imu.lastAHRSTime;
+
+  // Regelbereich entspricht maximaler Drehrate (deg/s)
+  imuDirPID.x = distancePI(imu.ypr.yaw, motorHeadingSet) / PI * 180.0;
+  imuDirPID.w = 0;
+  imuDirPID.y_min = -motorHeadingMaxRate;
+  imuDirPID.y_max = motorHeadingMaxRate;
+  imuDirPID.max_output = motorHeadingMaxRate;
+  if ((dt == 0) || (dt > 1000)) {
+    // first sample: no derivative kick
+    imuDirPID.eold = imuDirPID.w - imuDirPID.x;
+    return;
+  }
+  imuDirPID.compute(dt / 1000.0);
+  // IMU yaw is clockwise, angular speed counter-clockwise
+  motorAngularSet = imuDirPID.y / 180.0 * PI * 1000.0;
+}
 
 // check for odometry sensor faults    
 void Robot::checkOdometryFaults(){
@@ -313,6 +358,85 @@ void Robot::checkOdometryFaults(){
 }
 
 
+// wheel control tick at MOTOR_CONTROL_RATE (Due: timer interrupt, Mega: loop)
+void Robot::motorControlTick(){
+  calcOdometry();
+  if (autotuneMode == AUTOTUNE_WHEELS) {
+    // relay output around feed forward PWM (same units as PID correction in motorSpeedControl)
+    // finished wheel stops until loop (checkAutotune) takes over
+    unsigned long now = micros();
+    int leftSpeed = (autotuneLeft.running) ? autotuneLeft.run(motorLeftRpmCurr, now) : 0;
+    int rightSpeed = (autotuneRight.running) ? autotuneRight.run(motorRightRpmCurr, now) : 0;
+    setMotorPWM(leftSpeed, rightSpeed, false);
+  }
+  else if (motorSpeedControlActive) motorSpeedControl();
+  else if (motorPWMProfileActive) {
+    // open-loop PWM, jerk-limited ramp (replaces motorAccel low-pass)
+    const double Ta = 1.0 / MOTOR_CONTROL_RATE;
+    setMotorPWM(motorLeftPWMProfile.update(motorLeftPWMSet, Ta), motorRightPWMProfile.update(motorRightPWMSet, Ta), false);
+  }
+}
+
+// stops both wheels: control tick must not drive them again until the next command
+void Robot::stopWheels(){
+  irqstate_t irq = irqLock();
+  motorSpeedControlActive = false;
+  motorHeadingHoldActive = false;
+  motorPWMProfileActive = false;
+  motorLeftPWMSet = motorRightPWMSet = 0;
+  motorLinearSet = motorAngularSet = 0;
+  setMotorPWM(0, 0, false);
+  irqUnlock(irq);
+}
+
+// closed-loop wheel speed control (ROS velocity command)
+// called at fixed rate, so PID uses a constant sampling time
+void Robot::motorSpeedControl(){
+  const double Ta = 1.0 / MOTOR_CONTROL_RATE;
+
+  // linear/angular set speed (jerk-limited ramp) to wheel speeds
+  float linear = motorLinearProfile.update(motorLinearSet, Ta);
+  float angular = motorAngularProfile.update(motorAngularSet, Ta);
+  float wheelOffset = angular * odometryWheelBaseCm / 200.0;   // mm/s
+  motorLeftRpmSet = constrain((linear - wheelOffset) * odometryRpmPerMmS, -motorSpeedMaxRpm, motorSpeedMaxRpm);
+  motorRightRpmSet = constrain((linear + wheelOffset) * odometryRpmPerMmS, -motorSpeedMaxRpm, motorSpeedMaxRpm);
+  motorLeftSpeedRpmSet = motorLeftRpmSet;
+  motorRightSpeedRpmSet = motorRightRpmSet;
+
+  motorLeftPID.x = motorLeftRpmCurr;                 // IST
+  motorLeftPID.w = motorLeftRpmSet;                  // SOLL
+  motorLeftPID.y_min = -motorSpeedMaxPwm;            // Regel-MIN
+  motorLeftPID.y_max = motorSpeedMaxPwm;             // Regel-MAX
+  motorLeftPID.max_output = motorSpeedMaxPwm;        // Begrenzung
+  motorLeftPID.compute(Ta);
+
+  motorRightPID.Kp = motorLeftPID.Kp;
+  motorRightPID.Ki = motorLeftPID.Ki;
+  motorRightPID.Kd = motorLeftPID.Kd;
+  motorRightPID.x = motorRightRpmCurr;               // IST
+  motorRightPID.w = motorRightRpmSet;                // SOLL
+  motorRightPID.y_min = -motorSpeedMaxPwm;           // Regel-MIN
+  motorRightPID.y_max = motorSpeedMaxPwm;            // Regel-MAX
+  motorRightPID.max_output = motorSpeedMaxPwm;       // Begrenzung
+  motorRightPID.compute(Ta);
+
+  // feed forward (open-loop PWM for set speed) plus PID correction
+  int leftSpeed = constrain(motorLeftRpmSet * motorSpeedMaxPwm / motorSpeedMaxRpm + motorLeftPID.y, -motorSpeedMaxPwm, motorSpeedMaxPwm);
+  int rightSpeed = constrain(motorRightRpmSet * motorSpeedMaxPwm / motorSpeedMaxRpm + motorRightPID.y, -motorSpeedMaxPwm, motorSpeedMaxPwm);
+
+  // ensures PWM is really zero at standstill
+  if ( (motorLeftRpmSet == 0) && (abs(motorLeftRpmCurr) < 2) ) {
+    leftSpeed = 0;
+    motorLeftPID.reset();
+  }
+  if ( (motorRightRpmSet == 0) && (abs(motorRightRpmCurr) < 2) ) {
+    rightSpeed = 0;
+    motorRightPID.reset();
+  }
+  setMotorPWM(leftSpeed, rightSpeed, false);
+}
+
+
 void Robot::motorControl(){
   if (millis() < nextTimeMotorControl) return;
     nextTimeMotorControl = millis() + 100;
@@ -434,6 +558,102 @@ void Robot::motorMowControl(){
 }
 
 
+// relay feedback PID autotune (Astrom-Hagglund, see autotune.h)
+// wheels: both wheels oscillate around half max speed in opposite directions (robot turns on the spot)
+// mow: mower motor oscillates around motorMowRPMSet
+void Robot::startAutotune(byte mode){
+  stopAutotune();
+  irqstate_t irq = irqLock();
+  if (mode == AUTOTUNE_WHEELS) {
+    float rpm = motorSpeedMaxRpm / 2;
+    float pwm = motorSpeedMaxPwm / 2;
+    motorSpeedControlActive = false;
+    motorHeadingHoldActive = false;
+    motorPWMProfileActive = false;
+    autotuneLeft.start(rpm, pwm, motorSpeedMaxPwm / 5, 2, 4);
+    autotuneRight.start(-rpm, -pwm, motorSpeedMaxPwm / 5, 2, 4);
+  }
+  else if (mode == AUTOTUNE_MOW) {
+    motorMowEnable = false;
+    autotuneMow.start(motorMowRPMSet, motorMowRPMSet / 20.0, motorMowSpeedMaxPwm / 5, 50, 4);
+  }
+  else {
+    irqUnlock(irq);
+    return;
+  }
+  autotuneStartTime = millis();
+  autotuneMode = mode;
+  irqUnlock(irq);
+  sendROSDebugInfo(ROS_INFO, "autotune started");
+}
+
+void Robot::stopAutotune(){
+  if (autotuneMode == AUTOTUNE_OFF) return;
+  irqstate_t irq = irqLock();
+  byte mode = autotuneMode;
+  autotuneMode = AUTOTUNE_OFF;
+  autotuneLeft.stop();
+  autotuneRight.stop();
+  autotuneMow.stop();
+  if (mode == AUTOTUNE_WHEELS) stopWheels();
+  else setMotorMowPWM(0, false);
+  irqUnlock(irq);
+}
+
+// supervises autotune (called by loop): runs mow relay, applies and saves gains when finished
+void Robot::checkAutotune(){
+  if (autotuneMode == AUTOTUNE_OFF) return;
+  if ((stateCurr == STATE_ERROR) || (millis() - autotuneStartTime > 30000)) {
+    stopAutotune();
+    sendROSDebugInfo(ROS_ERROR, "autotune failed (timeout)");
+    return;
+  }
+  ROSLastTimeMotorCommand = millis();   // keep motor command timeout quiet while tuning
+  RelayAutotune *result = NULL;
+  PID *pid = NULL;
+  if (autotuneMode == AUTOTUNE_WHEELS) {
+    if ((autotuneLeft.running) || (autotuneRight.running)) return;
+    if ((!autotuneLeft.done) || (!autotuneRight.done)) {
+      stopAutotune();
+      sendROSDebugInfo(ROS_ERROR, "autotune failed (no oscillation)");
+      return;
+    }
+    // both wheels share one parameter set (see motorSpeedControl)
+    autotuneLeft.Ku = (autotuneLeft.Ku + autotuneRight.Ku) / 2;
+    autotuneLeft.Tu = (autotuneLeft.Tu + autotuneRight.Tu) / 2;
+    result = &autotuneLeft;
+    pid = &motorLeftPID;
+  }
+  else {
+    if (autotuneMow.running) {
+      if (millis() < nextTimeAutotuneMow) return;
+      nextTimeAutotuneMow = millis() + 100;
+      setMotorMowPWM(autotuneMow.run(motorMowRpmCurr, micros()), false);
+      return;
+    }
+    if (!autotuneMow.done) {
+      stopAutotune();
+      sendROSDebugInfo(ROS_ERROR, "autotune failed (no oscillation)");
+      return;
+    }
+    result = &autotuneMow;
+    pid = &motorMowPID;
+  }
+  stopAutotune();
+  result->apply(*pid);
+  if (pid == &motorLeftPID) {
+    motorRightPID.Kp = motorLeftPID.Kp;
+    motorRightPID.Ki = motorLeftPID.Ki;
+    motorRightPID.Kd = motorLeftPID.Kd;
+    motorRightPID.reset();
+  }
+  saveUserSettings();
+  String msg = "autotune Ku=" + String(result->Ku) + " Tu=" + String(result->Tu)
+    + " Kp=" + String(pid->Kp) + " Ki=" + String(pid->Ki) + " Kd=" + String(pid->Kd);
+  sendROSDebugInfo(ROS_INFO, (char*)msg.c_str());
+}
+
+
 /*
 void Robot::printOdometry(){
   Console.print(F("ODO,"));
@@ -6,6 +6,7 @@ default settings for motor, perimeter, bumper, odometry etc.
 
 #include "mower.h"
 #include "NewPing.h"
+#include "sonar.h"
 
 #include <Arduino.h>
 #include "drivers.h"
@@ -13,6 +14,9 @@ default settings for motor, perimeter, bumper, odometry etc.
 #include "pinman.h"
 #include "buzzer.h"
 #include "flashmem.h"
+#ifndef __AVR__
+  #include "DueTimer.h"
+#endif
 
 
 Mower robot;
@@ -45,6 +49,8 @@ Mower::Mower(){
 		motorPowerMax              = 75;        // motor wheel max power (Watt)		  
 		motorSpeedMaxPwm           = 255;       // motor wheel max Pwm  (8-bit PWM=255, 10-bit PWM=1023)
 		motorSpeedMaxRpm           = 25;        // motor wheel max RPM (WARNING: do not set too high, so there's still speed control when battery is low!)
+		motorLinearProfile.setLimits(0, 300, 1500);     // linear speed ramp: max speed (0=motorSpeedMaxRpm), accel (mm/s^2), jerk (mm/s^3)
+		motorAngularProfile.setLimits(0, 1500, 7500);   // angular speed ramp: max speed (0=motorSpeedMaxRpm), accel (mrad/s^2), jerk (mrad/s^3)
 		motorLeftPID.Kp            = 1.5;       // motor wheel PID controller
     motorLeftPID.Ki            = 0.29;
     motorLeftPID.Kd            = 0.25;
@@ -56,6 +62,8 @@ Mower::Mower(){
 		motorPowerMax              = 2.0;         // motor wheel max power (Watt)			
 		motorSpeedMaxPwm           = 127;       // motor wheel max Pwm  (8-bit PWM=255, 10-bit PWM=1023)	  
 		motorSpeedMaxRpm           = 50;        // motor wheel max RPM (WARNING: do not set too high, so there's still speed control when battery is low!)		
+		motorLinearProfile.setLimits(0, 500, 2500);     // linear speed ramp: max speed (0=motorSpeedMaxRpm), accel (mm/s^2), jerk (mm/s^3)
+		motorAngularProfile.setLimits(0, 3000, 15000);  // angular speed ramp: max speed (0=motorSpeedMaxRpm), accel (mrad/s^2), jerk (mrad/s^3)
 		motorLeftPID.Kp        		 = 0.2;       // motor wheel PID controller
     motorLeftPID.Ki            = 0.0;
     motorLeftPID.Kd            = 0.0;  
@@ -64,6 +72,8 @@ Mower::Mower(){
 		//motorRollTimeMax           = 2000;      // max. roll time (ms)
 		//motorRollTimeMin           = 750;       // min. roll time (ms) should be smaller than motorRollTimeMax  
   #endif		
+  motorLeftPWMProfile.setLimits(0, 500, 2500);    // open-loop PWM ramp (ROS motor command): accel (PWM/s), jerk (PWM/s^2)
+  motorRightPWMProfile.setLimits(0, 500, 2500);
   motorSenseRightScale       = ADC2voltage(1)*1905;   // ADC to right motor sense milliamp 
 	motorSenseLeftScale        = ADC2voltage(1)*1905;   // ADC to left motor sense milliamp 
 	motorPowerIgnoreTime       = 2000;      // time to ignore motor power (ms)  
@@ -106,6 +116,12 @@ Mower::Mower(){
   sonarCenterUse             = 0;
   sonarTriggerBelow          = 0;       // ultrasonic sensor trigger distance (0=off)
 	sonarSlowBelow             = 100;     // ultrasonic sensor slow down distance
+  #ifdef __AVR__
+    sonarGuardTime           = 250;     // ms between sonar bursts (Mega: blocking ping)
+  #else
+    sonarGuardTime           = 10;      // ms between sonar bursts (crosstalk guard time, late echos decay)
+  #endif
+  sonarOutlierCm             = 50;      // outlier filter: max. distance jump (cm) accepted without confirmation (0=off)
   
   // ------ perimeter ---------------------------------
   perimeterUse               = 0;          // use perimeter?    
@@ -132,7 +148,8 @@ Mower::Mower(){
   imuCorrectDir              = 0;          // correct direction by compass?
   imuDirPID.Kp               = 5.0;        // direction PID controller
   imuDirPID.Ki               = 1.0;
-  imuDirPID.Kd               = 1.0;    
+  imuDirPID.Kd               = 1.0;
+  motorHeadingMaxRate        = 30;         // heading hold max. turn rate (deg/s)    
   imuRollPID.Kp              = 0.8;        // roll PID controller
   imuRollPID.Ki              = 21;
   imuRollPID.Kd              = 0;  
@@ -175,9 +192,19 @@ Mower::Mower(){
 
   // ------ odometry ------------------------------------
 		odoLeftRightCorrection     = true;       // left-right correction for straight lines?
+  twoWayOdometrySensorUse    = 0;          // use optional two-wire odometry sensor (quadrature, 4x resolution)?
+  odometryLeftSwapDir        = false;      // inverse left encoder direction (two-wire only)?
+  odometryRightSwapDir       = false;      // inverse right encoder direction (two-wire only)?
+  odometryTicksPerRevolution = 1060;       // encoder ticks per one full resolution (rising edges of one channel)
+  odometryTicksPerCm         = 13.49;      // encoder ticks per cm (rising edges of one channel)
+  odometryWheelBaseCm        = 36;         // wheel-to-wheel distance (cm)
+  odometryImuFusion          = 0;          // IMU yaw weight (0..100%) for odometry heading (0 = wheels only)
 
   // ----- GPS -------------------------------------------
   gpsUse                     = 0;          // use GPS?
+  gpsUbx                     = 1;          // u-blox UBX protocol (NAV-PVT at 115200 baud, 5 Hz)? (0 = NMEA at 9600 baud)
+  gpsOriginLat               = 0;          // local xy (0,0) in 1e-7 degree (0/0 = first fix after start)
+  gpsOriginLon               = 0;
   stuckIfGpsSpeedBelow       = 0.2;        // if Gps speed is below given value the mower is stuck
   gpsSpeedIgnoreTime         = 5000;       // how long gpsSpeed is ignored when robot switches into a new STATE (in ms)
 
@@ -233,6 +260,29 @@ ISR(PCINT0_vect){
 // perimeter filter output (mag value) which disappears when disabling odometry interrupts.
 // SOLUTION: allow odometry interrupt handler nesting (see odometry interrupt function)
 // http://www.nongnu.org/avr-libc/user-manual/group__avr__interrupts.html
+
+// store edge time for wheel speed estimation (lock-free: interrupt is the only writer)
+static inline void addOdometryEdge(odoedges_t &edges, unsigned long time, char dir)
+{
+  edges.time[edges.head & (ODOMETRY_EDGES - 1)] = time;
+  edges.dir = dir;
+  edges.head++;
+  if (edges.valid < ODOMETRY_EDGES) edges.valid++;
+}
+
+// quadrature decoder (two-wire odometry, 4x resolution)
+// index = (last BA << 2) | new BA, value = counter change (0 = no or invalid transition)
+const char odometryQuadTable[16] = { 0, 1, -1, 0, -1, 0, 0, 1, 1, 0, 0, -1, 0, -1, 1, 0 };
+
+static inline void decodeOdometryQuad(byte lastBA, byte newBA, int &counter, odoedges_t &edges, bool swapDir, unsigned long time)
+{
+  char d = odometryQuadTable[(lastBA << 2) | newBA];
+  if (d == 0) return;
+  if (swapDir) d = -d;
+  counter += d;
+  addOdometryEdge(edges, time, d);
+}
+
 #ifdef __AVR__
   
 	volatile byte oldOdoPins = 0;
@@ -241,20 +291,30 @@ ISR(PCINT0_vect){
   {				
 		const byte actPins = PINK;                				// read register PINK
 		const byte setPins = (oldOdoPins ^ actPins);
-		unsigned long time = millis();    
-    if ((setPins & 0b00010000) && (actPins & 0b00010000))               				// pin left is RISING
+		unsigned long time = micros();    
+    if (robot.twoWayOdometrySensorUse)
+    {
+      // left A/B = PK4/PK5 (A12/A13), right A/B = PK6/PK7 (A14/A15)
+      if (setPins & 0b00110000)
+        decodeOdometryQuad((oldOdoPins >> 4) & 3, (actPins >> 4) & 3, robot.odometryLeft, robot.odometryLeftEdges, robot.odometryLeftSwapDir, time);
+      if (setPins & 0b11000000)
+        decodeOdometryQuad((oldOdoPins >> 6) & 3, (actPins >> 6) & 3, robot.odometryRight, robot.odometryRightEdges, robot.odometryRightSwapDir, time);
+    }
+    else if ((setPins & 0b00010000) && (actPins & 0b00010000))               				// pin left is RISING
     {			
 			if (robot.motorLeftPWMCurr >= 0)						// forward
         robot.odometryLeft++;
       else
         robot.odometryLeft--;									// backward
+      addOdometryEdge(robot.odometryLeftEdges, time, (robot.motorLeftPWMCurr >= 0) ? 1 : -1);
     }
-    if ((setPins & 0b01000000) && (actPins & 0b01000000))                  				// pin right is RISING
+    if ((!robot.twoWayOdometrySensorUse) && (setPins & 0b01000000) && (actPins & 0b01000000))      // pin right is RISING
     {			
 			if (robot.motorRightPWMCurr >= 0)
         robot.odometryRight++;								// forward
       else
         robot.odometryRight--;								// backward
+      addOdometryEdge(robot.odometryRightEdges, time, (robot.motorRightPWMCurr >= 0) ? 1 : -1);
     }      
 		oldOdoPins = actPins;
   }
@@ -267,6 +327,7 @@ ISR(PCINT0_vect){
         robot.odometryRight++;								// forward
       else
         robot.odometryRight--;								// backward
+      addOdometryEdge(robot.odometryRightEdges, micros(), (robot.motorRightPWMCurr >= 0) ? 1 : -1);
   }   
 
 	void OdometryLeftInt(){			
@@ -274,17 +335,127 @@ ISR(PCINT0_vect){
         robot.odometryLeft++;
       else
         robot.odometryLeft--;									// backward
+      addOdometryEdge(robot.odometryLeftEdges, micros(), (robot.motorLeftPWMCurr >= 0) ? 1 : -1);
   }	
 
+  // two-wire odometry: both channels trigger on CHANGE, decoded by table
+  // NOTE: the SAM3X TC quadrature decoder (QDEC) only works on TIOA0/TIOB0 (pins 2/13) and TIOA6/TIOB6 (pins 5/4),
+  // which are used for motor PWM/LED/battery switch on the Ardumower PCB - so decoding is done by interrupts.
+  // Both channels of a wheel are on the same PIO port (left: PB15/PB16, right: PA1/PA0), so one
+  // PIO_PDSR read samples A and B together (digitalRead is too slow for a CHANGE interrupt on both channels)
+  static inline byte readOdometryBA(byte pinA, byte pinB){
+    const uint32_t pins = g_APinDescription[pinA].pPort->PIO_PDSR;
+    return ((pins & g_APinDescription[pinA].ulPin) ? 1 : 0) | ((pins & g_APinDescription[pinB].ulPin) ? 2 : 0);
+  }
+
+  void OdometryLeftQuadInt(){
+    byte newBA = readOdometryBA(pinOdometryLeft, pinOdometryLeft2);
+    byte lastBA = robot.odometryLeftLastState | (robot.odometryLeftLastState2 << 1);
+    robot.odometryLeftLastState = newBA & 1;
+    robot.odometryLeftLastState2 = newBA >> 1;
+    decodeOdometryQuad(lastBA, newBA, robot.odometryLeft, robot.odometryLeftEdges, robot.odometryLeftSwapDir, micros());
+  }
+
+  void OdometryRightQuadInt(){
+    byte newBA = readOdometryBA(pinOdometryRight, pinOdometryRight2);
+    byte lastBA = robot.odometryRightLastState | (robot.odometryRightLastState2 << 1);
+    robot.odometryRightLastState = newBA & 1;
+    robot.odometryRightLastState2 = newBA >> 1;
+    decodeOdometryQuad(lastBA, newBA, robot.odometryRight, robot.odometryRightEdges, robot.odometryRightSwapDir, micros());
+  }
+
+#endif
+
+#ifndef __AVR__
+  // wheel speed control timer interrupt (Due)
+  void motorControlTimerHandler(){
+    robot.motorControlTick();
+  }
 #endif
 
 // mower motor speed sensor interrupt
 //void rpm_interrupt(){
 //}
 
-NewPing NewSonarLeft(pinSonarLeftTrigger, pinSonarLeftEcho, 110);
-NewPing NewSonarRight(pinSonarRightTrigger, pinSonarRightEcho, 110);
-NewPing NewSonarCenter(pinSonarCenterTrigger, pinSonarCenterEcho, 110);
+// RTC read (queued I2C transfer)
+byte rtcBuf[8];
+i2ctransfer_t rtcTransfer = {0};
+
+void rtcReadDone(i2ctransfer_t *t){
+  if ((t->status != I2C_DONE) || (!decodeDS1307(rtcBuf, robot.datetime))) {
+    //Console.println("RTC data error!");        
+    robot.addErrorCounter(ERR_RTC_DATA);         
+    robot.setNextState(STATE_ERROR);       
+  }
+}
+
+#ifdef __AVR__
+  // Mega: sonar echo pins are no interrupt pins - blocking ping (see ACT_SONAR_PING)
+  NewPing NewSonarLeft(pinSonarLeftTrigger, pinSonarLeftEcho, 110);
+  NewPing NewSonarRight(pinSonarRightTrigger, pinSonarRightEcho, 110);
+  NewPing NewSonarCenter(pinSonarCenterTrigger, pinSonarCenterEcho, 110);
+  unsigned int sonarDistPinged[3] = {NO_ECHO, NO_ECHO, NO_ECHO};  // center, left, right
+  unsigned long sonarPingTime[3] = {0, 0, 0};
+
+  int readSonar(char type){
+    byte idx = type - SEN_SONAR_CENTER;
+    robot.sensorSampleTime[type] = sonarPingTime[idx];
+    unsigned int dist = sonarDistPinged[idx];
+    if ((dist != NO_ECHO) && (dist * US_ROUNDTRIP_CM < MIN_ECHO_TIME)) return SONAR_CROSSTALK;
+    return dist;
+  }
+
+  void pingSonar(char type){
+    byte idx = type - SEN_SONAR_CENTER;
+    switch (type) {
+      case SEN_SONAR_CENTER: sonarDistPinged[idx] = NewSonarCenter.ping_cm(); break;
+      case SEN_SONAR_LEFT: sonarDistPinged[idx] = NewSonarLeft.ping_cm(); break;
+      case SEN_SONAR_RIGHT: sonarDistPinged[idx] = NewSonarRight.ping_cm(); break;
+    }
+    sonarPingTime[idx] = micros();
+  }
+#else
+  // Due: non-blocking ranging, echo pulse timed by interrupt
+  SonarRanger SonarLeft(pinSonarLeftTrigger, pinSonarLeftEcho, 110, MIN_ECHO_TIME);
+  SonarRanger SonarRight(pinSonarRightTrigger, pinSonarRightEcho, 110, MIN_ECHO_TIME);
+  SonarRanger SonarCenter(pinSonarCenterTrigger, pinSonarCenterEcho, 110, MIN_ECHO_TIME);
+
+  void SonarLeftEchoInt(){
+    SonarLeft.echo();
+  }
+
+  void SonarRightEchoInt(){
+    SonarRight.echo();
+  }
+
+  void SonarCenterEchoInt(){
+    SonarCenter.echo();
+  }
+
+  SonarRanger *sonarRanger(char type){
+    switch (type) {
+      case SEN_SONAR_LEFT: return &SonarLeft;
+      case SEN_SONAR_RIGHT: return &SonarRight;
+      default: return &SonarCenter;
+    }
+  }
+
+  int readSonar(char type){
+    SonarRanger *sonar = sonarRanger(type);
+    if (!sonar->ready()) return SONAR_BUSY;
+    robot.sensorSampleTime[type] = sonar->echoTime;
+    if (sonar->early()) {
+      // echo came too early for a real obstacle: crosstalk
+      sonar->read();
+      return SONAR_CROSSTALK;
+    }
+    return sonar->read();
+  }
+
+  void pingSonar(char type){
+    sonarRanger(type)->ping();
+  }
+#endif
 
 
 // WARNING: never use 'Serial' in the Ardumower code - use 'Console' instead
@@ -299,7 +470,7 @@ void Mower::setup(){
   Buzzer.begin();
 	//Console.begin(CONSOLE_BAUDRATE);  
 	I2Creset();	
-  Wire.begin();            			
+  I2Cbegin();            			
   unsigned long timeout = millis() + 10000;
 	while (millis() < timeout){
     if (!checkAT24C32()){
@@ -420,11 +591,11 @@ void Mower::setup(){
 
 // ARDUMOWERROS
   imu.init();
-	  
-  gps.init();
 
   Robot::setup();  
 
+  gps.init(gpsUbx);  // after user settings are loaded
+
   if (esp8266Use) {
   //  Console.println(F("Sending ESP8266 Config"));
     ESP8266port.begin(ESP8266_BAUDRATE);
@@ -469,9 +640,15 @@ void Mower::setup(){
 	// PCMSK2, PCINT21, HIGH
 	// PCMSK2, PCINT23, HIGH
 
+	  oldOdoPins = PINK;
 	  PCICR |= (1<<PCIE2);
 	  PCMSK2 |= (1<<PCINT20);
 	  PCMSK2 |= (1<<PCINT22);	  
+	  if (twoWayOdometrySensorUse)
+	  {
+	    PCMSK2 |= (1<<PCINT21);
+	    PCMSK2 |= (1<<PCINT23);
+	  }
 	
 		
   //-------------------------------------------------------------------------	
@@ -485,8 +662,24 @@ void Mower::setup(){
 #else
   // Due interrupts
   // ODO
-  attachInterrupt(pinOdometryLeft, OdometryLeftInt, RISING);    
-  attachInterrupt(pinOdometryRight, OdometryRightInt, RISING);  
+  if (twoWayOdometrySensorUse)
+  {
+    odometryLeftLastState = digitalRead(pinOdometryLeft);
+    odometryLeftLastState2 = digitalRead(pinOdometryLeft2);
+    odometryRightLastState = digitalRead(pinOdometryRight);
+    odometryRightLastState2 = digitalRead(pinOdometryRight2);
+    attachInterrupt(pinOdometryLeft, OdometryLeftQuadInt, CHANGE);
+    attachInterrupt(pinOdometryLeft2, OdometryLeftQuadInt, CHANGE);
+    attachInterrupt(pinOdometryRight, OdometryRightQuadInt, CHANGE);
+    attachInterrupt(pinOdometryRight2, OdometryRightQuadInt, CHANGE);
+    PinMan.setDebounce(pinOdometryLeft2, 100);
+    PinMan.setDebounce(pinOdometryRight2, 100);
+  }
+  else
+  {
+    attachInterrupt(pinOdometryLeft, OdometryLeftInt, RISING);    
+    attachInterrupt(pinOdometryRight, OdometryRightInt, RISING);  
+  }
 	PinMan.setDebounce(pinOdometryLeft, 100);  // reject spikes shorter than usecs on pin
 	PinMan.setDebounce(pinOdometryRight, 100);  // reject spikes shorter than usecs on pin	      
     
@@ -499,6 +692,14 @@ void Mower::setup(){
 	
 	//Motor Mow RPM	
 	//attachInterrupt(pinMotorMowRpm, PCINT2_vect, CHANGE);    
+
+  // sonar echo
+  SonarLeft.begin(SonarLeftEchoInt);
+  SonarRight.begin(SonarRightEchoInt);
+  SonarCenter.begin(SonarCenterEchoInt);
+
+  // wheel speed control at fixed rate (Timer1 is used by buzzer)
+  Timer3.attachInterrupt(motorControlTimerHandler).setFrequency(MOTOR_CONTROL_RATE).start();
 #endif   
   
 }
@@ -549,6 +750,10 @@ void Mower::resetMotorFault(){
 
  
 int Mower::readSensor(char type){
+  // sonar is stamped with time of ranging
+  if ((type == SEN_SONAR_CENTER) || (type == SEN_SONAR_LEFT) || (type == SEN_SONAR_RIGHT)) return readSonar(type);
+  // IMU is stamped by IMU::update with time of its last fused sample
+  if (type != SEN_IMU) sensorSampleTime[type] = micros(); // capture time, sent with ROS responses
   switch (type) {
 // motors------------------------------------------------------------------------------------------------
 #if defined (DRIVER_L298N)
@@ -591,19 +796,16 @@ int Mower::readSensor(char type){
     case SEN_DROP_LEFT: return(digitalRead(pinDropLeft)); break;                                                                                        // Dropsensor - Absturzsensor
 
 // sonar---------------------------------------------------------------------------------------------------   
-    case SEN_SONAR_CENTER: return(NewSonarCenter.ping_cm()); break;
-    case SEN_SONAR_LEFT: return(NewSonarLeft.ping_cm()); break;
-    case SEN_SONAR_RIGHT: return(NewSonarRight.ping_cm()); break;    
+    // SEN_SONAR_CENTER, SEN_SONAR_LEFT, SEN_SONAR_RIGHT: see readSonar
 
 // imu-------------------------------------------------------------------------------------------------------
     //case SEN_IMU: imuYaw=imu.ypr.yaw; imuPitch=imu.ypr.pitch; imuRoll=imu.ypr.roll; break;    
 // rtc--------------------------------------------------------------------------------------------------------
     case SEN_RTC: 
-      if (!readDS1307(datetime)) {
-        //Console.println("RTC data error!");        
-        addErrorCounter(ERR_RTC_DATA);         
-        setNextState(STATE_ERROR);       
-      }
+      // queued read, see rtcReadDone (last read still running: skip)
+      if (rtcTransfer.status == I2C_QUEUED) break;
+      I2Cprepare(&rtcTransfer, DS1307_ADDRESS, 0x00, sizeof rtcBuf, rtcBuf, true, rtcReadDone);
+      I2Csubmit(&rtcTransfer);
       break;
 // rain--------------------------------------------------------------------------------------------------------
     case SEN_RAIN: if (digitalRead(pinRain)==LOW) return 1; break;
@@ -632,6 +834,7 @@ void Mower::setActuator(char type, int value){
     case ACT_CHGRELAY: digitalWrite(pinChargeRelay, value); break;
     //case ACT_CHGRELAY: digitalWrite(pinChargeRelay, !value); break;
     case ACT_BATTERY_SW: digitalWrite(pinBatterySwitch, value); break;
+    case ACT_SONAR_PING: pingSonar(value); break;
   }
 }
 
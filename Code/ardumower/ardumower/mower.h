@@ -150,6 +150,10 @@ choose your robot type, PCB version, baud rates, pin definitions etc.
 // ------- I2C addresses --------------------------------------------------------------
 #define DS1307_ADDRESS B1101000
 #define AT24C32_ADDRESS B1010000
+#define AT24C32_PAGE_SIZE 32
+#define AT24C32_WRITE_CHUNK 32   // page part per I2C transfer (whole page)
+#define AT24C32_WRITE_TIMEOUT 20 // max. write cycle time (ms)
+#define AT24C32_READ_CHUNK 128   // sequential read part per I2C transfer
 
 // ---- choose only one perimeter signal code ----
 #define SIGCODE_1  // Ardumower default perimeter signal
@@ -31,6 +31,7 @@
 #include "imu.h"
 #include "perimeter.h"
 #include "config.h"
+#include "i2c.h"
 
 RemoteControl::RemoteControl()
 {
@@ -630,6 +631,7 @@ void RemoteControl::sendSonarMenu(boolean update)
   serialPort->print(robot->sonarDistRight);
   sendSlider("d03", F("Trigger below (cm)(0=off)"), robot->sonarTriggerBelow, "", 1, 100);
   sendSlider("d07", F("Slow below (cm)"), robot->sonarSlowBelow, "", 1, 100);
+  sendSlider("d08", F("Outlier jump (cm)(0=off)"), robot->sonarOutlierCm, "", 1, 100);
   serialPort->println("}");
 }
 
@@ -641,6 +643,8 @@ void RemoteControl::processSonarMenu(String pfodCmd)
     processSlider(pfodCmd, robot->sonarSlowBelow, 1);
   else if (pfodCmd.startsWith("d03"))
     processSlider(pfodCmd, robot->sonarTriggerBelow, 1);
+  else if (pfodCmd.startsWith("d08"))
+    processSlider(pfodCmd, robot->sonarOutlierCm, 1);
   else if (pfodCmd == "d04")
     robot->sonarLeftUse = !robot->sonarLeftUse;
   else if (pfodCmd == "d05")
@@ -781,6 +785,9 @@ void RemoteControl::sendGPSMenu(boolean update)
     serialPort->print(F("{.GPS`1000"));
   serialPort->print(F("|q00~Use "));
   sendYesNo(robot->gpsUse);
+  serialPort->print(F("|q03~UBX protocol (restart) "));
+  sendYesNo(robot->gpsUbx);
+  serialPort->print(F("|q04~Set origin here"));
   sendSlider("q01", F("Stuck if GPS speed is below"), robot->stuckIfGpsSpeedBelow, "", 0.1, 3);
   // ROS?
   //sendSlider("q02", F("GPS speed ignore time"), robot->gpsSpeedIgnoreTime, "", 1, 10000, robot->motorReverseTime);
@@ -791,6 +798,10 @@ void RemoteControl::processGPSMenu(String pfodCmd)
 {
   if (pfodCmd == "q00")
     robot->gpsUse = !robot->gpsUse;
+  else if (pfodCmd == "q03")
+    robot->gpsUbx = !robot->gpsUbx;
+  else if (pfodCmd == "q04")
+    robot->setGPSOrigin();
   else if (pfodCmd.startsWith("q01"))
     processSlider(pfodCmd, robot->stuckIfGpsSpeedBelow, 0.1);
   else if (pfodCmd.startsWith("q02"))
@@ -1090,6 +1101,18 @@ void RemoteControl::sendInfoMenu(boolean update)
   serialPort->print(robot->statsBatteryChargingCapacityTotal / 1000);
   serialPort->print(F("|v08~Battery recharged capacity average (mAh)"));
   serialPort->print(robot->statsBatteryChargingCapacityAverage);
+  for (uint8_t i=0; i < I2CgetDeviceCount(); i++){
+    uint8_t device = I2CgetDevice(i);
+    serialPort->print(F("|v1"));
+    serialPort->print(i);
+    serialPort->print(F("~I2C 0x"));
+    serialPort->print(device, HEX);
+    serialPort->print(F(" errors "));
+    serialPort->print(I2CgetErrorCounter(device));
+    serialPort->print(F(" (consecutive "));
+    serialPort->print(I2CgetConsecutiveErrors(device));
+    serialPort->print(F(")"));
+  }
   //serialPort->print("|d01~Perimeter v");
   //serialPort->print(verToString(readPerimeterVer()));
   //serialPort->print("|d02~IMU v");
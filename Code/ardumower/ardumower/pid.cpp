@@ -48,9 +48,14 @@ void PID::reset(void) {
 
 float PID::compute() {
   unsigned long now = micros();
-  Ta = ((now - lastControlTime) / 1000000.0);
+  double dt = ((now - lastControlTime) / 1000000.0);
   lastControlTime = now;
-  if (Ta > 1.0) Ta = 1.0;   // should only happen for the very first call
+  if (dt > 1.0) dt = 1.0;   // should only happen for the very first call
+  return compute(dt);
+}
+
+float PID::compute(double Ta) {
+  this->Ta = Ta;
 
   // compute error
   float e = (w - x);	
@@ -94,9 +99,15 @@ VelocityPID::VelocityPID(float Kp, float Ki, float Kd){
 float VelocityPID::compute()
 {   
   unsigned long now = micros();
-  Ta = ((now - lastControlTime) / 1000000.0);
+  double dt = ((now - lastControlTime) / 1000000.0);
   lastControlTime = now;
-  if (Ta > 1.0) Ta = 1.0;   // should only happen for the very first call
+  if (dt > 1.0) dt = 1.0;   // should only happen for the very first call
+  return compute(dt);
+}
+
+float VelocityPID::compute(double Ta)
+{
+  this->Ta = Ta;
 
   // compute error
   int16_t e = (w - x);
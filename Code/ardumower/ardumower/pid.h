@@ -37,8 +37,9 @@ class PID
   public:
     PID();
     PID(float Kp, float Ki, float Kd);
-    void reset(void);
-    float compute();
+    virtual void reset(void);
+    virtual float compute();
+    virtual float compute(double Ta); // fixed sampling time (controller called at constant rate)
     double Ta; // sampling time	
     float w; // set value
     float x; // current value
@@ -61,6 +62,7 @@ class VelocityPID
     VelocityPID();
     VelocityPID(float Kp, float Ki, float Kd);
     float compute();
+    float compute(double Ta); // fixed sampling time (controller called at constant rate)
     double Ta; // sampling time 
     float w; // set value
     float x; // current value
@@ -78,6 +80,131 @@ class VelocityPID
 };
 
 
+/*
+  fixed point digital PID controllers (Q16.16 by default), same interface as PID/VelocityPID
+  - parameters, set and current value stay float, the controller itself computes in fixed point
+  - gains and 1/Ta are precomputed only if Ta or a parameter changes (call compute(Ta) at a constant rate)
+  - anti wind-up by clamping the integral term (esum is not used)
+  NOTE: fast on Due (32x32->64 bit multiply in hardware), on Mega the 64 bit products cost about as much as float
+*/
+
+template <byte FRAC = 16> class FixedPID : public PID
+{
+  public:
+    FixedPID() : prepared(false), iTerm(0), eOld(0), KpQ(0), KiTa(0), KdInvTa(0) {}
+    FixedPID(float Kp, float Ki, float Kd) : PID(Kp, Ki, Kd), prepared(false), iTerm(0), eOld(0), KpQ(0), KiTa(0), KdInvTa(0) {}
+    void reset(void) {
+      PID::reset();
+      iTerm = eOld = 0;
+    }
+    float compute() {
+      unsigned long now = micros();
+      double dt = ((now - lastControlTime) / 1000000.0);
+      lastControlTime = now;
+      if (dt > 1.0) dt = 1.0;   // should only happen for the very first call
+      return compute(dt);
+    }
+    float compute(double Ta) {
+      if ((!prepared) || (Ta != this->Ta) || (Kp != KpLast) || (Ki != KiLast) || (Kd != KdLast)
+        || (max_output != maxOutputLast) || (y_min != yMinLast) || (y_max != yMaxLast)) prepare(Ta);
+      // compute error
+      long e = toFixed(w) - toFixed(x);
+      // integrate error, anti wind-up by clamping
+      iTerm += mul(KiTa, e);
+      if (iTerm > maxOutput) iTerm = maxOutput;
+      if (iTerm < -maxOutput) iTerm = -maxOutput;
+      long out = mul(KpQ, e) + iTerm + mul(KdInvTa, e - eOld);
+      eOld = e;
+      // restrict output to min/max
+      if (out > yMax) out = yMax;
+      if (out < yMin) out = yMin;
+      eold = fromFixed(e);
+      y = fromFixed(out);
+      return y;
+    }
+  private:
+    boolean prepared;
+    long iTerm; // integral term
+    long eOld;
+    long KpQ, KiTa, KdInvTa, maxOutput, yMin, yMax;
+    float KpLast, KiLast, KdLast, maxOutputLast, yMinLast, yMaxLast;
+    void prepare(double Ta) {
+      this->Ta = Ta;
+      KpLast = Kp; KiLast = Ki; KdLast = Kd;
+      maxOutputLast = max_output; yMinLast = y_min; yMaxLast = y_max;
+      KpQ = toFixed(Kp);
+      KiTa = toFixed(Ki * Ta);
+      KdInvTa = toFixed(Kd / Ta);
+      maxOutput = toFixed(max_output);
+      yMin = toFixed(y_min);
+      yMax = toFixed(y_max);
+      prepared = true;
+    }
+    static long toFixed(float v) { return (long)(v * (float)(1L << FRAC)); }
+    static float fromFixed(long v) { return v * (1.0 / (float)(1L << FRAC)); }
+    static long mul(long a, long b) { return (long)(((int64_t)a * b) >> FRAC); }
+};
+
+// NOTE: unlike VelocityPID the error is not truncated to an integer; the integer output is
+// truncated towards zero as in VelocityPID (max_output < 32768)
+template <byte FRAC = 16> class FixedVelocityPID : public VelocityPID
+{
+  public:
+    FixedVelocityPID() : prepared(false), eOld1(0), eOld2(0), KpQ(0), KiTa(0), KdInvTa(0) {}
+    FixedVelocityPID(float Kp, float Ki, float Kd) : VelocityPID(Kp, Ki, Kd), prepared(false), eOld1(0), eOld2(0), KpQ(0), KiTa(0), KdInvTa(0) {}
+    float compute() {
+      unsigned long now = micros();
+      double dt = ((now - lastControlTime) / 1000000.0);
+      lastControlTime = now;
+      if (dt > 1.0) dt = 1.0;   // should only happen for the very first call
+      return compute(dt);
+    }
+    float compute(double Ta) {
+      if ((!prepared) || (Ta != this->Ta) || (Kp != KpLast) || (Ki != KiLast) || (Kd != KdLast)) prepare(Ta);
+      // compute error
+      long e = toFixed(w) - toFixed(x);
+
+      // compute max/min output
+      if (w < 0) { y_min = -max_output; y_max = 0; }
+      if (w > 0) { y_min = 0; y_max = max_output; }
+
+      long out = ((long)yold << FRAC)
+          + mul(KpQ, e - eOld1)
+          + mul(KiTa, e)
+          + mul(KdInvTa, e - 2 * eOld1 + eOld2);
+      y = (out >= 0) ? (int)(out >> FRAC) : -(int)((-out) >> FRAC);
+
+      // restrict output to min/max
+      if (y > y_max) y = y_max;
+      if (y < y_min) y = y_min;
+
+      // save variable for next time
+      eOld2 = eOld1;
+      eOld1 = e;
+      eold2 = eold1;
+      eold1 = fromFixed(e);
+      yold = y;
+
+      return y;
+    }
+  private:
+    boolean prepared;
+    long eOld1, eOld2;
+    long KpQ, KiTa, KdInvTa;
+    float KpLast, KiLast, KdLast;
+    void prepare(double Ta) {
+      this->Ta = Ta;
+      KpLast = Kp; KiLast = Ki; KdLast = Kd;
+      KpQ = toFixed(Kp);
+      KiTa = toFixed(Ki * Ta);
+      KdInvTa = toFixed(Kd / Ta);
+      prepared = true;
+    }
+    static long toFixed(float v) { return (long)(v * (float)(1L << FRAC)); }
+    static float fromFixed(long v) { return v * (1.0 / (float)(1L << FRAC)); }
+    static long mul(long a, long b) { return (long)(((int64_t)a * b) >> FRAC); }
+};
+
 
 #endif
 
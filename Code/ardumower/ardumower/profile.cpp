@@ -0,0 +1,72 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+  
+*/
+
+#include "profile.h"
+
+
+MotionProfile::MotionProfile(){
+  vMax = aMax = jMax = 0;
+  reset();
+}
+
+void MotionProfile::setLimits(float vMax, float aMax, float jMax){
+  this->vMax = vMax;
+  this->aMax = aMax;
+  this->jMax = jMax;
+}
+
+void MotionProfile::reset(float v){
+  this->v = v;
+  a = 0;
+}
+
+float MotionProfile::update(float target, double Ta){
+  if (vMax > 0) target = constrain(target, -vMax, vMax);
+  if (aMax <= 0) {
+    // no limits: follow target
+    v = target;
+    a = 0;
+    return v;
+  }
+  float dv = target - v;
+  if (jMax <= 0) {
+    // trapezoidal
+    a = constrain(dv / Ta, -aMax, aMax);
+  }
+  else {
+    // velocity reached if acceleration is ramped down to zero from now on
+    float vStop = v + a * fabs(a) / (2 * jMax);
+    float aSet;
+    float dj = jMax * Ta;
+    if (vStop < target - dj * Ta) aSet = aMax;
+    else if (vStop > target + dj * Ta) aSet = -aMax;
+    else aSet = 0;
+    a += constrain(aSet - a, -dj, dj);
+  }
+  v += a * Ta;
+  // reached (or crossed) target: stop ramp
+  if ( ((dv >= 0) && (v >= target)) || ((dv <= 0) && (v <= target)) ) {
+    v = target;
+    a = 0;
+  }
+  return v;
+}
@@ -0,0 +1,51 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+
+*/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <Arduino.h>
+
+
+/*
+  online motion profile generator (velocity ramp)
+  ramps velocity v towards a target with acceleration limit aMax and jerk limit jMax (S-curve),
+  jMax = 0 gives a trapezoidal profile (acceleration steps)
+  must be called at constant rate (sampling time Ta)
+*/
+
+class MotionProfile
+{
+  public:
+    MotionProfile();
+    void setLimits(float vMax, float aMax, float jMax);
+    void reset(float v = 0);
+    float update(float target, double Ta); // returns new velocity
+    float vMax; // velocity limit
+    float aMax; // acceleration limit (per second)
+    float jMax; // jerk limit (per second^2), 0 = no jerk limit
+    float v;    // current velocity
+    float a;    // current acceleration
+};
+
+
+#endif
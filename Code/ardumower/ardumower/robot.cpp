@@ -33,8 +33,10 @@
 #include "config.h"
 #include "i2c.h"
 #include "flashmem.h"
+#include "journal.h"
 
-#define MAGIC 52
+#define MAGIC 57
+#define LEGACY_MAGIC 52   // fixed address layout of older firmware (statistics and error counters are migrated)
 
 #define ADDR_USER_SETTINGS 0
 #define ADDR_ERR_COUNTERS 400
@@ -44,8 +46,8 @@ const char *stateNames[] = {"OFF ", "ROS", "REMOTE", "ERR ", "CHARG", "STAT"};
 
 const char *sensorNames[] = {"SEN_STATUS", "SEN_PERIM_LEFT", "SEN_PERIM_RIGHT", "SEN_LAWN_FRONT", "SEN_LAWN_BACK",
                              "SEN_BAT_VOLTAGE", "SEN_CHG_CURRENT", "SEN_CHG_VOLTAGE", "SEN_MOTOR_LEFT", "SEN_MOTOR_RIGHT", "SEN_MOTOR_MOW", "SEN_BUMPER_LEFT", "SEN_BUMPER_RIGHT",
-                             "SEN_DROP_LEFT", "SEN_DROP_RIGHT", "SEN_SONAR_CENTER", "SEN_SONAR_LEFT", "SEN_SONAR_RIGHT", "SEN_BUTTON", "SEN_IMU", "SEN_MOTOR_MOW_RPM", "SEN_RTC",
-                             "SEN_RAIN", "SEN_TILT", "SEN_FREE_WHEEL"
+                             "SEN_DROP_LEFT", "SEN_DROP_RIGHT", "SEN_SONAR_CENTER", "SEN_SONAR_LEFT", "SEN_SONAR_RIGHT", "SEN_BUTTON", "SEN_IMU", "SEN_ODOM", "SEN_MOTOR_MOW_RPM", "SEN_RTC",
+                             "SEN_RAIN", "SEN_TILT", "SEN_FREE_WHEEL", "SEN_POSE", "SEN_GPS"
                             };
 
 
@@ -83,16 +85,35 @@ Robot::Robot()
   idleTimeSec = 0;
   ROSlastMessageID = 0;
   ROSLastTimeMotorCommand = 0;
+  ROSLastRxMicros = 0;
 
   statsMowTimeTotalStart = false;
 
   odometryLeft = odometryRight = 0;
   odometryLeftLastState = odometryLeftLastState2 = odometryRightLastState = odometryRightLastState2 = LOW;
+  odometryX = odometryY = odometryTheta = 0;
+  odometrySpeed = odometryYawRate = 0;
+  odometryPoseTime = 0;
+  odometryLeftLast = odometryRightLast = 0;
+  odometryImuThetaLast = 0;
+  memset((void*)&odometryLeftEdges, 0, sizeof odometryLeftEdges);
+  memset((void*)&odometryRightEdges, 0, sizeof odometryRightEdges);
 
   motorRightRpmCurr = motorLeftRpmCurr = 0;
   lastMotorRpmTime = 0;
   lastSetMotorSpeedTime = 0;
   motorLeftSpeedRpmSet = motorRightSpeedRpmSet = 0;
+  motorSpeedControlActive = false;
+  motorLinearSet = motorAngularSet = 0;
+  motorLeftRpmSet = motorRightRpmSet = 0;
+  nextTimeMotorControlTick = 0;
+  motorHeadingHoldActive = false;
+  motorHeadingSet = 0;
+  motorHeadingLastSample = 0;
+  motorPWMProfileActive = false;
+  motorLeftPWMSet = motorRightPWMSet = 0;
+  autotuneMode = AUTOTUNE_OFF;
+  autotuneStartTime = nextTimeAutotuneMow = 0;
   motorLeftPWMCurr = motorRightPWMCurr = 0;
   motorRightSenseADC = motorLeftSenseADC = 0;
   motorLeftSenseCurrent = motorRightSenseCurrent = 0;
@@ -129,7 +150,8 @@ Robot::Robot()
   dropLeftCounter = dropRightCounter = 0; // Dropsensor - Absturzsensor
   dropLeft = dropRight = false;           // Dropsensor - Absturzsensor
 
-  gpsLat = gpsLon = gpsX = gpsY = 0;
+  gpsEast = gpsNorth = 0;
+  gpsX = gpsY = 0;
   robotIsStuckCounter = 0;
 
   imuDriveHeading = 0;
@@ -189,6 +211,12 @@ Robot::Robot()
   nextTimeBumper = 0;
   nextTimeDrop = 0; // Dropsensor - Absturzsensor
   nextTimeSonar = 0;
+  sonarGroup = 1;
+  sonarPending = 0;
+  for (byte i=0; i < 3; i++)
+    for (byte j=0; j < 3; j++) sonarHistory[i][j] = SONAR_NO_ECHO_RAW;
+  memset(sonarHistoryIdx, 0, sizeof sonarHistoryIdx);
+  memset(sonarOutlier, 0, sizeof sonarOutlier);
   nextTimeFreeWheel = 0;
   nextTimeBattery = 0;
   nextTimeCheckBattery = millis() + 10000;
@@ -198,7 +226,6 @@ Robot::Robot()
   nextTimePrintErrors = 0;
   nextTimeTimer = millis() + 60000;
   nextTimeRTC = 0;
-  nextTimeGPS = 0;
   nextTimePfodLoop = 0;
   nextTimeRain = 0;
   lastMotorMowRpmTime = millis();
@@ -211,6 +238,7 @@ Robot::Robot()
   nextTimeMotorMowControl = 0;
 
   nextTimeRobotStats = 0;
+  statsDirtyTime = 0;
   statsMowTimeMinutesTripCounter = 0;
   statsBatteryChargingCounter = 0;
 }
@@ -279,6 +307,7 @@ void Robot::setup()
   setMotorPWM(0, 0, false);
   loadSaveErrorCounters(true);
   loadUserSettings();
+  initOdometry();
   if (!statsOverride)
     loadSaveRobotStats(true);
   else
@@ -512,31 +541,44 @@ void Robot::readSensors()
     lawnSensorBackOld = lawnSensorBack;
   }
 
-  if ((sonarUse) && (millis() >= nextTimeSonar))
+  // sonar: left and right beams don't overlap and are fired together, center is fired alone
+  // next burst is fired when all echos are in and the crosstalk guard time has passed
+  if (sonarUse)
   {
-    static char senSonarTurn = SEN_SONAR_CENTER;
-    nextTimeSonar = millis() + 250;
-
-    switch (senSonarTurn)
+    for (byte i = 0; i < 3; i++)
+    {
+      if ((sonarPending & (1 << i)) == 0) continue;
+      char type = SEN_SONAR_CENTER + i;
+      int dist = readSensor(type);
+      if (dist == SONAR_BUSY) continue;
+      sonarPending &= ~(1 << i);
+      if (sonarPending == 0) nextTimeSonar = millis() + sonarGuardTime;
+      if (dist == SONAR_CROSSTALK) continue;
+      switch (type)
+      {
+        case SEN_SONAR_CENTER:
+          sonarDistCenter = filterSonar(i, dist);
+          break;
+        case SEN_SONAR_LEFT:
+          sonarDistLeft = filterSonar(i, dist);
+          break;
+        case SEN_SONAR_RIGHT:
+          sonarDistRight = filterSonar(i, dist);
+          break;
+      }
+    }
+    if ((sonarPending == 0) && (millis() >= nextTimeSonar))
     {
-      case SEN_SONAR_RIGHT:
-        if (sonarRightUse)
-          sonarDistRight = readSensor(SEN_SONAR_RIGHT);
-        senSonarTurn = SEN_SONAR_LEFT;
-        break;
-      case SEN_SONAR_LEFT:
-        if (sonarLeftUse)
-          sonarDistLeft = readSensor(SEN_SONAR_LEFT);
-        senSonarTurn = SEN_SONAR_CENTER;
-        break;
-      case SEN_SONAR_CENTER:
-        if (sonarCenterUse)
-          sonarDistCenter = readSensor(SEN_SONAR_CENTER);
-        senSonarTurn = SEN_SONAR_RIGHT;
-        break;
-      default:
-        senSonarTurn = SEN_SONAR_CENTER;
-        break;
+      byte sides = (sonarLeftUse ? (1 << 1) : 0) | (sonarRightUse ? (1 << 2) : 0);
+      byte center = (sonarCenterUse ? 1 : 0);
+      sonarGroup = !sonarGroup;
+      if ((sonarGroup == 0) && (sides == 0)) sonarGroup = 1;
+      if ((sonarGroup == 1) && (center == 0)) sonarGroup = 0;
+      sonarPending = (sonarGroup == 0) ? sides : center;
+      for (byte i = 0; i < 3; i++)
+      {
+        if (sonarPending & (1 << i)) setActuator(ACT_SONAR_PING, SEN_SONAR_CENTER + i);
+      }
     }
   }
 
@@ -609,6 +651,8 @@ void Robot::readSensors()
     // IMU
     readSensor(SEN_IMU);
     nextTimeIMU = millis() + 200; // 5 hz
+    if (imu.calibInfoAvail())
+      sendROSDebugInfo(ROS_INFO, (char*)imu.calibInfo.c_str());
     if (imu.getErrorCounter() > 0)
     {
       addErrorCounter(ERR_IMU_COMM);
@@ -804,7 +848,7 @@ void Robot::checkCurrent()
       //beep(1);
       motorLeftSenseCounter++;
       setSensorTriggered(SEN_MOTOR_LEFT);
-      setMotorPWM(0, 0, false);
+      stopWheels();
     }
 
   }
@@ -817,7 +861,7 @@ void Robot::checkCurrent()
       //beep(1);
       motorRightSenseCounter++;
       setSensorTriggered(SEN_MOTOR_RIGHT);
-      setMotorPWM(0, 0, false);
+      stopWheels();
     }
   }
 }
@@ -897,6 +941,31 @@ void Robot::checkCurrent()
 //  }
 //}
 
+// median-of-3 filter of sonar distances (idx: 0..2 = center, left, right)
+// no echo counts as far away, so a single spike or dropout does not change the output
+unsigned int Robot::filterSonar(byte idx, unsigned int dist)
+{
+  unsigned int *h = sonarHistory[idx];
+  unsigned int v = (dist == NO_ECHO) ? SONAR_NO_ECHO_RAW : dist;
+  if (sonarOutlierCm > 0)
+  {
+    // a single distance jumping away from the filtered one (crosstalk, multipath) is dropped,
+    // the second one in a row is taken as real change
+    unsigned int m = max(min(h[0], h[1]), min(max(h[0], h[1]), h[2]));
+    unsigned int jump = (v > m) ? v - m : m - v;
+    if ((jump > (unsigned int)sonarOutlierCm) && (!sonarOutlier[idx]))
+    {
+      sonarOutlier[idx] = true;
+      return (m == SONAR_NO_ECHO_RAW) ? NO_ECHO : m;
+    }
+    sonarOutlier[idx] = false;
+  }
+  h[sonarHistoryIdx[idx]] = v;
+  sonarHistoryIdx[idx] = (sonarHistoryIdx[idx] + 1) % 3;
+  unsigned int m = max(min(h[0], h[1]), min(max(h[0], h[1]), h[2]));
+  return (m == SONAR_NO_ECHO_RAW) ? NO_ECHO : m;
+}
+
 // check sonar
 void Robot::checkSonar()
 {
@@ -907,12 +976,7 @@ void Robot::checkSonar()
   nextTimeCheckSonar = millis() + 500;
   if (millis() < stateStartTime + 4000)
     return;
-  if (sonarDistCenter < 11 || sonarDistCenter > 100)
-    sonarDistCenter = NO_ECHO; // Objekt ist zu nah am Sensor Wert ist unbrauchbar
-  if (sonarDistRight < 11 || sonarDistRight > 100)
-    sonarDistRight = NO_ECHO; // Object is too close to the sensor. Sensor value is useless
-  if (sonarDistLeft < 11 || sonarDistLeft > 100)
-    sonarDistLeft = NO_ECHO; // Filters spiks under the possible detection limit
+  // spikes are removed by median filter (filterSonar), crosstalk by early echo rejection (readSensors)
 
   // slow down motor wheel speed near obstacles
   //  if ((stateCurr == STATE_FORWARD)) //|| (((stateCurr == STATE_FORWARD) || (stateCurr == STATE_REVERSE))))
@@ -996,24 +1060,38 @@ void Robot::checkTilt()
 }
 
 
+// called for each new fix
 void Robot::processGPSData()
 {
-  if (millis() < nextTimeGPS)
-    return;
-  nextTimeGPS = millis() + 1000;
-  float nlat, nlon;
-  unsigned long age;
-  gps.f_get_position(&nlat, &nlon, &age);
-  if (nlat == GPS::GPS_INVALID_F_ANGLE)
+  long lat, lon;
+  gps.get_position_e7(&lat, &lon);
+  if (lat == GPS::GPS_INVALID_ANGLE_E7)
     return;
-  if (gpsLon == 0)
+  if (!gps.origin_valid())
   {
-    gpsLon = nlon; // this is xy (0,0)
-    gpsLat = nlat;
-    return;
+    if ((gpsOriginLat == 0) && (gpsOriginLon == 0))
+    {
+      gpsOriginLat = lat; // this is xy (0,0)
+      gpsOriginLon = lon;
+    }
+    gps.set_origin(gpsOriginLat, gpsOriginLon);
   }
-  gpsX = (float)gps.distance_between(nlat, gpsLon, gpsLat, gpsLon);
-  gpsY = (float)gps.distance_between(gpsLat, nlon, gpsLat, gpsLon);
+  gps.to_enu(lat, lon, &gpsEast, &gpsNorth);
+  gpsX = gpsEast / 1000.0;
+  gpsY = gpsNorth / 1000.0;
+}
+
+// current position becomes xy (0,0)
+void Robot::setGPSOrigin()
+{
+  long lat, lon;
+  gps.get_position_e7(&lat, &lon);
+  if (lat == GPS::GPS_INVALID_ANGLE_E7)
+    return;
+  gpsOriginLat = lat;
+  gpsOriginLon = lon;
+  gps.set_origin(gpsOriginLat, gpsOriginLon);
+  processGPSData();
 }
 // ROS Timeout Check
 void Robot::checkTimeout()
@@ -1036,11 +1114,11 @@ void Robot::setNextState(byte stateNew) {
   }
 
   if (stateNew == STATE_STATION) {
-    setMotorPWM(0, 0, false);
+    stopWheels();
     setActuator(ACT_CHGRELAY, 0);
     setDefaults();
     statsMowTimeTotalStart = false;  // stop stats mowTime counter
-    loadSaveRobotStats(false);        //save robot stats
+    flushRobotStats(true);           //save changed robot stats
 
   }
   if (stateNew == STATE_STATION_CHARGING) {
@@ -1051,14 +1129,15 @@ void Robot::setNextState(byte stateNew) {
     setActuator(ACT_CHGRELAY, 0);
     setDefaults();
     statsMowTimeTotalStart = false; // stop stats mowTime counter
-    loadSaveRobotStats(false);      //save robot stats
+    flushRobotStats(true);          //save changed robot stats
   }
   if (stateNew == STATE_ERROR) {
+    stopWheels();
     motorMowEnable = false;
     motorLeftSpeedRpmSet = motorRightSpeedRpmSet = 0;
     setActuator(ACT_CHGRELAY, 0);
     statsMowTimeTotalStart = false;
-    //loadSaveRobotStats(false);
+    flushRobotStats(true);
   }
   // Inform ROS about new state
   raiseROSNewStateEvent(stateNew);
@@ -1075,6 +1154,7 @@ void Robot::loop()
   stateTime = millis() - stateStartTime;
   int steer;
   ADCMan.run();
+  I2Cservice();   // completion callbacks of queued I2C transfers (IMU, RTC)
 
   // ROS no read of serial console in loop, only setup
   readROSSerial();
@@ -1084,19 +1164,36 @@ void Robot::loop()
   readSensors();
   checkBattery();
   checkRobotStats();
-  //  calcOdometry();
+  checkAutotune();
+#ifdef __AVR__
+  // Due: called by timer interrupt (see Mower::setup)
+  if ((long)(micros() - nextTimeMotorControlTick) >= 0)
+  {
+    nextTimeMotorControlTick += 1000000UL / MOTOR_CONTROL_RATE;
+    if ((long)(micros() - nextTimeMotorControlTick) >= 0) nextTimeMotorControlTick = micros() + 1000000UL / MOTOR_CONTROL_RATE; // too late, resync
+    motorControlTick();
+  }
+#endif
   //   checkOdometryFaults();
   checkButton();
+  Buzzer.run();
   // motorMowControl();
   checkTilt();
 
   if (imuUse)
+  {
     imu.update();
+    sensorSampleTime[SEN_IMU] = imu.sampleTime;
+    motorControlImuDir();
+  }
 
   if (gpsUse)
   {
-    gps.feed();
-    processGPSData();
+    if (gps.feed())
+    {
+      sensorSampleTime[SEN_GPS] = micros();
+      processGPSData();
+    }
   }
 
     spinOnce();
@@ -1156,9 +1253,9 @@ void Robot::loop()
   }
 
   // check for TImeout motor command (stop motors)
-  if (millis() - ROSLastTimeMotorCommand > ROSTimeoutMotorCommand )
+  if ( (millis() - ROSLastTimeMotorCommand > ROSTimeoutMotorCommand ) && (autotuneMode == AUTOTUNE_OFF) )
   {
-    setMotorPWM(0, 0, false);
+    stopWheels();
     motorMowEnable = false;
   }
   // state machine - things to do *PERMANENTLY* for current state
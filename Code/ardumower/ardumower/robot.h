@@ -27,7 +27,6 @@
 #define ROBOT_H
 
 #include <Arduino.h>
-#include <Wire.h>
 #ifdef __AVR__
 // Arduino Mega
 #include <EEPROM.h>
@@ -37,6 +36,8 @@
 //#include <Servo.h>  // for RC brushless contoller
 #include "drivers.h"
 #include "pid.h"
+#include "autotune.h"
+#include "profile.h"
 #include "imu.h"
 
 #include "adcman.h"
@@ -81,6 +82,8 @@ enum
   SEN_RAIN,
   SEN_TILT,
   SEN_FREE_WHEEL,
+  SEN_POSE,         // odometry pose/twist integrated on Arduino
+  SEN_GPS,          // position and accuracy estimate
   SEN_NUM_TOKENS  // add this always at the end!!!
 };
 
@@ -98,6 +101,7 @@ enum
   ACT_RTC,
   ACT_CHGRELAY,
   ACT_BATTERY_SW,
+  ACT_SONAR_PING,  // start ranging of sonar (value: SEN_SONAR_...)
 };
 
 // error types
@@ -158,10 +162,41 @@ enum
   ROS_FATAL
 };
 
+// PID autotune modes
+enum
+{
+  AUTOTUNE_OFF,
+  AUTOTUNE_WHEELS,  // motorLeftPID/motorRightPID (robot turns on the spot!)
+  AUTOTUNE_MOW      // motorMowPID
+};
+
 #define MAX_TIMERS 5
 
+// wheel speed control rate (Hz)
+#define MOTOR_CONTROL_RATE 200
+
+// sonar ranging (readSensor returns SONAR_BUSY until echo is received)
+#define SONAR_BUSY -1
+#define SONAR_CROSSTALK -2  // echo too early (below MIN_ECHO_TIME), measurement rejected
+#define SONAR_NO_ECHO_RAW 0xFFFF  // no echo in sonar filter history (counts as far away)
+
+// odometry edge timestamps (ring written by odometry interrupt, single writer)
+#define ODOMETRY_EDGES 8  // ring size (power of 2)
+
+struct odoedges_t {
+  volatile unsigned long time[ODOMETRY_EDGES]; // micros() of each edge
+  volatile byte head;  // edge counter, slot of next edge = head % ODOMETRY_EDGES
+  volatile byte valid; // number of valid edges (max. ODOMETRY_EDGES)
+  volatile char dir;   // direction of last edge (+1/-1)
+};
+
+typedef struct odoedges_t odoedges_t;
+
 #define BATTERY_SW_OFF -1
 
+// robot stats: max. time changed stats stay unsaved (ms), bounds loss on power failure
+#define ROBOT_STATS_MAX_STALENESS 600000
+
 class Robot
 {
   public:
@@ -190,11 +225,13 @@ class Robot
     // -------- gps state -------------------------------
     GPS gps;
     char gpsUse; // use GPS?
-    float gpsLat;
-    float gpsLon;
-    float gpsX; // X position (m)
-    float gpsY; // Y position (m)
-    unsigned long nextTimeGPS;
+    char gpsUbx; // configure u-blox module for UBX NAV-PVT (u-blox 7/M8 or newer)?
+    long gpsOriginLat; // local xy (0,0) (1e-7 degree), 0/0 = first fix after start
+    long gpsOriginLon;
+    long gpsEast;  // ENU position relative to origin (mm)
+    long gpsNorth;
+    float gpsX; // X position (m, east)
+    float gpsY; // Y position (m, north)
     float stuckIfGpsSpeedBelow;
     int gpsSpeedIgnoreTime; // how long gpsSpeed is ignored when robot switches into a new STATE (in ms)
     int robotIsStuckCounter;
@@ -208,6 +245,25 @@ class Robot
     boolean odometryLeftLastState2;
     boolean odometryRightLastState;
     boolean odometryRightLastState2;
+    int odometryTicksPerRevolution; // encoder ticks per one full wheel revolution
+    float odometryTicksPerCm;       // encoder ticks per cm
+    float odometryWheelBaseCm;      // wheel-to-wheel distance (cm)
+    char odometryImuFusion;         // weight (0..100%) of IMU yaw for odometry heading (0 = wheels only)
+    long odometryX;                 // position (micrometer, ROS coordinates: X+ forward)
+    long odometryY;                 // position (micrometer, Y+ left)
+    long odometryTheta;             // heading as binary angle (2^32 = 2*PI, wraps around)
+    int odometrySpeed;              // linear speed (mm/s)
+    int odometryYawRate;            // angular speed (mrad/s)
+    unsigned long odometryPoseTime; // micros() of last pose update
+    int odometryLeftLast;
+    int odometryRightLast;
+    byte odometryEdgesPerTick;      // counter steps per encoder tick (4 with quadrature), precomputed by initOdometry()
+    long odometryUmPerTick;         // precomputed by initOdometry()
+    long odometryBamPerUmQ16;       // precomputed by initOdometry()
+    long odometryImuThetaLast;
+    float odometryRpmPerMmS;        // wheel rpm per mm/s, precomputed by initOdometry()
+    odoedges_t odometryLeftEdges;   // edge timestamps for wheel speed estimation
+    odoedges_t odometryRightEdges;
     float motorLeftRpmCurr;  // left wheel rpm
     float motorRightRpmCurr; // right wheel rpm
     unsigned long lastMotorRpmTime;
@@ -240,8 +296,8 @@ class Robot
     int motorSpeedMaxRpm;       // motor wheel max RPM
     int motorSpeedMaxPwm;       // motor wheel max Pwm  (8-bit PWM=255, 10-bit PWM=1023)
     float motorPowerMax;        // motor wheel max power (Watt)
-    PID motorLeftPID;           // motor left wheel PID controller
-    PID motorRightPID;          // motor right wheel PID controller
+    FixedPID<> motorLeftPID;    // motor left wheel PID controller (fixed point, runs in control tick)
+    FixedPID<> motorRightPID;   // motor right wheel PID controller
     float motorSenseRightScale; // motor right sense scale (mA=(ADC-zero)/scale)
     float motorSenseLeftScale;  // motor left sense scale  (mA=(ADC-zero)/scale)
     long motorForwTimeMax; // max. forward time (ms) / timeout
@@ -249,6 +305,23 @@ class Robot
     bool motorLeftSwapDir;    // inverse left motor direction?
     int motorLeftSpeedRpmSet; // set speed
     int motorRightSpeedRpmSet;
+    boolean motorSpeedControlActive; // wheel speeds PID controlled (ROS velocity command) or open-loop PWM
+    float motorLinearSet;     // set linear speed (mm/s)
+    float motorAngularSet;    // set angular speed (mrad/s)
+    float motorLeftRpmSet;    // wheel speed set values of closed-loop control (rpm)
+    float motorRightRpmSet;
+    unsigned long nextTimeMotorControlTick;
+    boolean motorHeadingHoldActive;    // angular speed set by heading controller (imuDirPID)
+    float motorHeadingSet;             // heading hold set value (rad, IMU yaw)
+    float motorHeadingMaxRate;         // heading hold max. turn rate (deg/s)
+    unsigned long motorHeadingLastSample; // IMU sample time (ms) used last by heading controller
+    MotionProfile motorLinearProfile;  // ramps motorLinearSet (mm/s, mm/s^2, mm/s^3)
+    MotionProfile motorAngularProfile; // ramps motorAngularSet (mrad/s, mrad/s^2, mrad/s^3)
+    boolean motorPWMProfileActive;     // open-loop PWM (ROS motor command) ramped in control tick
+    int motorLeftPWMSet;               // open-loop PWM set values
+    int motorRightPWMSet;
+    MotionProfile motorLeftPWMProfile; // ramps motorLeftPWMSet (PWM, PWM/s, PWM/s^2)
+    MotionProfile motorRightPWMProfile;
     float motorLeftPWMCurr; // current speed
     float motorRightPWMCurr;
     int motorRightSenseADC;
@@ -292,6 +365,13 @@ class Robot
     unsigned long lastSetMotorMowSpeedTime;
     unsigned long nextTimeCheckCurrent;
     unsigned long lastTimeMotorMowStuck;
+    // -------- PID autotune -----------------------------
+    byte autotuneMode;
+    RelayAutotune autotuneLeft;
+    RelayAutotune autotuneRight;
+    RelayAutotune autotuneMow;
+    unsigned long autotuneStartTime;
+    unsigned long nextTimeAutotuneMow;
     // --------- BumperDuino state ---------------------------
     // bumper state (true = pressed)
     char bumperUse; // has bumpers?
@@ -385,6 +465,13 @@ class Robot
     unsigned int tempSonarDistCounter;
     unsigned long sonarObstacleTimeout;
     unsigned long nextTimeSonar;
+    int sonarGuardTime;   // crosstalk guard time (ms) between sonar bursts
+    byte sonarGroup;      // sonar burst: 0 = left+right (no beam overlap, fired together), 1 = center
+    byte sonarPending;    // sonars ranging (bit 0..2 = center, left, right)
+    int sonarOutlierCm;   // outlier filter: max. jump (cm) from filtered distance accepted at once (0=off)
+    unsigned int sonarHistory[3][3]; // last raw distances (median-of-3 filter)
+    byte sonarHistoryIdx[3];
+    boolean sonarOutlier[3];         // last distance was rejected by outlier filter
     unsigned long nextTimeCheckSonar;
     // --------- pfodApp ----------------------------------
     RemoteControl rc; // pfodApp
@@ -399,6 +486,9 @@ class Robot
     // general sensor rates
     unsigned int sensorRate[SEN_NUM_TOKENS] = {0};
     unsigned long sensorNextSend[SEN_NUM_TOKENS] = {0};
+    unsigned int sensorMissedDeadline[SEN_NUM_TOKENS] = {0}; // periods skipped because loop was too slow
+    unsigned long sensorSampleTime[SEN_NUM_TOKENS] = {0};     // micros() when sensor was sampled last
+    unsigned long ROSLastRxMicros; // micros() when last ROS command arrived (heartbeat clock sync)
 
 
 
@@ -468,6 +558,7 @@ class Robot
     float statsMowTimeHoursTotal;
     int statsMowTimeMinutesTrip;
     unsigned long nextTimeRobotStats;
+    unsigned long statsDirtyTime; // millis() of first unsaved change (0 = saved)
 
     // --------------------------------------------------
     Robot();
@@ -497,6 +588,7 @@ class Robot
 
     // GPS
     virtual void processGPSData();
+    virtual void setGPSOrigin();
 
     // read hardware sensor (HAL)
     virtual int readSensor(char type) {}
@@ -524,6 +616,8 @@ class Robot
     virtual void loadSaveErrorCounters(boolean readflag);
     virtual void loadSaveUserSettings(boolean readflag);
     virtual void loadSaveRobotStats(boolean readflag);
+    virtual void setRobotStatsDirty();
+    virtual void flushRobotStats(boolean force);
     virtual void loadUserSettings();
     virtual void checkErrorCounter();
     virtual void printSettingSerial();
@@ -547,16 +641,23 @@ class Robot
     virtual void processMotorCommand(String pwmLeft, String pwmRight, String mow);
     virtual void sendSpinMessage(int sensorID);
     virtual void responseMotorCommand();
-    virtual void responseHeartBeat();
+    virtual void processVelocityCommand(String linearStr, String angularStr, String mowStr);
+    virtual void processHeadingCommand(String linearStr, String headingStr, String mowStr);
+    virtual void processAutotuneCommand(String modeStr);
+    virtual void processProfileCommand(String linearMaxStr, String angularMaxStr, String linearAccelStr,
+                                       String angularAccelStr, String linearJerkStr, String angularJerkStr);
+    virtual void responseHeartBeat(String hostTime);
     virtual void responseStatus();
     virtual void responsePerimeter();
     virtual void responseMotor();
     virtual void responseOdometry();
+    virtual void responsePose();
     virtual void responseBattery();
     virtual void responseBumper();
     virtual void responseSonar();
     virtual void responseButton();
     virtual void responseIMU();
+    virtual void responseGPS();
 
     // check sensor
     virtual void checkButton();
@@ -569,6 +670,7 @@ class Robot
     //virtual void checkPerimeterBoundary();
     //virtual void checkLawn();
     virtual void checkSonar();
+    virtual unsigned int filterSonar(byte idx, unsigned int dist);
     virtual void checkTilt();
     // virtual void checkRain();
     virtual void checkTimeout();
@@ -577,10 +679,16 @@ class Robot
 
     // motor controllers
     virtual void motorControl();
+    virtual void motorControlTick();
+    virtual void stopWheels();
+    virtual void motorSpeedControl();
     //  virtual void motorControlImuRoll();
     //  virtual void motorControlPerimeter();
-    //  virtual void motorControlImuDir();
+    virtual void motorControlImuDir();
     virtual void motorMowControl();
+    virtual void startAutotune(byte mode);
+    virtual void stopAutotune();
+    virtual void checkAutotune();
 
     // date & time
     //virtual void setDefaultTime();
@@ -599,9 +707,12 @@ class Robot
     virtual void testOdometry();
     virtual void testMotors();
     virtual void testRTC();
+    virtual void testPIDTiming();
     virtual void setDefaults();
     virtual void receiveGPSTime();
-    //virtual void calcOdometry();
+    virtual void initOdometry();
+    virtual void calcOdometry();
+    virtual float odometryEdgeRate(odoedges_t &edges);
     virtual void menu();
     virtual void commsMenuBT();
     virtual void commsMenuWifi();
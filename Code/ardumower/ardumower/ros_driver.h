@@ -16,6 +16,15 @@
 //  $RS response with requested sensor data (Arduino -> ROS)
 //  $M1 Motor command message (ROS -> Arduino)
 //  $M2 Motor response message (Arduino -> ROS)
+//  $V1 Velocity command message: linear (mm/s), angular (mrad/s), mow (ROS -> Arduino), answered by $M2
+//      wheel speeds are closed-loop controlled by Arduino (motorSpeedControl)
+//  $H1 Heading hold command: linear (mm/s), heading (mrad, counter-clockwise = -IMU yaw), mow (ROS -> Arduino), answered by $M2
+//      angular speed is set by heading controller (imuDirPID) at IMU rate, requires IMU
+//  $VL Velocity profile limits: max linear (mm/s), max angular (mrad/s), linear accel (mm/s^2), angular accel (mrad/s^2),
+//      linear jerk (mm/s^3), angular jerk (mrad/s^3) (ROS -> Arduino), answered by $M2
+//      $V1 set speeds are ramped in the control tick (jerk 0 = trapezoidal ramp, accel 0 = no ramp)
+//  $AT PID autotune command: mode 0=abort, 1=wheels, 2=mow (ROS -> Arduino), answered by $M2
+//      result (Ku, Tu, gains) is reported by $LI and saved to user settings
 //  $EV Event message (like Bumper or Perimeter hit, Overload etc.) (Arduino -> ROS)
 //
 //  $LD Debug message to ROS base controller (Arduino -> ROS)
@@ -24,6 +33,11 @@
 //  $LE Error message to ROS base controller (Arduino -> ROS)
 //  $LF Fatal message to ROS base controller (Arduino -> ROS)
 //
+//  Each $RS and $EV message ends with a micros() timestamp taken when the sensor was sampled.
+//  Clock sync (NTP like): ROS sends $HB|ID|t1 (host time), Arduino answers $HB|ID|t1|t2|t3
+//  with t2 = micros() at receive and t3 = micros() at send. ROS takes t4 at receive and gets
+//  offset = ((t1 - t2) + (t4 - t3)) / 2 to map firmware timestamps into host time.
+//
 //
 //
 // NOTE: use high baud rates for this serial interface (in mower.h, configure CONSOLE_BAUDRATE to 115200 baud)
@@ -31,11 +45,12 @@
 #ifndef ROS_DRIVER_H
 #define ROS_DRIVER_H
 
-const char *ROSCommandSet[] = { "$HB", "$RQ", "$RS", "$M1", "$M2", "$EV" };
+const char *ROSCommandSet[] = { "$HB", "$RQ", "$RS", "$M1", "$M2", "$EV", "$V1", "$AT", "$VL", "$H1" };
 
 // ROS commands as enum
 enum {
-  HEARTBEAT, REQUEST, RESPONSE, MOTORREQUEST, MOTORRESPONSE, EVENT
+  HEARTBEAT, REQUEST, RESPONSE, MOTORREQUEST, MOTORRESPONSE, EVENT, VELOCITYREQUEST, AUTOTUNEREQUEST, PROFILEREQUEST, HEADINGREQUEST,
+  ROS_COMMAND_COUNT
 };
 
 // ROS Events
@@ -72,6 +87,9 @@ enum {
 //SEN_RAIN,
 //SEN_TILT,
 //SEN_FREE_WHEEL
+//SEN_POSE         // x, y (mm), theta (mrad), speed (mm/s), yaw rate (mrad/s)
+//SEN_GPS          // lat, lon (1e-7 degree, 2147483647 = no fix), altitude (cm), hAcc, vAcc (mm), satellites, fix type (1=none, 2=2D, 3=3D),
+//                 east, north (mm, local tangent plane around gpsOriginLat/gpsOriginLon)
 //
 //
 //
@@ -92,7 +110,27 @@ void Robot::initROSSensorRates() {
   sensorRate[SEN_SONAR_LEFT] = 100;
   sensorRate[SEN_IMU] = 100;
   sensorRate[SEN_ODOM] = 100;     // every 100 ms
+  sensorRate[SEN_POSE] = 50;      // pose/twist integrated on Arduino
   sensorRate[SEN_STATUS] = 1000; // every 10.000ms
+  if (gpsUse) sensorRate[SEN_GPS] = gpsUbx ? GPS_UBX_RATE : 1000;  // GPS navigation rate
+
+  // stagger first send time of all active streams across the shortest period,
+  // so streams with same rate don't fire in the same loop
+  int activeStreams = 0;
+  unsigned int minRate = 0;
+  for (int i = 0; i < SEN_NUM_TOKENS; i++) {
+    if (sensorRate[i] == 0) continue;
+    activeStreams++;
+    if ((minRate == 0) || (sensorRate[i] < minRate)) minRate = sensorRate[i];
+  }
+  unsigned long now = millis();
+  int slot = 0;
+  for (int i = 0; i < SEN_NUM_TOKENS; i++) {
+    sensorMissedDeadline[i] = 0;
+    if (sensorRate[i] == 0) continue;
+    sensorNextSend[i] = now + ((unsigned long)minRate * slot) / activeStreams;
+    slot++;
+  }
 }
 
 void Robot::initROSSerial() {
@@ -131,7 +169,9 @@ void Robot::raiseROSNewStateEvent(byte stateNew) {
   Console.print('|');
   Console.print(ROS_EV_NEW_STATE);
   Console.print('|');
-  Console.println(stateNew);
+  Console.print(stateNew);
+  Console.print('|');
+  Console.println(micros());
 }
 
 void Robot::raiseROSSensorEvent(int sensorType) {
@@ -139,7 +179,9 @@ void Robot::raiseROSSensorEvent(int sensorType) {
   Console.print('|');
   Console.print(ROS_EV_SENSOR_TRIGGER);
   Console.print('|');
-  Console.println(sensorType);
+  Console.print(sensorType);
+  Console.print('|');
+  Console.println(sensorSampleTime[sensorType]);
 }
 
 void Robot::raiseROSErrorEvent(byte errorType) {
@@ -147,13 +189,16 @@ void Robot::raiseROSErrorEvent(byte errorType) {
   Console.print('|');
   Console.print(ROS_EV_ERROR);
   Console.print('|');
-  Console.println(errorType);
+  Console.print(errorType);
+  Console.print('|');
+  Console.println(micros());
 }
 
 void Robot::readROSSerial() {
   String serialdata;
 
   if (Console.available() > 0) {
+    ROSLastRxMicros = micros();
     serialdata = waitStringConsole();
     if (serialdata[0] == '$') {
       ROSLastTimeMessage = millis();
@@ -213,12 +258,12 @@ void Robot::processROSCommand(String command) {
   ROSlastMessageID = thisMessageID;
 
   // Check which message needs to be send
-  for (int i = 0; i < 6; i++) {
+  for (int i = 0; i < ROS_COMMAND_COUNT; i++) {
     if (strcmp(commandType, ROSCommandSet[i]) == 0) {
 
       switch (i) {
         case HEARTBEAT:
-          responseHeartBeat();
+          responseHeartBeat(commandParts[1]);
           break;
         case REQUEST:
           // Check which sensor was requested
@@ -248,6 +293,10 @@ void Robot::processROSCommand(String command) {
               responseOdometry();
               break;
 
+            case SEN_POSE:
+              responsePose();
+              break;
+
             case SEN_BUMPER_LEFT:
             case SEN_BUMPER_RIGHT:
               responseBumper();
@@ -262,6 +311,10 @@ void Robot::processROSCommand(String command) {
             case SEN_BUTTON:
               responseButton();
               break;
+
+            case SEN_GPS:
+              responseGPS();
+              break;
             default:
               sendROSDebugInfo(ROS_ERROR, "invalid sensor requested");
               break;
@@ -270,6 +323,19 @@ void Robot::processROSCommand(String command) {
         case MOTORREQUEST:
           processMotorCommand(commandParts[1], commandParts[2], commandParts[3]);
           break;
+        case VELOCITYREQUEST:
+          processVelocityCommand(commandParts[1], commandParts[2], commandParts[3]);
+          break;
+        case AUTOTUNEREQUEST:
+          processAutotuneCommand(commandParts[1]);
+          break;
+        case HEADINGREQUEST:
+          processHeadingCommand(commandParts[1], commandParts[2], commandParts[3]);
+          break;
+        case PROFILEREQUEST:
+          processProfileCommand(commandParts[1], commandParts[2], commandParts[3],
+                                commandParts[4], commandParts[5], commandParts[6]);
+          break;
       }
 
     }
@@ -277,11 +343,17 @@ void Robot::processROSCommand(String command) {
 
 }
 
-void Robot::responseHeartBeat() {
+void Robot::responseHeartBeat(String hostTime) {
   // prepare message
   Console.print(ROSCommandSet[HEARTBEAT]);
   Console.print('|');
-  Console.println(ROSlastMessageID);
+  Console.print(ROSlastMessageID);
+  Console.print('|');
+  Console.print(hostTime);        // t1, echoed back
+  Console.print('|');
+  Console.print(ROSLastRxMicros); // t2
+  Console.print('|');
+  Console.println(micros());      // t3
 }
 
 void Robot::responseStatus() {
@@ -297,7 +369,17 @@ void Robot::responseStatus() {
   Console.print('|');
   Console.print(stateNames[stateCurr]);
   Console.print('|');
-  Console.println("E000");
+  Console.print("E000");
+  // missed spin deadlines per stream (only streams with a rate)
+  for (int i = 0; i < SEN_NUM_TOKENS; i++) {
+    if (sensorRate[i] == 0) continue;
+    Console.print('|');
+    Console.print(i);
+    Console.print(':');
+    Console.print(sensorMissedDeadline[i]);
+  }
+  Console.print('|');
+  Console.println(micros());
 
 }
 
@@ -312,7 +394,9 @@ void Robot::responseBattery() {
   Console.print('|');
   Console.print(chgVoltage);
   Console.print('|');
-  Console.println(chgCurrent);
+  Console.print(chgCurrent);
+  Console.print('|');
+  Console.println(sensorSampleTime[SEN_BAT_VOLTAGE]);
 }
 
 void Robot::responsePerimeter() {
@@ -334,7 +418,9 @@ void Robot::responsePerimeter() {
   Console.print('|');
   Console.print(perimeter.signalTimedOut(0));
   Console.print('|');
-  Console.println(perimeter.signalTimedOut(1));
+  Console.print(perimeter.signalTimedOut(1));
+  Console.print('|');
+  Console.println(sensorSampleTime[SEN_PERIM_LEFT]);
 }
 
 void Robot::responseMotor() {
@@ -366,20 +452,54 @@ void Robot::responseMotor() {
   Console.print('|');
   Console.print(motorMowSenseCurrent); // current in mA
   Console.print('|');
-  Console.println(motorMowSenseCounter); // overload counter
+  Console.print(motorMowSenseCounter);
+  Console.print('|');
+  Console.println(sensorSampleTime[SEN_MOTOR_LEFT]); // capture time of motor sense values
 
 }
 
 void Robot::responseOdometry() {
+  // counters are updated by interrupts: take a consistent snapshot together with its time
+  noInterrupts();
+  int left = odometryLeft;
+  int right = odometryRight;
+  unsigned long sampleTime = micros();
+  interrupts();
   Console.print(ROSCommandSet[RESPONSE]);
   Console.print('|');
   Console.print(ROSlastMessageID);
   Console.print('|');
   Console.print(SEN_ODOM);
   Console.print('|');
-  Console.print(odometryLeft);
+  Console.print(left);
+  Console.print('|');
+  Console.print(right);
+  Console.print('|');
+  Console.print(motorLeftRpmCurr);  // wheel speeds (rpm) by edge timestamps
+  Console.print('|');
+  Console.print(motorRightRpmCurr);
+  Console.print('|');
+  Console.println(sampleTime);
+}
+
+void Robot::responsePose() {
+  Console.print(ROSCommandSet[RESPONSE]);
+  Console.print('|');
+  Console.print(ROSlastMessageID);
+  Console.print('|');
+  Console.print(SEN_POSE);
+  Console.print('|');
+  Console.print(odometryX / 1000);  // mm
+  Console.print('|');
+  Console.print(odometryY / 1000);
   Console.print('|');
-  Console.println(odometryRight);
+  Console.print((long)((int64_t)odometryTheta * 3141593 / 2147483648000LL)); // mrad (-PI..PI)
+  Console.print('|');
+  Console.print(odometrySpeed);    // mm/s
+  Console.print('|');
+  Console.print(odometryYawRate);  // mrad/s
+  Console.print('|');
+  Console.println(odometryPoseTime);
 }
 
 void Robot::responseBumper() {
@@ -395,10 +515,16 @@ void Robot::responseBumper() {
   Console.print('|');
   Console.print(bumperLeft);
   Console.print('|');
-  Console.println(bumperRight);
+  Console.print(bumperRight);
+  Console.print('|');
+  Console.println(sensorSampleTime[SEN_BUMPER_LEFT]);
 }
 
 void Robot::responseSonar() {
+  // sonars are read round robin, use time of the newest reading
+  unsigned long sampleTime = sensorSampleTime[SEN_SONAR_CENTER];
+  if ((long)(sensorSampleTime[SEN_SONAR_LEFT] - sampleTime) > 0) sampleTime = sensorSampleTime[SEN_SONAR_LEFT];
+  if ((long)(sensorSampleTime[SEN_SONAR_RIGHT] - sampleTime) > 0) sampleTime = sensorSampleTime[SEN_SONAR_RIGHT];
   Console.print(ROSCommandSet[RESPONSE]);
   Console.print('|');
   Console.print(ROSlastMessageID);
@@ -411,7 +537,9 @@ void Robot::responseSonar() {
   Console.print('|');
   Console.print(sonarDistRight);
   Console.print('|');
-  Console.println(sonarDistCounter);
+  Console.print(sonarDistCounter);
+  Console.print('|');
+  Console.println(sampleTime);
 }
 
 void Robot::responseButton() {
@@ -421,7 +549,9 @@ void Robot::responseButton() {
   Console.print('|');
   Console.print(SEN_BUTTON);
   Console.print('|');
-  Console.println(buttonCounter);
+  Console.print(buttonCounter);
+  Console.print('|');
+  Console.println(micros());
   buttonCounter = 0;
 }
 
@@ -452,7 +582,39 @@ void Robot::responseIMU() {
   Console.print('|');
   Console.print(imu.com.x);
   Console.print('|');
-  Console.println(imu.com.y);
+  Console.print(imu.com.y);
+  Console.print('|');
+  Console.println(sensorSampleTime[SEN_IMU]);
+}
+
+void Robot::responseGPS() {
+  long lat, lon;
+  gps.get_position_e7(&lat, &lon);
+  Console.print(ROSCommandSet[RESPONSE]);
+  Console.print('|');
+  Console.print(ROSlastMessageID);
+  Console.print('|');
+  Console.print(SEN_GPS);
+  Console.print('|');
+  Console.print(lat);  // 1e-7 degree
+  Console.print('|');
+  Console.print(lon);
+  Console.print('|');
+  Console.print(gps.altitude());  // cm
+  Console.print('|');
+  Console.print(gps.h_accuracy());  // mm
+  Console.print('|');
+  Console.print(gps.v_accuracy());
+  Console.print('|');
+  Console.print(gps.satellites());
+  Console.print('|');
+  Console.print(gps.fix_type());
+  Console.print('|');
+  Console.print(gpsEast);  // mm
+  Console.print('|');
+  Console.print(gpsNorth);
+  Console.print('|');
+  Console.println(sensorSampleTime[SEN_GPS]);
 }
 
 void Robot::responseMotorCommand() {
@@ -494,10 +656,22 @@ void Robot::processMotorCommand(String pwmLeftStr, String pwmRightStr, String mo
     sendROSDebugInfo(ROS_ERROR, "invalid value for mow motor");
     invalidCommand = true;
   }
-  // set motor speeds accordingly
+  // set motor speeds accordingly (open-loop, ramped in control tick)
+  stopAutotune();
+  // control tick (Due: timer interrupt) must not see half of the new set values
+  noInterrupts();
+  motorHeadingHoldActive = false;
+  if ((motorSpeedControlActive) || (!motorPWMProfileActive))
+  {
+    motorLeftPWMProfile.reset(motorLeftPWMCurr);
+    motorRightPWMProfile.reset(motorRightPWMCurr);
+  }
+  motorSpeedControlActive = false;
   if (!invalidCommand)
   {
-    setMotorPWM(pwmLeft, pwmRight, false);
+    motorLeftPWMSet = pwmLeft;
+    motorRightPWMSet = pwmRight;
+    motorPWMProfileActive = true;
 
     switch (mow)
     {
@@ -508,9 +682,11 @@ void Robot::processMotorCommand(String pwmLeftStr, String pwmRightStr, String mo
         motorMowEnable = true;
         break;
     }
+    interrupts();
   }
   else {
-    setMotorPWM(0, 0, false);
+    interrupts();
+    stopWheels();
     motorMowEnable = false;
   }
 
@@ -519,15 +695,179 @@ void Robot::processMotorCommand(String pwmLeftStr, String pwmRightStr, String mo
 
 }
 
+void Robot::processVelocityCommand(String linearStr, String angularStr, String mowStr)
+{
+  ROSLastTimeMotorCommand = millis();
+  float linear = linearStr.toFloat();
+  float angular = angularStr.toFloat();
+  int mow = mowStr.toInt();
+  bool invalidCommand = false;
+
+  // check for valid commands (wheel speeds are limited to motorSpeedMaxRpm by controller)
+  if ( abs(linear) > 5000 )
+  {
+    sendROSDebugInfo(ROS_ERROR, "invalid linear speed");
+    invalidCommand = true;
+  }
+  if ( abs(angular) > 20000 )
+  {
+    sendROSDebugInfo(ROS_ERROR, "invalid angular speed");
+    invalidCommand = true;
+  }
+  if ( mow < 0 || mow > 1)
+  {
+    sendROSDebugInfo(ROS_ERROR, "invalid value for mow motor");
+    invalidCommand = true;
+  }
+  if (invalidCommand)
+  {
+    linear = angular = 0;
+    mow = 0;
+  }
+
+  stopAutotune();
+  noInterrupts();
+  if (!motorSpeedControlActive)
+  {
+    motorLeftPID.reset();
+    motorRightPID.reset();
+    // start ramp from current motion
+    motorLinearProfile.reset(odometrySpeed);
+    motorAngularProfile.reset(odometryYawRate);
+  }
+  motorPWMProfileActive = false;
+  motorHeadingHoldActive = false;
+  motorLinearSet = linear;
+  motorAngularSet = angular;
+  motorSpeedControlActive = true;
+  motorMowEnable = (mow == 1);
+  interrupts();
+
+  responseMotorCommand();
+}
+
+void Robot::processHeadingCommand(String linearStr, String headingStr, String mowStr)
+{
+  ROSLastTimeMotorCommand = millis();
+  float linear = linearStr.toFloat();
+  float heading = headingStr.toFloat();
+  int mow = mowStr.toInt();
+  bool invalidCommand = false;
+
+  // check for valid commands
+  if ( abs(linear) > 5000 )
+  {
+    sendROSDebugInfo(ROS_ERROR, "invalid linear speed");
+    invalidCommand = true;
+  }
+  if ( abs(heading) > 6284 )
+  {
+    sendROSDebugInfo(ROS_ERROR, "invalid heading");
+    invalidCommand = true;
+  }
+  if ( mow < 0 || mow > 1)
+  {
+    sendROSDebugInfo(ROS_ERROR, "invalid value for mow motor");
+    invalidCommand = true;
+  }
+  if ( (!imuUse) || (imu.state != IMU_RUN) )
+  {
+    sendROSDebugInfo(ROS_ERROR, "heading hold requires IMU");
+    invalidCommand = true;
+  }
+
+  stopAutotune();
+  noInterrupts();
+  if (!motorSpeedControlActive)
+  {
+    motorLeftPID.reset();
+    motorRightPID.reset();
+    motorLinearProfile.reset(odometrySpeed);
+    motorAngularProfile.reset(odometryYawRate);
+  }
+  if ((invalidCommand) || (!motorHeadingHoldActive))
+  {
+    imuDirPID.reset();
+    motorHeadingLastSample = 0;
+  }
+  motorPWMProfileActive = false;
+  if (invalidCommand)
+  {
+    motorHeadingHoldActive = false;
+    motorLinearSet = motorAngularSet = 0;
+    motorMowEnable = false;
+  }
+  else
+  {
+    motorHeadingSet = scalePI(-heading / 1000.0);
+    motorLinearSet = linear;
+    motorHeadingHoldActive = true;
+    motorMowEnable = (mow == 1);
+  }
+  motorSpeedControlActive = true;
+  interrupts();
+
+  responseMotorCommand();
+}
+
+void Robot::processAutotuneCommand(String modeStr)
+{
+  ROSLastTimeMotorCommand = millis();
+  int mode = modeStr.toInt();
+  if ( mode < AUTOTUNE_OFF || mode > AUTOTUNE_MOW )
+  {
+    sendROSDebugInfo(ROS_ERROR, "invalid autotune mode");
+    mode = AUTOTUNE_OFF;
+  }
+  if (mode == AUTOTUNE_OFF) stopAutotune();
+  else startAutotune(mode);
+
+  responseMotorCommand();
+}
+
+void Robot::processProfileCommand(String linearMaxStr, String angularMaxStr, String linearAccelStr,
+                                  String angularAccelStr, String linearJerkStr, String angularJerkStr)
+{
+  float linearMax = linearMaxStr.toFloat();
+  float angularMax = angularMaxStr.toFloat();
+  float linearAccel = linearAccelStr.toFloat();
+  float angularAccel = angularAccelStr.toFloat();
+  float linearJerk = linearJerkStr.toFloat();
+  float angularJerk = angularJerkStr.toFloat();
+
+  // check for valid limits
+  if ( linearMax < 0 || angularMax < 0 || linearAccel < 0 || angularAccel < 0 || linearJerk < 0 || angularJerk < 0 )
+  {
+    sendROSDebugInfo(ROS_ERROR, "invalid velocity profile limits");
+  }
+  else
+  {
+    noInterrupts();
+    motorLinearProfile.setLimits(linearMax, linearAccel, linearJerk);
+    motorAngularProfile.setLimits(angularMax, angularAccel, angularJerk);
+    interrupts();
+  }
+
+  responseMotorCommand();
+}
+
 void Robot::spinOnce() {
 
   unsigned long now = millis();
   for (int i = 0; i < SEN_NUM_TOKENS; i++)
   {
-    if ( ( now > sensorNextSend[i] ) && sensorRate[i] != 0)
+    // signed difference keeps comparison valid when millis() wraps (~49 days)
+    if ( ( (long)(now - sensorNextSend[i]) >= 0 ) && sensorRate[i] != 0)
     {
       sendSpinMessage(i);
-      sensorNextSend[i] = now + sensorRate[i];
+      // advance by period (not from now) to avoid drift
+      sensorNextSend[i] += sensorRate[i];
+      if ((long)(now - sensorNextSend[i]) >= 0) {
+        // one or more periods missed: skip them, keep phase
+        unsigned long skipped = (now - sensorNextSend[i]) / sensorRate[i] + 1;
+        sensorNextSend[i] += skipped * sensorRate[i];
+        sensorMissedDeadline[i] += skipped;
+      }
     }
   }
 }
@@ -559,6 +899,10 @@ void Robot::sendSpinMessage(int sensorID) {
       responseOdometry();
       break;
 
+    case SEN_POSE:
+      responsePose();
+      break;
+
     case SEN_BUMPER_LEFT:
     case SEN_BUMPER_RIGHT:
       responseBumper();
@@ -578,6 +922,10 @@ void Robot::sendSpinMessage(int sensorID) {
       responseIMU();
       break;
 
+    case SEN_GPS:
+      responseGPS();
+      break;
+
     default:
       sendROSDebugInfo(ROS_ERROR, "invalid sensor requested");
       break;
@@ -3,140 +3,188 @@
 void Robot::loadSaveRobotStats(boolean readflag){
   if (readflag) Console.println(F("loadSaveRobotStats: read"));
     else Console.println(F("loadSaveRobotStats: write"));
-  int addr = ADDR_ROBOT_STATS;
-  short magic = 0;
-  if (!readflag) magic = MAGIC;  
-  eereadwrite(readflag, addr, magic); // magic
-  if ((readflag) && (magic != MAGIC)) {
-    Console.println(F("EEPROM STATISTICS: NO STATISTICS FOUND"));
-  }
-  eereadwrite(readflag, addr, statsMowTimeMinutesTrip); 
-  eereadwrite(readflag, addr, statsMowTimeMinutesTotal);
-  eereadwrite(readflag, addr, statsBatteryChargingCounterTotal);
-  eereadwrite(readflag, addr, statsBatteryChargingCapacityTrip);
-  eereadwrite(readflag, addr, statsBatteryChargingCapacityTotal);
-  eereadwrite(readflag, addr, statsBatteryChargingCapacityAverage);
-   // <----------------------------new robot stats to save goes here!----------------
+  short validMagic = MAGIC;
+  if (readflag) {
+    // no journal record yet: migrate data of older firmware (fixed address, same layout)
+    if (!Journal.openRead(JOURNAL_ROBOT_STATS)) {
+      Journal.openLegacy(ADDR_ROBOT_STATS);
+      validMagic = LEGACY_MAGIC;
+    }
+  } else Journal.openWrite(JOURNAL_ROBOT_STATS);
+  int addr;
+  do {
+    addr = 0;
+    short magic = 0;
+    if (!readflag) magic = MAGIC;  
+    jreadwrite(readflag, addr, magic); // magic
+    if ((readflag) && (magic != validMagic)) {
+      Console.println(F("EEPROM STATISTICS: NO STATISTICS FOUND"));
+    }
+    jreadwrite(readflag, addr, statsMowTimeMinutesTrip); 
+    jreadwrite(readflag, addr, statsMowTimeMinutesTotal);
+    jreadwrite(readflag, addr, statsBatteryChargingCounterTotal);
+    jreadwrite(readflag, addr, statsBatteryChargingCapacityTrip);
+    jreadwrite(readflag, addr, statsBatteryChargingCapacityTotal);
+    jreadwrite(readflag, addr, statsBatteryChargingCapacityAverage);
+     // <----------------------------new robot stats to save goes here!----------------
+  } while (Journal.nextPass());
   Console.print(F("loadSaveRobotStats addrstop="));
   Console.println(addr);
 }
 
+// stats changed: saved by flushRobotStats within ROBOT_STATS_MAX_STALENESS
+void Robot::setRobotStatsDirty(){
+  if (statsDirtyTime == 0) statsDirtyTime = max(millis(), 1UL);
+}
+
+// saves changed stats if forced (state change) or stale, unchanged record is not written by journal
+void Robot::flushRobotStats(boolean force){
+  if (statsDirtyTime == 0) return;
+  if ((!force) && (millis() - statsDirtyTime < ROBOT_STATS_MAX_STALENESS)) return;
+  statsDirtyTime = 0;
+  loadSaveRobotStats(false);
+}
+
 void Robot::loadSaveErrorCounters(boolean readflag){
   if (readflag) Console.println(F("loadSaveErrorCounters: read"));
     else Console.println(F("loadSaveErrorCounters: write"));
-  int addr = ADDR_ERR_COUNTERS;
-  short magic = 0;
-  if (!readflag) magic = MAGIC;  
-  eereadwrite(readflag, addr, magic); // magic
-  if ((readflag) && (magic != MAGIC)) {
-    Console.println(F("EEPROM ERROR DATA: NO ERROR COUNTERS FOUND"));    
-    //addErrorCounter(ERR_EEPROM_DATA);
-    //setNextState(STATE_ERROR, 0);
-    return;
-  }
-  eereadwrite(readflag, addr, errorCounterMax);  
+  short validMagic = MAGIC;
+  if (readflag) {
+    // no journal record yet: migrate data of older firmware (fixed address, same layout)
+    if (!Journal.openRead(JOURNAL_ERR_COUNTERS)) {
+      Journal.openLegacy(ADDR_ERR_COUNTERS);
+      validMagic = LEGACY_MAGIC;
+    }
+  } else Journal.openWrite(JOURNAL_ERR_COUNTERS);
+  int addr;
+  do {
+    addr = 0;
+    short magic = 0;
+    if (!readflag) magic = MAGIC;  
+    jreadwrite(readflag, addr, magic); // magic
+    if ((readflag) && (magic != validMagic)) {
+      Console.println(F("EEPROM ERROR DATA: NO ERROR COUNTERS FOUND"));    
+      //addErrorCounter(ERR_EEPROM_DATA);
+      //setNextState(STATE_ERROR, 0);
+      return;
+    }
+    jreadwrite(readflag, addr, errorCounterMax);  
+  } while (Journal.nextPass());
   Console.print(F("loadSaveErrorCounters addrstop="));
   Console.println(addr);
 }
 
 void Robot::loadSaveUserSettings(boolean readflag){
-  int addr = ADDR_USER_SETTINGS;
-  short magic = 0;
-  if (!readflag) magic = MAGIC;  
-  eereadwrite(readflag, addr, magic); // magic
-  if ((readflag) && (magic != MAGIC)) {
-    Console.println(F("EEPROM USER SETTINGS: NO EEPROM USER SETTINGS FOUND"));    
-    //addErrorCounter(ERR_EEPROM_DATA);
-    //setNextState(STATE_ERROR, 0);
-    return;
-  }
-  eereadwrite(readflag, addr, developerActive);          
-  eereadwrite(readflag, addr, motorAccel);    
-  eereadwrite(readflag, addr, motorSpeedMaxRpm);
-  eereadwrite(readflag, addr, motorSpeedMaxPwm); 
-  eereadwrite(readflag, addr, motorPowerMax);
-  eereadwrite(readflag, addr, motorSenseRightScale);
-  eereadwrite(readflag, addr, motorSenseLeftScale);
-  //eereadwrite(readflag, addr, motorRollTimeMax);
-  //eereadwrite(readflag, addr, motorRollTimeMin);
-  //eereadwrite(readflag, addr, motorReverseTime);
-  eereadwrite(readflag, addr, motorPowerIgnoreTime);
-  eereadwrite(readflag, addr, motorForwTimeMax);
-  eereadwrite(readflag, addr, motorMowSpeedMaxPwm);
-  eereadwrite(readflag, addr, motorMowPowerMax);
-  eereadwrite(readflag, addr, motorMowRPMSet);
-  eereadwrite(readflag, addr, motorMowSenseScale);
-  eereadwrite(readflag, addr, motorLeftPID.Kp);
-  eereadwrite(readflag, addr, motorLeftPID.Ki);
-  eereadwrite(readflag, addr, motorLeftPID.Kd);
-  eereadwrite(readflag, addr, motorMowPID.Kp);
-  eereadwrite(readflag, addr, motorMowPID.Ki);
-  eereadwrite(readflag, addr, motorMowPID.Kd);
-  //eereadwrite(readflag, addr, motorBiDirSpeedRatio1);
-  //eereadwrite(readflag, addr, motorBiDirSpeedRatio2);  
-  eereadwrite(readflag, addr, motorLeftSwapDir);
-  eereadwrite(readflag, addr, motorRightSwapDir);  
-  eereadwrite(readflag, addr, bumperUse);
-  eereadwrite(readflag, addr, sonarUse);
-  eereadwrite(readflag, addr, sonarCenterUse);
-  eereadwrite(readflag, addr, sonarLeftUse);
-  eereadwrite(readflag, addr, sonarRightUse);  
-  eereadwrite(readflag, addr, sonarTriggerBelow);
-  eereadwrite(readflag, addr, perimeterUse);
-  eereadwrite(readflag, addr, perimeter.timedOutIfBelowSmag);        
-  eereadwrite(readflag, addr, perimeterTriggerTimeout);
-  eereadwrite(readflag, addr, perimeterPID.Kp);
-  eereadwrite(readflag, addr, perimeterPID.Ki);
-  eereadwrite(readflag, addr, perimeterPID.Kd);
-  eereadwrite(readflag, addr, perimeter.signalCodeNo);        
-  eereadwrite(readflag, addr, perimeter.swapCoilPolarityLeft);  
-  eereadwrite(readflag, addr, perimeter.swapCoilPolarityRight);  
-  eereadwrite(readflag, addr, perimeter.timeOutSecIfNotInside);  
-  eereadwrite(readflag, addr, trackingBlockInnerWheelWhilePerimeterStruggling);  
-  eereadwrite(readflag, addr, lawnSensorUse);
-  eereadwrite(readflag, addr, imuUse);
-  eereadwrite(readflag, addr, imuCorrectDir);
-  eereadwrite(readflag, addr, imuDirPID.Kp);
-  eereadwrite(readflag, addr, imuDirPID.Ki);
-  eereadwrite(readflag, addr, imuDirPID.Kd);  
-  eereadwrite(readflag, addr, imuRollPID.Kp);    
-  eereadwrite(readflag, addr, imuRollPID.Ki);    
-  eereadwrite(readflag, addr, imuRollPID.Kd);      
-  eereadwrite(readflag, addr, remoteUse);
-  eereadwrite(readflag, addr, batMonitor);
-  eereadwrite(readflag, addr, batSwitchOffIfBelow);  
-  eereadwrite(readflag, addr, batSwitchOffIfIdle);  
-  eereadwrite(readflag, addr, batFactor);
-  eereadwrite(readflag, addr, batChgFactor);
-  eereadwrite(readflag, addr, chgSenseZero);
-  eereadwrite(readflag, addr, chgFactor);
-  eereadwrite(readflag, addr, batFullCurrent);
-  eereadwrite(readflag, addr, startChargingIfBelow);
-  //eereadwrite(readflag, addr, odometryTicksPerRevolution);
-  //eereadwrite(readflag, addr, odometryTicksPerCm);
-  //eereadwrite(readflag, addr, odometryWheelBaseCm);
-  eereadwrite(readflag, addr, odometryLeftSwapDir);
-  eereadwrite(readflag, addr, odometryRightSwapDir);
-  eereadwrite(readflag, addr, twoWayOdometrySensorUse);
-  eereadwrite(readflag, addr, buttonUse);
-  eereadwrite(readflag, addr, userSwitch1);
-  eereadwrite(readflag, addr, userSwitch2);
-  eereadwrite(readflag, addr, userSwitch3);    
-  eereadwrite(readflag, addr, timerUse);
-  eereadwrite(readflag, addr, timer);  
-  eereadwrite(readflag, addr, rainUse);
-  eereadwrite(readflag, addr, gpsUse);
-  eereadwrite(readflag, addr, stuckIfGpsSpeedBelow);
-  eereadwrite(readflag, addr, gpsSpeedIgnoreTime);
-  eereadwrite(readflag, addr, dropUse);   
-  eereadwrite(readflag, addr, statsOverride);   
-  eereadwrite(readflag, addr, bluetoothUse);
-  eereadwrite(readflag, addr, esp8266Use);
-  eereadwriteString(readflag, addr, esp8266ConfigString);
-  eereadwrite(readflag, addr, tiltUse);
-  eereadwrite(readflag, addr, sonarSlowBelow);
-	eereadwrite(readflag, addr, motorMowForceOff);	
-  eereadwrite(readflag, addr, freeWheelUse);  
+  // settings of older firmware (fixed address) have another layout: not migrated, defaults are used
+  if (readflag) {
+    if (!Journal.openRead(JOURNAL_USER_SETTINGS)) return;
+  } else Journal.openWrite(JOURNAL_USER_SETTINGS);
+  int addr;
+  do {
+    addr = 0;
+    short magic = 0;
+    if (!readflag) magic = MAGIC;  
+    jreadwrite(readflag, addr, magic); // magic
+    if ((readflag) && (magic != MAGIC)) {
+      Console.println(F("EEPROM USER SETTINGS: NO EEPROM USER SETTINGS FOUND"));    
+      //addErrorCounter(ERR_EEPROM_DATA);
+      //setNextState(STATE_ERROR, 0);
+      return;
+    }
+    jreadwrite(readflag, addr, developerActive);          
+    jreadwrite(readflag, addr, motorAccel);    
+    jreadwrite(readflag, addr, motorSpeedMaxRpm);
+    jreadwrite(readflag, addr, motorSpeedMaxPwm); 
+    jreadwrite(readflag, addr, motorPowerMax);
+    jreadwrite(readflag, addr, motorSenseRightScale);
+    jreadwrite(readflag, addr, motorSenseLeftScale);
+    //jreadwrite(readflag, addr, motorRollTimeMax);
+    //jreadwrite(readflag, addr, motorRollTimeMin);
+    //jreadwrite(readflag, addr, motorReverseTime);
+    jreadwrite(readflag, addr, motorPowerIgnoreTime);
+    jreadwrite(readflag, addr, motorForwTimeMax);
+    jreadwrite(readflag, addr, motorMowSpeedMaxPwm);
+    jreadwrite(readflag, addr, motorMowPowerMax);
+    jreadwrite(readflag, addr, motorMowRPMSet);
+    jreadwrite(readflag, addr, motorMowSenseScale);
+    jreadwrite(readflag, addr, motorLeftPID.Kp);
+    jreadwrite(readflag, addr, motorLeftPID.Ki);
+    jreadwrite(readflag, addr, motorLeftPID.Kd);
+    jreadwrite(readflag, addr, motorMowPID.Kp);
+    jreadwrite(readflag, addr, motorMowPID.Ki);
+    jreadwrite(readflag, addr, motorMowPID.Kd);
+    //jreadwrite(readflag, addr, motorBiDirSpeedRatio1);
+    //jreadwrite(readflag, addr, motorBiDirSpeedRatio2);  
+    jreadwrite(readflag, addr, motorLeftSwapDir);
+    jreadwrite(readflag, addr, motorRightSwapDir);  
+    jreadwrite(readflag, addr, bumperUse);
+    jreadwrite(readflag, addr, sonarUse);
+    jreadwrite(readflag, addr, sonarCenterUse);
+    jreadwrite(readflag, addr, sonarLeftUse);
+    jreadwrite(readflag, addr, sonarRightUse);  
+    jreadwrite(readflag, addr, sonarTriggerBelow);
+    jreadwrite(readflag, addr, perimeterUse);
+    jreadwrite(readflag, addr, perimeter.timedOutIfBelowSmag);        
+    jreadwrite(readflag, addr, perimeterTriggerTimeout);
+    jreadwrite(readflag, addr, perimeterPID.Kp);
+    jreadwrite(readflag, addr, perimeterPID.Ki);
+    jreadwrite(readflag, addr, perimeterPID.Kd);
+    jreadwrite(readflag, addr, perimeter.signalCodeNo);        
+    jreadwrite(readflag, addr, perimeter.swapCoilPolarityLeft);  
+    jreadwrite(readflag, addr, perimeter.swapCoilPolarityRight);  
+    jreadwrite(readflag, addr, perimeter.timeOutSecIfNotInside);  
+    jreadwrite(readflag, addr, trackingBlockInnerWheelWhilePerimeterStruggling);  
+    jreadwrite(readflag, addr, lawnSensorUse);
+    jreadwrite(readflag, addr, imuUse);
+    jreadwrite(readflag, addr, imuCorrectDir);
+    jreadwrite(readflag, addr, imuDirPID.Kp);
+    jreadwrite(readflag, addr, imuDirPID.Ki);
+    jreadwrite(readflag, addr, imuDirPID.Kd);  
+    jreadwrite(readflag, addr, imuRollPID.Kp);    
+    jreadwrite(readflag, addr, imuRollPID.Ki);    
+    jreadwrite(readflag, addr, imuRollPID.Kd);      
+    jreadwrite(readflag, addr, remoteUse);
+    jreadwrite(readflag, addr, batMonitor);
+    jreadwrite(readflag, addr, batSwitchOffIfBelow);  
+    jreadwrite(readflag, addr, batSwitchOffIfIdle);  
+    jreadwrite(readflag, addr, batFactor);
+    jreadwrite(readflag, addr, batChgFactor);
+    jreadwrite(readflag, addr, chgSenseZero);
+    jreadwrite(readflag, addr, chgFactor);
+    jreadwrite(readflag, addr, batFullCurrent);
+    jreadwrite(readflag, addr, startChargingIfBelow);
+    jreadwrite(readflag, addr, odometryTicksPerRevolution);
+    jreadwrite(readflag, addr, odometryTicksPerCm);
+    jreadwrite(readflag, addr, odometryWheelBaseCm);
+    jreadwrite(readflag, addr, odometryLeftSwapDir);
+    jreadwrite(readflag, addr, odometryRightSwapDir);
+    jreadwrite(readflag, addr, twoWayOdometrySensorUse);
+    jreadwrite(readflag, addr, buttonUse);
+    jreadwrite(readflag, addr, userSwitch1);
+    jreadwrite(readflag, addr, userSwitch2);
+    jreadwrite(readflag, addr, userSwitch3);    
+    jreadwrite(readflag, addr, timerUse);
+    jreadwrite(readflag, addr, timer);  
+    jreadwrite(readflag, addr, rainUse);
+    jreadwrite(readflag, addr, gpsUse);
+    jreadwrite(readflag, addr, stuckIfGpsSpeedBelow);
+    jreadwrite(readflag, addr, gpsSpeedIgnoreTime);
+    jreadwrite(readflag, addr, dropUse);   
+    jreadwrite(readflag, addr, statsOverride);   
+    jreadwrite(readflag, addr, bluetoothUse);
+    jreadwrite(readflag, addr, esp8266Use);
+    jreadwriteString(readflag, addr, esp8266ConfigString);
+    jreadwrite(readflag, addr, tiltUse);
+    jreadwrite(readflag, addr, sonarSlowBelow);
+  	jreadwrite(readflag, addr, motorMowForceOff);	
+    jreadwrite(readflag, addr, freeWheelUse);  
+    jreadwrite(readflag, addr, odometryImuFusion);
+    jreadwrite(readflag, addr, sonarGuardTime);
+    jreadwrite(readflag, addr, gpsUbx);
+    jreadwrite(readflag, addr, gpsOriginLat);
+    jreadwrite(readflag, addr, gpsOriginLon);
+    jreadwrite(readflag, addr, sonarOutlierCm);
+  } while (Journal.nextPass());
   Console.print(F("loadSaveUserSettings addrstop="));
   Console.println(addr);
 }
@@ -280,6 +328,10 @@ void Robot::printSettingSerial(){
   Console.println(sonarTriggerBelow);
   Console.print  (F("sonarSlowBelow                             : "));
   Console.println(sonarSlowBelow);
+  Console.print  (F("sonarGuardTime                             : "));
+  Console.println(sonarGuardTime);
+  Console.print  (F("sonarOutlierCm                             : "));
+  Console.println(sonarOutlierCm);
 
   // ------ perimeter -------------------------------------------------------------
   Console.println(F("---------- perimeter -----------------------------------------"));
@@ -381,12 +433,14 @@ void Robot::printSettingSerial(){
   Console.println(F("---------- odometry ------------------------------------------"));
   Console.print  (F("twoWayOdometrySensorUse                    : "));
   Console.println( twoWayOdometrySensorUse,1);
- // Console.print  (F("odometryTicksPerRevolution                 : "));
- // Console.println( odometryTicksPerRevolution);
-  //Console.print  (F("odometryTicksPerCm                         : "));
-  //Console.println( odometryTicksPerCm);
-  //Console.print  (F("odometryWheelBaseCm                        : "));
-  //Console.println( odometryWheelBaseCm);  
+  Console.print  (F("odometryTicksPerRevolution                 : "));
+  Console.println( odometryTicksPerRevolution);
+  Console.print  (F("odometryTicksPerCm                         : "));
+  Console.println( odometryTicksPerCm);
+  Console.print  (F("odometryWheelBaseCm                        : "));
+  Console.println( odometryWheelBaseCm);  
+  Console.print  (F("odometryImuFusion                          : "));
+  Console.println( odometryImuFusion,1);
 
 
 // ------ odometry Interrupt-------------------------------------------------------
@@ -413,6 +467,12 @@ void Robot::printSettingSerial(){
   Console.println(F("---------- GPS -----------------------------------------------"));
   Console.print  (F("gpsUse                                     : "));
   Console.println(gpsUse,1); 
+  Console.print  (F("gpsUbx                                     : "));
+  Console.println(gpsUbx,1); 
+  Console.print  (F("gpsOriginLat                               : "));
+  Console.println(gpsOriginLat); 
+  Console.print  (F("gpsOriginLon                               : "));
+  Console.println(gpsOriginLon); 
   Console.print  (F("stuckIfGpsSpeedBelow                       : "));
   Console.println(stuckIfGpsSpeedBelow); 
   Console.print  (F("gpsSpeedIgnoreTime                         : "));
@@ -478,9 +538,10 @@ void Robot::saveUserSettings(){
 
 void Robot::deleteUserSettings(){
   loadSaveRobotStats(true);
-  int addr = 0;
+  int addr = ADDR_USER_SETTINGS;
   Console.println(F("ALL USER SETTINGS DELETED - PLEASE RE-POWER SYSTEM!"));
-  eewrite(addr, (short)0); // magic  
+  Journal.erase(JOURNAL_USER_SETTINGS);
+  eewrite(addr, (short)0); // magic (older firmware)
   loadSaveRobotStats(false);
   Console.println(F("system will reboot now..."));
   Console.println();
@@ -568,6 +629,7 @@ void Robot::checkRobotStats(){
         statsMowTimeMinutesTripCounter++;
         statsMowTimeMinutesTrip = statsMowTimeMinutesTripCounter;
         statsMowTimeMinutesTotal++;
+        setRobotStatsDirty();
   } 
   else 
     if (statsMowTimeMinutesTripCounter != 0){
@@ -582,6 +644,7 @@ void Robot::checkRobotStats(){
     statsBatteryChargingCapacityTrip = batCapacity;
     statsBatteryChargingCapacityTotal += (batCapacity - lastTimeBatCapacity); // summ up only the difference between actual batCapacity and last batCapacity
     lastTimeBatCapacity = batCapacity;
+    setRobotStatsDirty();
   }
   else{                         // resets values to 0 when mower is not charging
     statsBatteryChargingCounter = 0; 
@@ -596,4 +659,6 @@ void Robot::checkRobotStats(){
 
 
 //----------------new stats goes here------------------------------------------------------
+
+  flushRobotStats(false);
 }
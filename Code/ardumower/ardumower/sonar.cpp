@@ -0,0 +1,91 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+  
+*/
+
+#include "sonar.h"
+
+
+SonarRanger::SonarRanger(byte triggerPin, byte echoPin, unsigned int maxCm, unsigned int minEchoTime){
+  this->triggerPin = triggerPin;
+  this->echoPin = echoPin;
+  maxEchoTime = (unsigned long)maxCm * SONAR_US_ROUNDTRIP_CM;
+  this->minEchoTime = minEchoTime;
+  state = IDLE;
+  echoTime = echoDuration = 0;
+}
+
+void SonarRanger::begin(void (*echoISR)(void)){
+  pinMode(triggerPin, OUTPUT);
+  pinMode(echoPin, INPUT);
+  digitalWrite(triggerPin, LOW);
+  attachInterrupt(echoPin, echoISR, CHANGE);
+}
+
+void SonarRanger::ping(){
+  echoDuration = 0;
+  pingTime = micros();
+  state = WAIT_ECHO;
+  digitalWrite(triggerPin, HIGH);
+  delayMicroseconds(10);
+  digitalWrite(triggerPin, LOW);
+}
+
+void SonarRanger::echo(){
+  unsigned long now = micros();
+  if (digitalRead(echoPin) == HIGH) {
+    if (state == WAIT_ECHO) {
+      echoStart = now;
+      state = ECHO;
+    }
+  }
+  else if (state == ECHO) {
+    echoDuration = now - echoStart;
+    echoTime = now;
+    state = DONE;
+  }
+}
+
+boolean SonarRanger::ready(){
+  if (state == DONE) return true;
+  if (state == IDLE) return true;
+  noInterrupts();
+  unsigned long now = micros();
+  if ( ((state == WAIT_ECHO) && (now - pingTime > SONAR_MAX_START_DELAY))
+    || ((state == ECHO) && (now - echoStart > maxEchoTime)) ) {
+    // no echo within max. distance
+    echoDuration = 0;
+    echoTime = now;
+    state = DONE;
+  }
+  interrupts();
+  return (state == DONE);
+}
+
+boolean SonarRanger::early(){
+  return ((state == DONE) && (echoDuration != 0) && (echoDuration < minEchoTime));
+}
+
+unsigned int SonarRanger::read(){
+  unsigned long duration = echoDuration;
+  state = IDLE;
+  if ((duration == 0) || (duration > maxEchoTime)) return 0;
+  return max((duration + SONAR_US_ROUNDTRIP_CM / 2) / SONAR_US_ROUNDTRIP_CM, 1UL);
+}
@@ -0,0 +1,63 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+
+*/
+
+#ifndef SONAR_H
+#define SONAR_H
+
+#include <Arduino.h>
+
+
+/*
+  non-blocking ultrasonic ranger (HC-SR04 type)
+  ping() sends the trigger pulse and returns immediately, the echo pulse is timed by the
+  echo pin interrupt (echo() must be called on CHANGE of echo pin)
+  requires interrupt capable echo pins (Due: all pins)
+*/
+
+#define SONAR_US_ROUNDTRIP_CM 57  // microseconds sound takes for 1 cm distance (round-trip)
+#define SONAR_MAX_START_DELAY 5800 // max. microseconds until sensor starts echo pulse
+
+class SonarRanger
+{
+  public:
+    SonarRanger(byte triggerPin, byte echoPin, unsigned int maxCm, unsigned int minEchoTime);
+    void begin(void (*echoISR)(void));
+    void ping();            // start ranging
+    void echo();            // echo pin changed (call from interrupt)
+    boolean ready();        // ranging finished (echo received or timeout)?
+    boolean early();        // finished echo shorter than min. echo time (crosstalk)?
+    unsigned int read();    // distance (cm) of finished ranging (0 = no echo)
+    unsigned long echoTime; // micros() when ranging finished
+  private:
+    enum { IDLE, WAIT_ECHO, ECHO, DONE };
+    byte triggerPin;
+    byte echoPin;
+    unsigned long maxEchoTime;
+    unsigned int minEchoTime;
+    volatile byte state;
+    volatile unsigned long pingTime;
+    volatile unsigned long echoStart;
+    volatile unsigned long echoDuration;
+};
+
+
+#endif
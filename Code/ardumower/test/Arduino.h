@@ -0,0 +1,91 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+
+*/
+
+// minimal Arduino API for compiling firmware modules on the host (see README)
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define PI 3.1415926535897932384626433832795
+#define TWO_PI 6.283185307179586476925286766559
+#define radians(deg) ((deg)*PI/180.0)
+#define degrees(rad) ((rad)*180.0/PI)
+#define sq(x) ((x)*(x))
+#define PROGMEM
+#define pgm_read_word(p) (*(p))
+#define constrain(x,a,b) ((x)<(a)?(a):((x)>(b)?(b):(x)))
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+
+inline unsigned long micros(){
+  return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline unsigned long millis(){
+  return micros() / 1000;
+}
+
+inline void delay(unsigned long ms){
+}
+
+// serial port fed by the test (setInput), written bytes are collected in output
+class HardwareSerial {
+  public:
+    const uint8_t *input;
+    size_t inputLen, inputPos;
+    uint8_t output[1024];
+    size_t outputLen;
+    HardwareSerial() : input(0), inputLen(0), inputPos(0), outputLen(0) {}
+    void setInput(const void *data, size_t len){ input = (const uint8_t*)data; inputLen = len; inputPos = 0; }
+    void begin(unsigned long baud){}
+    void flush(){}
+    int available(){ return inputLen - inputPos; }
+    int read(){ return (inputPos < inputLen) ? input[inputPos++] : -1; }
+    size_t readBytes(char *buf, size_t len){
+      size_t n = min(len, inputLen - inputPos);
+      memcpy(buf, input + inputPos, n);
+      inputPos += n;
+      return n;
+    }
+    size_t write(uint8_t c){
+      if (outputLen < sizeof output) output[outputLen++] = c;
+      return 1;
+    }
+    size_t write(const uint8_t *buf, size_t len){
+      for (size_t i=0; i < len; i++) write(buf[i]);
+      return len;
+    }
+};
+
+inline HardwareSerial Serial3;
+
+#endif
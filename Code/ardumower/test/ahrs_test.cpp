@@ -0,0 +1,284 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+
+*/
+
+/*
+  AHRS replay harness: Mahony AHRS (ahrs.h) against the filters it replaced
+  (per-sample Kalman for pitch/roll, second-order complementary filter for compass yaw)
+  - replays a sensor log (CSV, one sample per line, IMU::fuse units and frame):
+      dt,gx,gy,gz,ax,ay,az,mx,my,mz[,yaw,pitch,roll]
+    dt in sec, gyro in rad/s, accel in g, compass in any unit, optional ground truth in rad
+    (yaw counter-clockwise as MahonyAHRS); without a log file a synthetic drive is generated:
+    lanes with 180 degree turns, slope changes, gyro bias, sensor noise
+  - reports RMS/max. attitude error, yaw error at the end (drift) and host cycles per sample,
+    checks the Mahony errors (with ground truth only)
+  usage: ahrs_test [log.csv]
+*/
+
+#include <vector>   // before Arduino.h (min/max macros)
+#include "test.h"
+#include "../ardumower/fastmath.h"
+#include "../ardumower/fastmath.cpp"
+#include "../ardumower/ahrs.h"
+#include "../ardumower/ahrs.cpp"
+
+#define TS 0.005          // sample time of the MPU9250 FIFO (200 Hz)
+#define SETTLE_TIME 30    // errors are evaluated after bias convergence (sec)
+
+struct sample_t {
+  float dt, gx, gy, gz, ax, ay, az, mx, my, mz;
+  float yaw, pitch, roll;  // ground truth
+};
+
+// ---------- filters replaced by MahonyAHRS (copied from imu.cpp before the change) ----------
+
+float legacyScalePI(float v){
+  float d = v;
+  while (d < 0) d += 2*PI;
+  while (d >= 2*PI) d -= 2*PI;
+  if (d >= PI) return (-2*PI + d);
+  else if (d < -PI) return (2*PI + d);
+  else return d;
+}
+
+float legacyScalePIangles(float setAngle, float currAngle){
+  if ((setAngle >= PI/2) && (currAngle <= -PI/2)) return (setAngle-2*PI);
+    else if ((setAngle <= -PI/2) && (currAngle >= PI/2)) return (setAngle+2*PI);
+    else return setAngle;
+}
+
+// y1 was read uninitialized in the firmware, zero here
+float legacyComplementary2(float newAngle, float newRate, float dt, float angle) {
+  float k=10;
+  float dtc2=dt;
+  float x1 = (newAngle -   angle)*k*k;
+  float y1 = dtc2*x1;
+  float x2 = y1 + (newAngle -   angle)*2*k + newRate;
+  angle = dtc2*x2 + angle;
+  return angle;
+}
+
+// covariance and bias were reset on every call
+float legacyKalman(float newAngle, float newRate, float dt, float x_angle)
+{
+  float Q_angle  =  0.01;
+  float Q_gyro   =  0.0003;
+  float R_angle  =  0.01;
+  float x_bias = 0;
+  float P_00 = 0, P_01 = 0, P_10 = 0, P_11 = 0;
+  float  y, S;
+  float K_0, K_1;
+  x_angle += dt * (newRate - x_bias);
+  P_00 +=  - dt * (P_10 + P_01) + Q_angle * dt;
+  P_01 +=  - dt * P_11;
+  P_10 +=  - dt * P_11;
+  P_11 +=  + Q_gyro * dt;
+  y = newAngle - x_angle;
+  S = P_00 + R_angle;
+  K_0 = P_00 / S;
+  K_1 = P_10 / S;
+  x_angle +=  K_0 * y;
+  x_bias  +=  K_1 * y;
+  return x_angle;
+}
+
+struct legacy_t {
+  float yaw, pitch, roll;  // yaw clockwise (compass)
+};
+
+void legacyUpdate(legacy_t &f, const sample_t &s){
+  float accPitch = atan2(-s.ax , sqrt(s.ay*s.ay + s.az*s.az));
+  float accRoll  = atan2(s.ay , s.az);
+  accPitch = legacyScalePIangles(accPitch, f.pitch);
+  accRoll  = legacyScalePIangles(accRoll, f.roll);
+  f.pitch = legacyKalman(accPitch, s.gx, s.dt, f.pitch);
+  f.roll  = legacyKalman(accRoll,  s.gy, s.dt, f.roll);
+  f.pitch = legacyScalePI(f.pitch);
+  f.roll = legacyScalePI(f.roll);
+  float tx =  s.mx * cos(f.pitch) + s.mz * sin(f.pitch);
+  float ty =  s.mx * sin(f.roll) * sin(f.pitch) + s.my * cos(f.roll) - s.mz * sin(f.roll) * cos(f.pitch);
+  float comYaw = legacyScalePI(atan2(ty, tx));
+  comYaw = legacyScalePIangles(comYaw, f.yaw);
+  f.yaw = legacyComplementary2(comYaw, -s.gz, s.dt, f.yaw);
+  f.yaw = legacyScalePI(f.yaw);
+}
+
+// ---------- synthetic drive ----------
+
+struct quat_t {
+  double w, x, y, z;
+};
+
+quat_t fromEuler(double yaw, double pitch, double roll){
+  double cr = cos(roll/2), sr = sin(roll/2), cp = cos(pitch/2), sp = sin(pitch/2), cy = cos(yaw/2), sy = sin(yaw/2);
+  quat_t q = { cr*cp*cy + sr*sp*sy, sr*cp*cy - cr*sp*sy, cr*sp*cy + sr*cp*sy, cr*cp*sy - sr*sp*cy };
+  return q;
+}
+
+// earth vector to sensor frame (q: sensor to earth)
+void toSensor(const quat_t &q, double ex, double ey, double ez, float &sx, float &sy, float &sz){
+  double r00 = 1 - 2*(q.y*q.y + q.z*q.z), r01 = 2*(q.x*q.y - q.w*q.z), r02 = 2*(q.x*q.z + q.w*q.y);
+  double r10 = 2*(q.x*q.y + q.w*q.z), r11 = 1 - 2*(q.x*q.x + q.z*q.z), r12 = 2*(q.y*q.z - q.w*q.x);
+  double r20 = 2*(q.x*q.z - q.w*q.y), r21 = 2*(q.y*q.z + q.w*q.x), r22 = 1 - 2*(q.x*q.x + q.y*q.y);
+  sx = r00*ex + r10*ey + r20*ez;
+  sy = r01*ex + r11*ey + r21*ez;
+  sz = r02*ex + r12*ey + r22*ez;
+}
+
+float noise(float sigma){
+  // sum of uniforms, approx. gaussian
+  float n = 0;
+  for (int i=0; i < 4; i++) n += (float)rand() / RAND_MAX - 0.5;
+  return n * sigma * 1.732;
+}
+
+std::vector<sample_t> syntheticDrive(float duration){
+  std::vector<sample_t> log;
+  const double dip = 60 * PI / 180;
+  const float bias[3] = { 0.01, -0.008, 0.012 };
+  srand(1);
+  double yaw = 0.3, yawRate = 0;
+  quat_t q = fromEuler(yaw, 0, 0);
+  for (double t=0; t < duration; t += TS){
+    // 20 s lane, then 180 degree turn at 0.6 rad/s (ramped)
+    double phase = fmod(t, 20 + PI / 0.6);
+    double rateSet = (phase < 20) ? 0 : ((fmod(t / (20 + PI / 0.6), 2) < 1) ? 0.6 : -0.6);
+    yawRate += constrain(rateSet - yawRate, -3 * TS, 3 * TS);
+    yaw += yawRate * TS;
+    double pitch = 0.08 * sin(2 * PI * t / 37);
+    double roll = 0.06 * sin(2 * PI * t / 23 + 1);
+    quat_t qn = fromEuler(yaw, pitch, roll);
+    // body rate from q^-1 * qn
+    double w = q.w*qn.w + q.x*qn.x + q.y*qn.y + q.z*qn.z;
+    double x = q.w*qn.x - q.x*qn.w - q.y*qn.z + q.z*qn.y;
+    double y = q.w*qn.y + q.x*qn.z - q.y*qn.w - q.z*qn.x;
+    double z = q.w*qn.z - q.x*qn.y + q.y*qn.x - q.z*qn.w;
+    double k = (w < 0) ? -2 / TS : 2 / TS;
+    sample_t s;
+    s.dt = TS;
+    s.gx = x * k + bias[0] + noise(0.003);
+    s.gy = y * k + bias[1] + noise(0.003);
+    s.gz = z * k + bias[2] + noise(0.003);
+    toSensor(qn, 0, 0, 1, s.ax, s.ay, s.az);
+    s.ax += noise(0.02); s.ay += noise(0.02); s.az += noise(0.02);
+    toSensor(qn, cos(dip), 0, -sin(dip), s.mx, s.my, s.mz);
+    s.mx += noise(0.01); s.my += noise(0.01); s.mz += noise(0.01);
+    s.yaw = wrapPI(yaw);
+    s.pitch = pitch;
+    s.roll = roll;
+    log.push_back(s);
+    q = qn;
+  }
+  return log;
+}
+
+bool readLog(const char *fileName, std::vector<sample_t> &log, bool &truth){
+  FILE *f = fopen(fileName, "r");
+  if (f == NULL) return false;
+  char line[256];
+  truth = true;
+  while (fgets(line, sizeof line, f)){
+    sample_t s;
+    int n = sscanf(line, "%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f", &s.dt, &s.gx, &s.gy, &s.gz,
+      &s.ax, &s.ay, &s.az, &s.mx, &s.my, &s.mz, &s.yaw, &s.pitch, &s.roll);
+    if (n < 10) continue;  // header, comments
+    if (n < 13) truth = false;
+    log.push_back(s);
+  }
+  fclose(f);
+  return true;
+}
+
+// ---------- evaluation ----------
+
+struct error_t {
+  double sum[3], maxErr[3];
+  int n;
+  float last;  // yaw error of last sample
+};
+
+void addError(error_t &e, float yaw, float pitch, float roll, const sample_t &s){
+  float d[3] = { (float)fabs(wrapPI(yaw - s.yaw)), (float)fabs(pitch - s.pitch), (float)fabs(roll - s.roll) };
+  for (int i=0; i < 3; i++){
+    e.sum[i] += d[i] * d[i];
+    e.maxErr[i] = max(e.maxErr[i], d[i]);
+  }
+  e.last = d[0];
+  e.n++;
+}
+
+void printError(const char *name, const error_t &e){
+  const double deg = 180 / PI;
+  printf("  %-8s RMS yaw/pitch/roll %6.2f %6.2f %6.2f deg, max. %6.2f %6.2f %6.2f deg, end yaw %6.2f deg\n", name,
+    sqrt(e.sum[0] / e.n) * deg, sqrt(e.sum[1] / e.n) * deg, sqrt(e.sum[2] / e.n) * deg,
+    e.maxErr[0] * deg, e.maxErr[1] * deg, e.maxErr[2] * deg, e.last * deg);
+}
+
+int main(int argc, char **argv){
+  std::vector<sample_t> log;
+  bool truth = true;
+  if (argc > 1){
+    if (!readLog(argv[1], log, truth)){
+      printf("cannot read %s\n", argv[1]);
+      return 1;
+    }
+  } else log = syntheticDrive(600);
+  printf("%d samples%s\n", (int)log.size(), (truth) ? "" : " (no ground truth)");
+
+  MahonyAHRS ahrs;
+  legacy_t legacy = { 0, 0, 0 };
+  error_t eAhrs = {}, eLegacy = {};
+  uint64_t cAhrs = 0, cYpr = 0, cLegacy = 0;
+  double t = 0;
+  for (size_t i=0; i < log.size(); i++){
+    const sample_t &s = log[i];
+    uint64_t c0 = cycles();
+    ahrs.update(s.gx, s.gy, s.gz, s.ax, s.ay, s.az, s.mx, s.my, s.mz, s.dt);
+    uint64_t c1 = cycles();
+    float yaw, pitch, roll;
+    ahrs.getYawPitchRoll(yaw, pitch, roll);
+    uint64_t c2 = cycles();
+    legacyUpdate(legacy, s);
+    uint64_t c3 = cycles();
+    cAhrs += c1 - c0;
+    cYpr += c2 - c1;
+    cLegacy += c3 - c2;
+    t += s.dt;
+    if ((truth) && (t > SETTLE_TIME)){
+      addError(eAhrs, yaw, pitch, roll, s);
+      addError(eLegacy, -legacy.yaw, legacy.pitch, legacy.roll, s);
+    }
+  }
+  int n = log.size();
+  printf("host cycles per sample: mahony %.1f (+ euler %.1f once per update), legacy %.1f\n",
+    (float)cAhrs / n, (float)cYpr / n, (float)cLegacy / n);
+  printf("gyro bias estimate: %.4f %.4f %.4f rad/s\n", ahrs.gyroBiasX, ahrs.gyroBiasY, ahrs.gyroBiasZ);
+  if (!truth) return 0;
+  printError("mahony", eAhrs);
+  printError("legacy", eLegacy);
+  const double deg = PI / 180;
+  check("mahony RMS pitch/roll (deg)", max(sqrt(eAhrs.sum[1] / eAhrs.n), sqrt(eAhrs.sum[2] / eAhrs.n)) < 0.5 * deg,
+    max(sqrt(eAhrs.sum[1] / eAhrs.n), sqrt(eAhrs.sum[2] / eAhrs.n)) / deg, 0.5);
+  check("mahony RMS yaw (deg)", sqrt(eAhrs.sum[0] / eAhrs.n) < 1.5 * deg, sqrt(eAhrs.sum[0] / eAhrs.n) / deg, 1.5);
+  check("mahony max. yaw (deg)", eAhrs.maxErr[0] < 5 * deg, eAhrs.maxErr[0] / deg, 5);
+  check("mahony yaw drift at end (deg)", eAhrs.last < 1 * deg, eAhrs.last / deg, 1);
+  return testResult("ahrs_test");
+}
@@ -0,0 +1,128 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+
+*/
+
+/*
+  host simulation of the relay feedback autotuner (autotune.h)
+  a first-order plant with dead time K*exp(-L*s)/(tau*s+1) is driven by RelayAutotune::run at 200 Hz
+  - the relay limit cycle of this plant is known exactly (hysteresis e, relay amplitude d):
+      amplitude a = K*d - (K*d - e)*exp(-L/tau)
+      period    T = 2*(L + tau*ln((K*d + a)/(K*d - e)))
+    Tu must match T, Ku must match the describing function value 4*d/(PI*sqrt(a^2-e^2))
+  - Ku/Tu must also be close to the true ultimate gain/period of the plant
+    (phase -180 deg at w: atan(w*tau) + w*L = PI, Ku = sqrt(1+(w*tau)^2)/K, Tu = 2*PI/w),
+    the describing function is an approximation (Ku too low for lag dominated plants, hysteresis
+    shifts the oscillation to a lower frequency), so this bound is wider and only checked for
+    small hysteresis
+*/
+
+#include "test.h"
+#include "../ardumower/pid.h"
+#include "../ardumower/pid.cpp"
+#include "../ardumower/autotune.h"
+#include "../ardumower/autotune.cpp"
+
+#define TS 0.005           // 1/MOTOR_CONTROL_RATE
+#define MAX_DELAY 1000     // dead time buffer (samples)
+
+struct plant_t {
+  float K, tau, L;
+};
+
+// relay limit cycle of the plant around set value w (returns false if no result)
+bool simulate(plant_t p, float w, float d, float e, RelayAutotune &tune){
+  static float u[MAX_DELAY];
+  int delay = p.L / TS + 0.5;
+  float base = w / p.K;     // steady state output at set value (symmetric oscillation)
+  for (int i=0; i < delay; i++) u[i] = base;
+  float y = w;
+  float decay = exp(-TS / p.tau);
+  unsigned long t = 1000000;
+  tune.start(w, base, d, e, 4);
+  for (int i=0; (i < 60.0 / TS) && (tune.running); i++){
+    int k = i % delay;
+    float delayed = u[k];
+    u[k] = tune.run(y, t);
+    y = p.K * delayed + (y - p.K * delayed) * decay;
+    t += TS * 1000000;
+  }
+  return tune.done;
+}
+
+// ultimateLimit=0: ultimate values are only printed
+void testPlant(const char *name, plant_t p, float w, float d, float e, float ultimateLimit){
+  RelayAutotune tune;
+  char s[64];
+  snprintf(s, sizeof s, "%s: oscillation found", name);
+  bool done = simulate(p, w, d, e, tune);
+  check(s, done, done, 1);
+  float Kd = p.K * d;
+  float a = Kd - (Kd - e) * exp(-p.L / p.tau);
+  float T = 2 * (p.L + p.tau * log((Kd + a) / (Kd - e)));
+  float KuRelay = 4 * d / (PI * sqrt(a * a - e * e));
+  snprintf(s, sizeof s, "%s: Tu vs limit cycle (%%)", name);
+  float err = 100 * fabs(tune.Tu - T) / T;
+  check(s, err < 5, err, 5);   // switching times are sampled at TS
+  snprintf(s, sizeof s, "%s: Ku vs describing function (%%)", name);
+  err = 100 * fabs(tune.Ku - KuRelay) / KuRelay;
+  check(s, err < 5, err, 5);   // switching times are sampled at TS
+  // ultimate frequency by bisection
+  float lo = 0, hi = PI / p.L;
+  for (int i=0; i < 60; i++){
+    float mid = (lo + hi) / 2;
+    if (atan(mid * p.tau) + mid * p.L < PI) lo = mid; else hi = mid;
+  }
+  float Ku = sqrt(1 + lo * p.tau * lo * p.tau) / p.K;
+  float Tu = 2 * PI / lo;
+  if (ultimateLimit > 0){
+    snprintf(s, sizeof s, "%s: Tu vs ultimate period (%%)", name);
+    err = 100 * fabs(tune.Tu - Tu) / Tu;
+    check(s, err < ultimateLimit, err, ultimateLimit);
+    snprintf(s, sizeof s, "%s: Ku vs ultimate gain (%%)", name);
+    err = 100 * fabs(tune.Ku - Ku) / Ku;
+    check(s, err < ultimateLimit, err, ultimateLimit);
+  }
+  printf("     %s: Ku=%g (ultimate %g) Tu=%g (ultimate %g)\n", name, tune.Ku, Ku, tune.Tu, Tu);
+}
+
+// Ziegler-Nichols gains are applied through a PID reference
+void testApply(){
+  RelayAutotune tune;
+  plant_t p = { 1.0, 1.0, 0.2 };
+  simulate(p, 1.0, 1.0, 0.05, tune);
+  FixedPID<> pid(0, 0, 0);
+  PID &ref = pid;
+  tune.apply(ref);
+  float err = fabs(pid.Kp - 0.6 * tune.Ku) + fabs(pid.Ki - 1.2 * tune.Ku / tune.Tu) + fabs(pid.Kd - 0.075 * tune.Ku * tune.Tu);
+  check("apply: Ziegler-Nichols gains", err < 1e-5, err, 1e-5);
+}
+
+int main(){
+  plant_t lag = { 1.0, 1.0, 0.2 };        // lag dominated
+  plant_t balanced = { 2.0, 0.5, 0.5 };   // dead time = time constant
+  plant_t wheel = { 0.09, 0.15, 0.05 };   // wheel model of pid_test (rpm per PWM)
+  testPlant("lag", lag, 1.0, 1.0, 0.005, 25);
+  testPlant("balanced", balanced, 10.0, 1.0, 0.005, 25);
+  testPlant("lag hysteresis", lag, 1.0, 1.0, 0.05, 0);
+  testPlant("wheel", wheel, 12.5, 51, 2, 0);   // as startAutotune(AUTOTUNE_WHEELS)
+  testApply();
+  return testResult("autotune_test");
+}
@@ -0,0 +1,163 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+
+*/
+
+/*
+  host test of the magnetometer ellipsoid fit (ellipsoid.h)
+  - samples on a known rotated, scaled and offset ellipsoid with noise: recovered offset
+    and correction matrix (corr = R * diag(1/scale) * R') within tolerance
+  - corrected samples on the unit sphere
+  - degenerate samples (all in one plane) and too elongated ellipsoids are rejected
+  - host cycles per add() and solve()
+*/
+
+#include "test.h"
+#include "../ardumower/ellipsoid.h"
+#include "../ardumower/ellipsoid.cpp"
+
+#define NOISE 0.005   // sample noise (unit field)
+
+float frand(){
+  return (float)rand() / RAND_MAX;
+}
+
+// approx. gaussian (sum of uniforms), standard deviation 1
+float grand(){
+  float s = 0;
+  for (int i=0; i < 12; i++) s += frand();
+  return s - 6;
+}
+
+// rotation matrix from yaw/pitch/roll (rad)
+void rotation(float yaw, float pitch, float roll, float r[3][3]){
+  float cy = cos(yaw), sy = sin(yaw), cp = cos(pitch), sp = sin(pitch), cr = cos(roll), sr = sin(roll);
+  float m[3][3] = {
+    { cy*cp, cy*sp*sr - sy*cr, cy*sp*cr + sy*sr },
+    { sy*cp, sy*sp*sr + cy*cr, sy*sp*cr - cy*sr },
+    { -sp,   cp*sr,            cp*cr } };
+  memcpy(r, m, sizeof m);
+}
+
+// ellipsoid x = ofs + R * diag(scale) * u (u on unit sphere), planar: u in the x/y plane only
+struct ellipsoid_t {
+  float ofs[3];
+  float scale[3];
+  float r[3][3];
+};
+
+void sample(const ellipsoid_t &e, bool planar, float x[3]){
+  float z = (planar) ? 0 : 2 * frand() - 1;
+  float phi = 2 * PI * frand();
+  float rho = sqrt(1 - z*z);
+  float u[3] = { rho * cos(phi) * e.scale[0], rho * sin(phi) * e.scale[1], z * e.scale[2] };
+  for (int i=0; i < 3; i++)
+    x[i] = e.ofs[i] + e.r[i][0]*u[0] + e.r[i][1]*u[1] + e.r[i][2]*u[2] + NOISE * grand();
+}
+
+// expected correction matrix R * diag(1/scale) * R'
+void expectedCorr(const ellipsoid_t &e, float corr[3][3]){
+  for (int i=0; i < 3; i++)
+    for (int j=0; j < 3; j++){
+      corr[i][j] = 0;
+      for (int k=0; k < 3; k++) corr[i][j] += e.r[i][k] / e.scale[k] * e.r[j][k];
+    }
+}
+
+void testFit(const char *name, const ellipsoid_t &e){
+  srand(1);
+  EllipsoidFit fit;
+  for (int i=0; i < 2000; i++){
+    float x[3];
+    sample(e, false, x);
+    fit.add(x[0], x[1], x[2]);
+  }
+  float ofs[3], corr[3][3], expCorr[3][3];
+  bool ok = fit.solve(ofs, corr);
+  char s[64];
+  snprintf(s, sizeof s, "%s: solve()", name);
+  check(s, ok, ok, 1);
+  if (!ok) return;
+  expectedCorr(e, expCorr);
+  float ofsErr = 0, corrErr = 0;
+  for (int i=0; i < 3; i++){
+    ofsErr = max(ofsErr, fabs(ofs[i] - e.ofs[i]));
+    for (int j=0; j < 3; j++) corrErr = max(corrErr, fabs(corr[i][j] - expCorr[i][j]));
+  }
+  snprintf(s, sizeof s, "%s: offset error", name);
+  check(s, ofsErr < 0.01, ofsErr, 0.01);
+  snprintf(s, sizeof s, "%s: correction matrix error", name);
+  check(s, corrErr < 0.01, corrErr, 0.01);
+  // corrected samples on unit sphere (within noise)
+  float radiusErr = 0;
+  for (int i=0; i < 500; i++){
+    float x[3], c[3];
+    sample(e, false, x);
+    for (int j=0; j < 3; j++) x[j] -= ofs[j];
+    for (int j=0; j < 3; j++) c[j] = corr[j][0]*x[0] + corr[j][1]*x[1] + corr[j][2]*x[2];
+    radiusErr = max(radiusErr, fabs(sqrt(c[0]*c[0] + c[1]*c[1] + c[2]*c[2]) - 1));
+  }
+  snprintf(s, sizeof s, "%s: corrected radius error", name);
+  check(s, radiusErr < 0.03, radiusErr, 0.03);
+}
+
+void testRejected(const char *name, const ellipsoid_t &e, bool planar){
+  srand(2);
+  EllipsoidFit fit;
+  for (int i=0; i < 2000; i++){
+    float x[3];
+    sample(e, planar, x);
+    fit.add(x[0], x[1], x[2]);
+  }
+  float ofs[3], corr[3][3];
+  bool ok = fit.solve(ofs, corr);
+  char s[64];
+  snprintf(s, sizeof s, "%s: solve() rejected", name);
+  check(s, !ok, ok, 0);
+}
+
+int main(){
+  ellipsoid_t e = { {0.3, -0.2, 0.15}, {1.0, 0.8, 1.25} };
+  rotation(0.7, -0.3, 0.4, e.r);
+  testFit("rotated ellipsoid", e);
+  ellipsoid_t sphere = { {-0.1, 0.05, 0.4}, {1, 1, 1} };
+  rotation(0, 0, 0, sphere.r);
+  testFit("offset sphere", sphere);
+  // robot not tilted during calibration: all samples in one plane, z axis unknown
+  testRejected("planar", e, true);
+  ellipsoid_t elongated = { {0, 0, 0}, {1.0, 1.0, 0.25} };
+  rotation(0.2, 0.1, 0, elongated.r);
+  testRejected("axis ratio 4", elongated, false);
+  // cycles
+  EllipsoidFit fit;
+  const int n = 1000;
+  static float x[n][3];
+  srand(3);
+  for (int i=0; i < n; i++) sample(e, false, x[i]);
+  uint64_t start = cycles();
+  for (int i=0; i < n; i++) fit.add(x[i][0], x[i][1], x[i][2]);
+  uint64_t addCycles = cycles() - start;
+  float ofs[3], corr[3][3];
+  start = cycles();
+  fit.solve(ofs, corr);
+  uint64_t solveCycles = cycles() - start;
+  printf("host cycles per add(): %.1f, per solve(): %llu\n", (float)addCycles / n, (unsigned long long)solveCycles);
+  return testResult("ellipsoid_test");
+}
@@ -0,0 +1,93 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+
+*/
+
+/*
+  host test of the IMU trig kernel (fastmath.h) against libm
+  - max. errors over the full argument range: fastAtan2, fastAsin 1e-5, fastSinCos 2e-4,
+    sinQ15/cosQ15 1.5e-4 (table with linear interpolation, ~1e-4), wrapPI 1e-4 (fixed point angles) or float rounding
+  - host cycles per call of both implementations (host has an FPU, Mega/Due have none,
+    so the ratio only shows the polynomial/table cost, not the gain on the robot)
+*/
+
+#include "test.h"
+#include "../ardumower/fastmath.h"
+#include "../ardumower/fastmath.cpp"
+
+#define N 200000
+
+volatile float sink;
+
+void testErrors(){
+  double eAtan2 = 0, eAsin = 0, eSinCos = 0, eQ15 = 0, eWrap = 0;
+  for (int i=0; i < N; i++){
+    double t = -PI + 2 * PI * i / N;
+    // radius 1..7, includes axes and diagonals
+    float r = 1 + i % 7;
+    float y = sin(t) * r, x = cos(t) * r;
+    eAtan2 = max(eAtan2, fabs(fastAtan2(y, x) - atan2((double)y, (double)x)));
+    double u = -1 + 2.0 * i / N;
+    eAsin = max(eAsin, fabs(fastAsin(u) - asin(u)));
+    float s, c;
+    fastSinCos(t * 3, s, c);
+    eSinCos = max(eSinCos, max(fabs(s - sin(t * 3)), fabs(c - cos(t * 3))));
+    unsigned int bam = i & 0xFFFF;
+    double a = bam * 2 * PI / 65536;
+    eQ15 = max(eQ15, max(fabs(sinQ15(bam) / 32767.0 - sin(a)), fabs(cosQ15(bam) / 32767.0 - cos(a))));
+    // wrap over +-10 turns, compare on the circle
+    double w = t * 10;
+    double d = fabs(wrapPI(w) - remainder(w, 2 * PI));
+    if (d > PI) d = fabs(d - 2 * PI);
+    eWrap = max(eWrap, d);
+  }
+  check("fastAtan2 max. error (rad)", eAtan2 <= 1e-5, eAtan2, 1e-5);
+  check("fastAsin max. error (rad)", eAsin <= 1e-5, eAsin, 1e-5);
+  check("fastSinCos max. error", eSinCos <= 2e-4, eSinCos, 2e-4);
+  check("sinQ15/cosQ15 max. error", eQ15 <= 1.5e-4, eQ15, 1.5e-4);
+  check("wrapPI max. error (rad)", eWrap <= 1e-4, eWrap, 1e-4);
+  check("fastAtan2(0,0)", fastAtan2(0, 0) == 0, fastAtan2(0, 0), 0);
+  check("fastAsin(1.5) clamped to PI/2", fabs(fastAsin(1.5) - PI/2) <= 1e-5, fastAsin(1.5), PI/2);
+}
+
+// cycles per call over a fixed argument set
+template <class F> float cost(F f){
+  static float args[1024];
+  for (int i=0; i < 1024; i++) args[i] = -PI + 2 * PI * i / 1024;
+  uint64_t start = cycles();
+  for (int n=0; n < 100; n++)
+    for (int i=0; i < 1024; i++) sink = f(args[i]);
+  return (float)(cycles() - start) / (100 * 1024);
+}
+
+void testCost(){
+  printf("host cycles per call (fast / libm):\n");
+  printf("  atan2  %6.1f / %6.1f\n", cost([](float a){ return fastAtan2(a, 1.3f); }), cost([](float a){ return atan2f(a, 1.3f); }));
+  printf("  asin   %6.1f / %6.1f\n", cost([](float a){ return fastAsin(a / 4); }), cost([](float a){ return asinf(a / 4); }));
+  printf("  sincos %6.1f / %6.1f\n", cost([](float a){ float s, c; fastSinCos(a, s, c); return s + c; }),
+    cost([](float a){ return sinf(a) + cosf(a); }));
+  printf("  wrapPI %6.1f / %6.1f\n", cost([](float a){ return wrapPI(a * 7); }), cost([](float a){ return remainderf(a * 7, 2 * (float)PI); }));
+}
+
+int main(){
+  testErrors();
+  testCost();
+  return testResult("fastmath_test");
+}
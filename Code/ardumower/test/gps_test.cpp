@@ -0,0 +1,228 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+
+*/
+
+/*
+  host test and benchmark of the GPS parser (gps.h)
+  - NMEA GGA/RMC/GSA/VTG fields (1e-7 degree coordinates), checksum errors, sentences split
+    across reads, overlong lines
+  - UBX NAV-PVT decoding and checksum errors
+  - local ENU projection against ellipsoid radii
+  - host cycles per received character (NMEA burst of a 1 Hz module, UBX NAV-PVT frame)
+*/
+
+#include "test.h"
+#include "../ardumower/gps.h"
+#include "../ardumower/gps.cpp"
+
+// NMEA sentence with checksum from its body (without '$' and '*')
+const char *nmea(const char *body){
+  static char s[128];
+  byte cs = 0;
+  for (const char *p = body; *p; p++) cs ^= *p;
+  snprintf(s, sizeof s, "$%s*%02X\r\n", body, cs);
+  return s;
+}
+
+int encodeString(GPS &gps, const char *s){
+  int valid = 0;
+  for (; *s; s++) if (gps.encode(*s)) valid++;
+  return valid;
+}
+
+void testNMEA(){
+  GPS gps;
+  const char *data =
+    "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n"
+    "$GPRMC,123519,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W*6A\r\n"
+    "$GPGSA,A,3,04,05,,09,12,,,24,,,,,2.5,1.3,2.1*39\r\n"
+    "$GPVTG,054.7,T,034.4,M,005.5,N,010.2,K*48\r\n";
+  Serial3.setInput(data, strlen(data));
+  check("nmea: feed() reports valid sentence", gps.feed(), 1, 1);
+  long lat, lon;
+  gps.get_position_e7(&lat, &lon);
+  check("nmea: latitude 48.1173 (1e-7 deg)", lat == 481173000, lat, 481173000);
+  check("nmea: longitude 11.516667 (1e-7 deg)", lon == 115166667, lon, 115166667);
+  check("nmea: satellites", gps.satellites() == 8, gps.satellites(), 8);
+  check("nmea: hdop (1/100)", gps.hdop() == 130, gps.hdop(), 130);  // GSA overrides GGA
+  check("nmea: pdop (1/100)", gps.pdop() == 250, gps.pdop(), 250);
+  check("nmea: vdop (1/100)", gps.vdop() == 210, gps.vdop(), 210);
+  check("nmea: fix type", gps.fix_type() == 3, gps.fix_type(), 3);
+  check("nmea: altitude (cm)", gps.altitude() == 54540, gps.altitude(), 54540);
+  check("nmea: speed (knots)", fabs(gps.f_speed_knots() - 5.5) < 1e-4, gps.f_speed_knots(), 5.5);
+  check("nmea: course (deg)", fabs(gps.f_course() - 54.7) < 1e-4, gps.f_course(), 54.7);
+  int year;
+  byte month, day, hour, minute, second;
+  gps.crack_datetime(&year, &month, &day, &hour, &minute, &second);
+  check("nmea: date 1994-03-23", (year == 1994) && (month == 3) && (day == 23), year * 10000 + month * 100 + day, 19940323);
+  check("nmea: time 12:35:19", (hour == 12) && (minute == 35) && (second == 19), hour * 10000 + minute * 100 + second, 123519);
+  unsigned long chars;
+  unsigned short good, failed;
+  gps.stats(&chars, &good, &failed);
+  check("nmea: good sentences", good == 4, good, 4);
+
+  // wrong checksum: counted, position kept
+  encodeString(gps, "$GPGGA,123520,4907.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*48\r\n");
+  gps.stats(&chars, &good, &failed);
+  gps.get_position_e7(&lat, &lon);
+  check("nmea: checksum error counted", failed == 1, failed, 1);
+  check("nmea: checksum error ignored", lat == 481173000, lat, 481173000);
+
+  // southern/western hemisphere, sentence split in single characters and other talker (GN)
+  GPS gps2;
+  int valid = encodeString(gps2, nmea("GNGGA,010203.50,3345.1234,S,07030.5678,W,2,12,0.7,10.0,M,0.0,M,,"));
+  gps2.get_position_e7(&lat, &lon);
+  check("nmea: GN talker accepted", valid == 1, valid, 1);
+  check("nmea: south latitude (1e-7 deg)", lat == -337520567, lat, -337520567);
+  check("nmea: west longitude (1e-7 deg)", lon == -705094633, lon, -705094633);
+
+  // overlong line (no end) must not corrupt the next sentence
+  GPS gps3;
+  char junk[200];
+  memset(junk, '1', sizeof junk - 1);
+  junk[0] = '$';
+  junk[sizeof junk - 1] = 0;
+  encodeString(gps3, junk);
+  valid = encodeString(gps3, nmea("GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,"));
+  check("nmea: sentence after overlong line", valid == 1, valid, 1);
+}
+
+// UBX frame of a NAV-PVT payload
+int ubxFrame(const ubx_nav_pvt_t &pvt, byte *f){
+  int n = 0;
+  f[n++] = 0xB5; f[n++] = 0x62; f[n++] = 0x01; f[n++] = 0x07;
+  f[n++] = sizeof pvt; f[n++] = 0;
+  memcpy(f + n, &pvt, sizeof pvt);
+  n += sizeof pvt;
+  byte a = 0, b = 0;
+  for (int i=2; i < n; i++){
+    a += f[i];
+    b += a;
+  }
+  f[n++] = a;
+  f[n++] = b;
+  return n;
+}
+
+void testUBX(){
+  GPS gps;
+  check("ubx: NAV-PVT payload size", sizeof(ubx_nav_pvt_t) == 92, sizeof(ubx_nav_pvt_t), 92);
+  ubx_nav_pvt_t pvt;
+  memset(&pvt, 0, sizeof pvt);
+  pvt.year = 2026; pvt.month = 10; pvt.day = 19; pvt.hour = 12; pvt.min = 34; pvt.sec = 56; pvt.valid = 3;
+  pvt.fixType = 3; pvt.flags = 1; pvt.numSV = 14;
+  pvt.lat = 481173000; pvt.lon = 115166667; pvt.hMSL = 545400; pvt.hAcc = 1234; pvt.vAcc = 2345;
+  pvt.gSpeed = 1000; pvt.headMot = 5470000; pvt.pDOP = 150;
+  byte f[128];
+  int n = ubxFrame(pvt, f);
+  bool res = false;
+  for (int i=0; i < n; i++) res |= gps.encodeUBX(f[i]);
+  long lat, lon;
+  gps.get_position_e7(&lat, &lon);
+  check("ubx: frame decoded", res, res, 1);
+  check("ubx: latitude (1e-7 deg)", lat == 481173000, lat, 481173000);
+  check("ubx: longitude (1e-7 deg)", lon == 115166667, lon, 115166667);
+  check("ubx: horizontal accuracy (mm)", gps.h_accuracy() == 1234, gps.h_accuracy(), 1234);
+  check("ubx: vertical accuracy (mm)", gps.v_accuracy() == 2345, gps.v_accuracy(), 2345);
+  check("ubx: fix type", gps.fix_type() == 3, gps.fix_type(), 3);
+  check("ubx: satellites", gps.satellites() == 14, gps.satellites(), 14);
+  check("ubx: altitude (cm)", gps.altitude() == 54540, gps.altitude(), 54540);
+  check("ubx: speed (m/s, stored in 1/100 knots)", fabs(gps.f_speed_mps() - 1.0) < 0.003, gps.f_speed_mps(), 1.0);
+  check("ubx: pdop (1/100)", gps.pdop() == 150, gps.pdop(), 150);
+  f[20] ^= 1;
+  res = false;
+  for (int i=0; i < n; i++) res |= gps.encodeUBX(f[i]);
+  unsigned long chars;
+  unsigned short good, failed;
+  gps.stats(&chars, &good, &failed);
+  check("ubx: corrupted frame rejected", !res, res, 0);
+  check("ubx: checksum error counted", failed == 1, failed, 1);
+  // init(true) configures the module with UBX CFG messages
+  Serial3.outputLen = 0;
+  Serial3.setInput("", 0);
+  gps.init(true);
+  check("ubx: init sends CFG messages", (Serial3.outputLen > 0) && (Serial3.output[0] == 0xB5) && (Serial3.output[2] == 0x06),
+    Serial3.outputLen, 1);
+}
+
+// ENU offsets (mm) against meridian/prime vertical radii of WGS84
+void testENU(){
+  GPS gps;
+  long lat0 = 481173000, lon0 = 115166667;
+  gps.set_origin(lat0, lon0);
+  const long d[][2] = { {1000, 0}, {0, 1000}, {-90000, 120000}, {900000, -900000} };
+  double maxErr = 0;
+  for (int i=0; i < 4; i++){
+    long e, n;
+    gps.to_enu(lat0 + d[i][0], lon0 + d[i][1], &e, &n);
+    double a = 6378137, fl = 1 / 298.257223563, e2 = fl * (2 - fl);
+    double p = lat0 / 1e7 * PI / 180;
+    double w = sqrt(1 - e2 * sin(p) * sin(p));
+    double M = a * (1 - e2) / (w * w * w), N = a / w;
+    double refN = d[i][0] / 1e7 * PI / 180 * M * 1000;
+    double refE = d[i][1] / 1e7 * PI / 180 * N * cos(p) * 1000;
+    double dist = sqrt(refE * refE + refN * refN);
+    // 0.1% of distance (flat earth over a lawn) plus 2 mm rounding
+    maxErr = max(maxErr, max(fabs(e - refE), fabs(n - refN)) / (dist * 1e-3 + 2));
+  }
+  check("enu: error / (0.1% distance + 2 mm)", maxErr <= 1, maxErr, 1);
+}
+
+void benchmark(){
+  // 1 Hz NMEA output: GGA, GSA, 3x GSV (filtered), RMC, VTG
+  static char burst[1024];
+  burst[0] = 0;
+  strcat(burst, nmea("GPGGA,123519.00,4807.03812,N,01131.00045,E,1,08,0.9,545.4,M,46.9,M,,"));
+  strcat(burst, nmea("GPGSA,A,3,04,05,,09,12,,,24,,,,,2.5,1.3,2.1"));
+  strcat(burst, nmea("GPGSV,3,1,11,03,03,111,00,04,15,270,00,06,01,010,00,13,06,292,00"));
+  strcat(burst, nmea("GPGSV,3,2,11,14,25,170,00,16,57,208,39,18,67,296,40,19,40,246,00"));
+  strcat(burst, nmea("GPGSV,3,3,11,22,42,067,42,24,14,311,43,27,05,244,00"));
+  strcat(burst, nmea("GPRMC,123519.00,A,4807.03812,N,01131.00045,E,022.4,084.4,230394,003.1,W"));
+  strcat(burst, nmea("GPVTG,054.7,T,034.4,M,005.5,N,010.2,K"));
+  GPS gps;
+  int len = strlen(burst);
+  const int runs = 2000;
+  int valid = 0;
+  uint64_t start = cycles();
+  for (int r=0; r < runs; r++) valid += encodeString(gps, burst);
+  uint64_t nmeaCycles = cycles() - start;
+  check("bench: valid sentences per burst", valid == 4 * runs, (float)valid / runs, 4);
+
+  ubx_nav_pvt_t pvt;
+  memset(&pvt, 0, sizeof pvt);
+  pvt.fixType = 3; pvt.lat = 481173000; pvt.lon = 115166667;
+  byte f[128];
+  int n = ubxFrame(pvt, f);
+  start = cycles();
+  for (int r=0; r < runs; r++)
+    for (int i=0; i < n; i++) gps.encodeUBX(f[i]);
+  uint64_t ubxCycles = cycles() - start;
+  printf("host cycles per character: NMEA %.1f (%d chars per burst, %.0f per burst), UBX %.1f (%d bytes per frame)\n",
+    (float)nmeaCycles / runs / len, len, (float)nmeaCycles / runs, (float)ubxCycles / runs / n, n);
+}
+
+int main(){
+  testNMEA();
+  testUBX();
+  testENU();
+  benchmark();
+  return testResult("gps_test");
+}
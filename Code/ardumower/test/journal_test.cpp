@@ -0,0 +1,237 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+
+*/
+
+/*
+  host test of the settings journal (journal.h) on a RAM-backed Flash (AT24C32) stub
+  - scan: newest record of each type is found after power-up, erased record reads as missing
+  - seq selection: record with the higher sequence number wins, not the one at the higher page
+  - allocate wrap-around: writes rotate through the journal area and wrap to page 0
+    without overwriting the live records of the other types
+  - torn record: power loss in the middle of a page leaves the previous record in use
+  - unchanged records are not written again
+*/
+
+#include "test.h"
+
+// journal.cpp includes the hardware drivers and config.h (Console), host replacements below
+#define DRIVERS_H
+#define MOWER_H
+#define F(s) s
+
+struct ConsoleStub {
+  void println(const char *s){}
+} Console;
+
+// minimal String (jreadwriteString)
+class String {
+  public:
+    String(const char *s = ""){ snprintf(buf, sizeof buf, "%s", s); }
+    String& operator+=(char ch){
+      size_t n = strlen(buf);
+      if (n + 1 < sizeof buf){ buf[n] = ch; buf[n+1] = 0; }
+      return *this;
+    }
+    unsigned int length() const { return strlen(buf); }
+    char charAt(unsigned int i) const { return buf[i]; }
+    bool operator==(const char *s) const { return strcmp(buf, s) == 0; }
+  private:
+    char buf[64];
+};
+
+#include "../ardumower/journal.cpp"
+
+// EEPROM in RAM, erased (0xFF) like a new AT24C32; writes stop after tornAfter bytes (power loss)
+byte eeprom[EEPROM_SIZE];
+long tornAfter = -1;
+int pageWrites = 0;
+
+FlashClass::FlashClass(){
+}
+
+byte FlashClass::read(uint32_t address){
+  return (address < EEPROM_SIZE) ? eeprom[address] : 0xFF;
+}
+
+boolean FlashClass::writePage(uint32_t address, const byte *data, byte len){
+  pageWrites++;
+  for (byte i=0; i < len; i++){
+    if (tornAfter == 0) return true;  // power lost: nothing reports the failure
+    if (tornAfter > 0) tornAfter--;
+    eeprom[address + i] = data[i];
+  }
+  return true;
+}
+
+FlashClass Flash;
+
+// record as written by Robot::loadSaveXXX (100 byte payload: 4 pages with header)
+struct record_t {
+  short magic;
+  long value;
+  byte fill[94];
+};
+
+void loadSave(boolean readflag, byte id, record_t &r){
+  if (readflag) {
+    memset(&r, 0, sizeof r);
+    if (!Journal.openRead(id)) return;
+  } else Journal.openWrite(id);
+  do {
+    int addr = 0;
+    jreadwrite(readflag, addr, r.magic);
+    jreadwrite(readflag, addr, r.value);
+    jreadwrite(readflag, addr, r.fill);
+  } while (Journal.nextPass());
+}
+
+void save(byte id, long value){
+  record_t r;
+  r.magic = 57;
+  r.value = value;
+  for (unsigned int i=0; i < sizeof r.fill; i++) r.fill[i] = value + i;
+  loadSave(false, id, r);
+}
+
+// value read after power-up (journal scanned again), -1 if missing or corrupt
+long load(byte id){
+  Journal = JournalClass();
+  record_t r;
+  loadSave(true, id, r);
+  if (r.magic != 57) return -1;
+  for (unsigned int i=0; i < sizeof r.fill; i++) if (r.fill[i] != (byte)(r.value + i)) return -1;
+  return r.value;
+}
+
+journal_header_t *headerAt(int page){
+  return (journal_header_t*)(eeprom + JOURNAL_START + page * JOURNAL_PAGE_SIZE);
+}
+
+void powerUp(){
+  memset(eeprom, 0xFF, sizeof eeprom);
+  tornAfter = -1;
+  Journal = JournalClass();
+}
+
+void testScan(){
+  powerUp();
+  check("scan: empty journal reads as missing", load(JOURNAL_USER_SETTINGS) == -1, load(JOURNAL_USER_SETTINGS), -1);
+  save(JOURNAL_USER_SETTINGS, 11);
+  save(JOURNAL_ERR_COUNTERS, 22);
+  save(JOURNAL_ROBOT_STATS, 33);
+  save(JOURNAL_USER_SETTINGS, 12);
+  int found = (load(JOURNAL_USER_SETTINGS) == 12) + (load(JOURNAL_ERR_COUNTERS) == 22) + (load(JOURNAL_ROBOT_STATS) == 33);
+  check("scan: newest record of each type", found == 3, found, 3);
+  Journal = JournalClass();
+  Journal.erase(JOURNAL_ERR_COUNTERS);
+  long v = load(JOURNAL_ERR_COUNTERS);
+  check("scan: erased record reads as missing", v == -1, v, -1);
+  v = load(JOURNAL_ROBOT_STATS);
+  check("scan: other records kept after erase", v == 33, v, 33);
+}
+
+// a newer record at a lower page (after wrap) must win over an older one at a higher page
+void testSeqSelection(){
+  powerUp();
+  save(JOURNAL_USER_SETTINGS, 1);   // pages 0..3
+  save(JOURNAL_USER_SETTINGS, 2);   // pages 4..7
+  // swap the two records: seq 2 now at page 0, seq 1 at page 4
+  byte tmp[4 * JOURNAL_PAGE_SIZE];
+  byte *a = eeprom + JOURNAL_START;
+  byte *b = a + sizeof tmp;
+  memcpy(tmp, a, sizeof tmp);
+  memcpy(a, b, sizeof tmp);
+  memcpy(b, tmp, sizeof tmp);
+  long v = load(JOURNAL_USER_SETTINGS);
+  check("seq: higher sequence number wins", v == 2, v, 2);
+  // next record continues behind the newest one and gets the next sequence number
+  save(JOURNAL_USER_SETTINGS, 3);
+  journal_header_t *h = headerAt(4);
+  check("seq: next record behind newest", (h->magic == JOURNAL_MAGIC) && (h->seq == 3), h->seq, 3);
+  v = load(JOURNAL_USER_SETTINGS);
+  check("seq: newest after next write", v == 3, v, 3);
+}
+
+void testWrapAround(){
+  powerUp();
+  save(JOURNAL_ERR_COUNTERS, 500);
+  save(JOURNAL_ROBOT_STATS, 600);
+  int wraps = 0;
+  int lastPage = 0;
+  int lost = 0;
+  for (long i=0; i < 100; i++){
+    save(JOURNAL_USER_SETTINGS, i);
+    // page of the newest settings record
+    int page = -1;
+    for (int p=0; p < JOURNAL_PAGES; p++){
+      journal_header_t *h = headerAt(p);
+      if ((h->magic == JOURNAL_MAGIC) && (h->id == JOURNAL_USER_SETTINGS) && (h->seq == (uint32_t)i + 3)) page = p;
+    }
+    if (page < lastPage) wraps++;
+    lastPage = page;
+    if ((load(JOURNAL_USER_SETTINGS) != i) || (load(JOURNAL_ERR_COUNTERS) != 500) || (load(JOURNAL_ROBOT_STATS) != 600)) lost++;
+  }
+  // 100 records of 4 pages in 96 pages: at least 4 rotations
+  check("wrap: rotations through journal area", wraps >= 4, wraps, 4);
+  check("wrap: live records lost", lost == 0, lost, 0);
+}
+
+void testTornRecord(){
+  powerUp();
+  save(JOURNAL_USER_SETTINGS, 7);
+  save(JOURNAL_ROBOT_STATS, 8);
+  // power lost in the middle of the second page of the new record
+  tornAfter = JOURNAL_PAGE_SIZE + 10;
+  save(JOURNAL_USER_SETTINGS, 9);
+  tornAfter = -1;
+  long v = load(JOURNAL_USER_SETTINGS);
+  check("torn: previous record in use", v == 7, v, 7);
+  v = load(JOURNAL_ROBOT_STATS);
+  check("torn: other record kept", v == 8, v, 8);
+  // torn pages are skipped by the next write
+  save(JOURNAL_USER_SETTINGS, 10);
+  v = load(JOURNAL_USER_SETTINGS);
+  check("torn: next record written", v == 10, v, 10);
+  // power lost within the header
+  tornAfter = 5;
+  save(JOURNAL_USER_SETTINGS, 11);
+  tornAfter = -1;
+  v = load(JOURNAL_USER_SETTINGS);
+  check("torn: header torn, previous record in use", v == 10, v, 10);
+}
+
+void testUnchanged(){
+  powerUp();
+  save(JOURNAL_ROBOT_STATS, 42);
+  pageWrites = 0;
+  save(JOURNAL_ROBOT_STATS, 42);
+  check("unchanged: page writes", pageWrites == 0, pageWrites, 0);
+  check("unchanged: skip counter", Journal.skipCounter == 1, Journal.skipCounter, 1);
+}
+
+int main(){
+  testScan();
+  testSeqSelection();
+  testWrapAround();
+  testTornRecord();
+  testUnchanged();
+  return testResult("journal_test");
+}
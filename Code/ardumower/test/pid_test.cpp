@@ -0,0 +1,218 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+
+*/
+
+/*
+  host test of FixedPID/FixedVelocityPID against the float PID/VelocityPID (pid.h)
+  - closed loop wheel speed control (as motorSpeedControl) of a first-order motor model,
+    step and ramp set values, fixed point and float trajectories must match
+  - velocity form: closed loop with integer speed feedback (VelocityPID truncates the error),
+    output truncated towards zero for positive and negative errors
+  - quantisation of the integral gain KiTa = toFixed(Ki*Ta) at Ta=5 ms (MOTOR_CONTROL_RATE)
+  - reset() through a PID reference (RelayAutotune::apply) clears the fixed point state
+  - host cycles per compute() call
+*/
+
+#include "test.h"
+#include "../ardumower/pid.h"
+#include "../ardumower/pid.cpp"
+
+#define TA 0.005             // 1/MOTOR_CONTROL_RATE
+#define MAX_PWM 255          // motorSpeedMaxPwm
+#define MAX_RPM 25           // motorSpeedMaxRpm
+#define MOTOR_TAU 0.15       // motor time constant (sec)
+#define MOTOR_GAIN 0.09      // rpm per PWM at steady state (less than feed forward 25/255)
+
+// wheel speed PID as in motorSpeedControl (default gains of mower.cpp)
+void setupPID(PID &pid){
+  pid.Kp = 1.5;
+  pid.Ki = 0.29;
+  pid.Kd = 0.25;
+  pid.y_min = -MAX_PWM;
+  pid.y_max = MAX_PWM;
+  pid.max_output = MAX_PWM;
+  pid.reset();
+}
+
+// one control tick: feed forward plus PID correction, returns PWM
+float controlTick(PID &pid, float w, float rpm){
+  pid.w = w;
+  pid.x = rpm;
+  pid.compute(TA);
+  return constrain(w * MAX_PWM / MAX_RPM + pid.y, -MAX_PWM, MAX_PWM);
+}
+
+// closed loop run of float and fixed controller, checks max. speed and output difference
+void runLoop(const char *name, bool ramp, float rpmLimit, float pwmLimit){
+  PID floatPID;
+  FixedPID<> fixedPID;
+  setupPID(floatPID);
+  setupPID(fixedPID);
+  float rpmFloat = 0, rpmFixed = 0;
+  float rpmDiff = 0, pwmDiff = 0;
+  int steps = 3.0 / TA;
+  for (int i=0; i < steps; i++){
+    float t = i * TA;
+    float w = (ramp) ? min(t * 10, 20.0f) : 20;
+    float pwmFloat = controlTick(floatPID, w, rpmFloat);
+    float pwmFixed = controlTick(fixedPID, w, rpmFixed);
+    rpmFloat += (MOTOR_GAIN * pwmFloat - rpmFloat) * TA / MOTOR_TAU;
+    rpmFixed += (MOTOR_GAIN * pwmFixed - rpmFixed) * TA / MOTOR_TAU;
+    rpmDiff = max(rpmDiff, fabs(rpmFixed - rpmFloat));
+    pwmDiff = max(pwmDiff, fabs(pwmFixed - pwmFloat));
+  }
+  char s[64];
+  snprintf(s, sizeof s, "%s: speed fixed-float (rpm)", name);
+  check(s, rpmDiff < rpmLimit, rpmDiff, rpmLimit);
+  snprintf(s, sizeof s, "%s: output fixed-float (pwm)", name);
+  check(s, pwmDiff < pwmLimit, pwmDiff, pwmLimit);
+}
+
+// velocity PID drives the PWM directly, speed feedback in whole rpm (float VelocityPID truncates the error)
+void setupVelocityPID(VelocityPID &pid){
+  pid.Kp = 1.5;
+  pid.Ki = 100;
+  pid.Kd = 0.002;
+  pid.max_output = MAX_PWM;
+  pid.y_min = -MAX_PWM;
+  pid.y_max = MAX_PWM;
+  pid.y = pid.yold = 0;
+  pid.eold1 = pid.eold2 = 0;
+}
+
+void runVelocityLoop(const char *name, float w, float rpmLimit, float pwmLimit, float errLimit){
+  VelocityPID floatPID;
+  FixedVelocityPID<> fixedPID;
+  setupVelocityPID(floatPID);
+  setupVelocityPID(fixedPID);
+  float rpmFloat = 0, rpmFixed = 0;
+  float rpmDiff = 0, pwmDiff = 0;
+  int steps = 3.0 / TA;
+  for (int i=0; i < steps; i++){
+    floatPID.w = fixedPID.w = w;
+    floatPID.x = round(rpmFloat);
+    fixedPID.x = round(rpmFixed);
+    float pwmFloat = floatPID.compute(TA);
+    float pwmFixed = fixedPID.compute(TA);
+    rpmFloat += (MOTOR_GAIN * pwmFloat - rpmFloat) * TA / MOTOR_TAU;
+    rpmFixed += (MOTOR_GAIN * pwmFixed - rpmFixed) * TA / MOTOR_TAU;
+    rpmDiff = max(rpmDiff, fabs(rpmFixed - rpmFloat));
+    pwmDiff = max(pwmDiff, fabs(pwmFixed - pwmFloat));
+  }
+  char s[64];
+  snprintf(s, sizeof s, "%s: speed fixed-float (rpm)", name);
+  check(s, rpmDiff < rpmLimit, rpmDiff, rpmLimit);
+  snprintf(s, sizeof s, "%s: output fixed-float (pwm)", name);
+  check(s, pwmDiff < pwmLimit, pwmDiff, pwmLimit);
+  snprintf(s, sizeof s, "%s: final speed error (rpm)", name);
+  check(s, fabs(rpmFixed - w) < errLimit, fabs(rpmFixed - w), errLimit);
+}
+
+// integral increment below one output step: output must stay 0 for either sign of the error
+// (truncation towards zero as VelocityPID, no drift of a floor shift for negative errors)
+void testVelocityTruncation(){
+  FixedVelocityPID<> pid;
+  setupVelocityPID(pid);
+  pid.Kp = pid.Kd = 0;
+  pid.Ki = 10;    // Ki*Ta*e = 0.05 per tick
+  int drift = 0;
+  for (int sign=-1; sign <= 1; sign += 2){
+    pid.w = 0;
+    pid.x = -sign;
+    pid.y = pid.yold = 0;
+    for (int i=0; i < 100; i++) pid.compute(TA);
+    drift = max(drift, abs(pid.y));
+  }
+  check("velocity: sub-step output drift (pwm)", drift == 0, drift, 0);
+}
+
+// integral only controller with constant error 1.0: output grows by the quantised Ki*Ta per tick
+void testKiTa(float Ki){
+  FixedPID<> pid;
+  pid.Kp = pid.Kd = 0;
+  pid.Ki = Ki;
+  pid.y_min = -1e4;
+  pid.y_max = pid.max_output = 1e4;
+  pid.reset();
+  pid.w = 1;
+  pid.x = 0;
+  int n = 1000;
+  for (int i=0; i < n; i++) pid.compute(TA);
+  float KiTa = Ki * TA;
+  float err = fabs(pid.y / n - KiTa);
+  float lsb = 1.0 / 65536;
+  char s[64];
+  snprintf(s, sizeof s, "KiTa Ki=%g: error (LSB)", Ki);
+  check(s, err <= lsb, err / lsb, 1);
+  snprintf(s, sizeof s, "KiTa Ki=%g: relative error (%%)", Ki);
+  check(s, err / KiTa <= lsb / KiTa, 100 * err / KiTa, 100 * lsb / KiTa);
+}
+
+// RelayAutotune::apply calls reset() through a PID reference
+void testReset(){
+  FixedPID<> fixedPID;
+  setupPID(fixedPID);
+  fixedPID.w = 10;
+  fixedPID.x = 0;
+  for (int i=0; i < 100; i++) fixedPID.compute(TA);
+  PID &pid = fixedPID;
+  pid.reset();
+  fixedPID.w = fixedPID.x = 5;
+  fixedPID.compute(TA);
+  check("reset via PID&: output with zero error", fixedPID.y == 0, fixedPID.y, 0);
+}
+
+void setup(PID &pid){ setupPID(pid); }
+void setup(VelocityPID &pid){ setupVelocityPID(pid); }
+
+template <class T> float cyclesPerCompute(T &pid){
+  setup(pid);
+  const int n = 100000;
+  float sum = 0;
+  uint64_t start = cycles();
+  for (int i=0; i < n; i++){
+    pid.w = 20;
+    pid.x = (i % 50) * 0.4;
+    sum += pid.compute(TA);
+  }
+  uint64_t end = cycles();
+  if (sum == 12345) printf(" ");  // keep loop
+  return (float)(end - start) / n;
+}
+
+int main(){
+  runLoop("step", false, 0.01, 0.5);
+  runLoop("ramp", true, 0.01, 0.5);
+  testKiTa(0.29);   // wheel default (Ta*Ki ~ 95 LSB)
+  testKiTa(0.05);
+  testKiTa(2.0);
+  testReset();
+  runVelocityLoop("velocity step", 20, 0.5, 5, 1.5);    // integer output: one step off at a rounding boundary shifts a few ticks
+  runVelocityLoop("velocity reverse", -15, 0.5, 5, 1.5);
+  testVelocityTruncation();
+  PID floatPID;
+  FixedPID<> fixedPID;
+  VelocityPID floatVelocityPID;
+  FixedVelocityPID<> fixedVelocityPID;
+  printf("host cycles per compute(): float %.1f, fixed %.1f\n", cyclesPerCompute(floatPID), cyclesPerCompute(fixedPID));
+  printf("host cycles per compute() velocity: float %.1f, fixed %.1f\n", cyclesPerCompute(floatVelocityPID), cyclesPerCompute(fixedVelocityPID));
+  return testResult("pid_test");
+}
@@ -0,0 +1,15 @@
+#!/bin/sh
+# compiles and runs all host tests (see README.md)
+cd "$(dirname "$0")"
+mkdir -p build
+result=0
+for src in *_test.cpp; do
+  name="${src%.cpp}"
+  if ! g++ -O2 -Wall -I. -o "build/$name" "$src"; then
+    echo "$name: BUILD FAILED"
+    result=1
+    continue
+  fi
+  "build/$name" || result=1
+done
+exit $result
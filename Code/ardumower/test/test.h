@@ -0,0 +1,57 @@
+/*
+  Ardumower (www.ardumower.de)
+  
+  Private-use only! (you need to ask for a commercial-use)
+ 
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  
+  Private-use only! (you need to ask for a commercial-use)
+
+*/
+
+// shared helpers of the host tests: checks and cycle counter
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdint.h>
+#if defined (__x86_64__) || defined (__i386__)
+  #include <x86intrin.h>
+#endif
+
+static int testFailures = 0;
+
+// prints and counts a failed check
+inline void check(const char *name, bool ok, double value, double limit){
+  printf("%-4s %-40s %12.6g (limit %g)\n", (ok) ? "ok" : "FAIL", name, value, limit);
+  if (!ok) testFailures++;
+}
+
+// host cycle counter (TSC), nanoseconds on other hosts
+inline uint64_t cycles(){
+  #if defined (__x86_64__) || defined (__i386__)
+    return __rdtsc();
+  #else
+    return (uint64_t)micros() * 1000;
+  #endif
+}
+
+inline int testResult(const char *name){
+  printf("%s: %s\n", name, (testFailures == 0) ? "PASSED" : "FAILED");
+  return (testFailures == 0) ? 0 : 1;
+}
+
+#endif
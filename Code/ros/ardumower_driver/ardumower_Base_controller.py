@@ -44,6 +44,16 @@ class BaseController:
         pid_params['Ko'] = rospy.get_param("~Ko", 50)
         
         self.accel_limit = rospy.get_param('~accel_limit', 0.1)
+        # wheel speeds closed-loop controlled by Ardumower (velocity command) instead of open-loop PWM
+        self.use_firmware_speed_control = rospy.get_param("~use_firmware_speed_control", True)
+        if self.use_firmware_speed_control:
+            # velocity commands are ramped by Ardumower (jerk-limited profile in control tick)
+            self.ardumower.setVelocityLimits(rospy.get_param("~max_linear_speed", 0.0),
+                                             rospy.get_param("~max_angular_speed", 0.0),
+                                             rospy.get_param("~linear_accel_limit", 0.3),
+                                             rospy.get_param("~angular_accel_limit", 1.5),
+                                             rospy.get_param("~linear_jerk_limit", 1.5),
+                                             rospy.get_param("~angular_jerk_limit", 7.5))
                
         # Set up PID parameters and check for missing values
         self.setup_pid(pid_params)
@@ -76,7 +86,11 @@ class BaseController:
 
         # Subscriptions
         rospy.Subscriber("cmd_vel", Twist, self.cmdVelCallback)
-        rospy.Subscriber("ardumower_odometry", msg.odometry, self.ardumowerOdomCallBack)
+        # odometry is integrated by Ardumower (ardumower_pose), ticks integration only as fallback
+        if rospy.get_param("~use_firmware_odometry", True):
+            rospy.Subscriber("ardumower_pose", msg.pose, self.ardumowerPoseCallBack)
+        else:
+            rospy.Subscriber("ardumower_odometry", msg.odometry, self.ardumowerOdomCallBack)
         
         # Clear any old odometry info
         #self.arduino.reset_encoders()
@@ -126,12 +140,48 @@ class BaseController:
             #     return
 
 
+    def ardumowerPoseCallBack(self, req):
+        # pose and twist are already integrated by Ardumower, only publish them
+        self.x = req.x
+        self.y = req.y
+        self.th = req.theta
+
+        quaternion = Quaternion()
+        quaternion.x = 0.0
+        quaternion.y = 0.0
+        quaternion.z = sin(self.th / 2.0)
+        quaternion.w = cos(self.th / 2.0)
+
+        self.odomBroadcaster.sendTransform(
+            (self.x, self.y, 0),
+            (quaternion.x, quaternion.y, quaternion.z, quaternion.w),
+            req.header.stamp,
+            self.base_frame,
+            "odom"
+            )
+
+        odom = Odometry()
+        odom.header.frame_id = "odom"
+        odom.child_frame_id = self.base_frame
+        odom.header.stamp = req.header.stamp
+        odom.pose.pose.position.x = self.x
+        odom.pose.pose.position.y = self.y
+        odom.pose.pose.position.z = 0
+        odom.pose.pose.orientation = quaternion
+        odom.twist.twist.linear.x = req.linear
+        odom.twist.twist.linear.y = 0
+        odom.twist.twist.angular.z = req.angular
+        self.odomPub.publish(odom)
+
     def ardumowerOdomCallBack(self, req):
-        now = rospy.Time.now()
+        # use capture time of Ardumower (synchronized to host clock) instead of receive time
+        now = req.header.stamp
         # time since last call                
         dt = now - self.then
         self.then = now
         dt = dt.to_sec()
+        if dt <= 0:
+            return
             
         # Calculate odometry
         if self.enc_left == None:
@@ -169,7 +219,7 @@ class BaseController:
         self.odomBroadcaster.sendTransform(
             (self.x, self.y, 0), 
             (quaternion.x, quaternion.y, quaternion.z, quaternion.w),
-            rospy.Time.now(),
+            now,
             self.base_frame,
             "odom"
             )
@@ -200,6 +250,12 @@ class BaseController:
         x = req.linear.x         # m/s
         th = req.angular.z       # rad/s
 
+        if self.use_firmware_speed_control:
+            if not self.stopped:
+                self.ardumower.setVelocity(x, th, False)
+            self.t_next = now + self.t_delta
+            return
+
         if x == 0:
             # Turn in place
             right = th * self.wheel_track  * self.gear_reduction / 2.0
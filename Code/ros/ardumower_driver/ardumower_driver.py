@@ -22,8 +22,9 @@ class ArdumowerROSDriver:
    SEN_MOTOR_LEFT,SEN_MOTOR_RIGHT,SEN_MOTOR_MOW, \
    SEN_BUMPER_LEFT,SEN_BUMPER_RIGHT,SEN_DROP_LEFT,SEN_DROP_RIGHT, \
    SEN_SONAR_CENTER,SEN_SONAR_LEFT,SEN_SONAR_RIGHT, \
-   SEN_BUTTON,SEN_IMU,SEN_ODOM,SEN_MOTOR_MOW_RPM,SEN_RTC,SEN_RAIN,SEN_TILT,SEN_FREE_WHEEL \
-    = range(0,26)
+   SEN_BUTTON,SEN_IMU,SEN_ODOM,SEN_MOTOR_MOW_RPM,SEN_RTC,SEN_RAIN,SEN_TILT,SEN_FREE_WHEEL, \
+   SEN_POSE,SEN_GPS \
+    = range(0,28)
 
    # Error types
    ERR_MOTOR_LEFT,ERR_MOTOR_RIGHT,ERR_MOTOR_MOW,ERR_MOW_SENSE, \
@@ -46,6 +47,7 @@ class ArdumowerROSDriver:
         self.ArdumowerStatus = -1
         self.lastSensorTriggered = -1
         self.lastError = -1
+        self.lastEventStamp = None
         
         # define publishers here
         self.pubStatus = rospy.Publisher("ardumower_Status",msg.Status, queue_size=10)
@@ -55,6 +57,8 @@ class ArdumowerROSDriver:
         self.pubMotor = rospy.Publisher("ardumower_motor", msg.motor, queue_size=10)
         self.pubSonar = rospy.Publisher("ardumo_sonar", msg.sonar, queue_size=10)
         self.pubOdometry = rospy.Publisher("ardumower_odometry", msg.odometry, queue_size=100)
+        self.pubPose = rospy.Publisher("ardumower_pose", msg.pose, queue_size=100)
+        self.pubGPS = rospy.Publisher("ardumower_gps", msg.gps, queue_size=10)
 
         # define mow motor status here
         self.mowMotorEnable = False
@@ -69,6 +73,14 @@ class ArdumowerROSDriver:
         self.timeoutROSMessage = 5 # await at least one message every x sec.
         self.timeLastROSCommand = rospy.get_time() +10 # when last ros command has arrived
 
+        # Clock sync between Ardumower micros() and host time (NTP like via heartbeat)
+        self.heartbeatRate = 1.0 # send heartbeat every x sec.
+        self.timeNextHeartbeat = 0
+        self.clockSamples = [] # (round trip delay, offset) of last heartbeats
+        self.clockOffset = None # host time - firmware time in sec.
+        self.fwMicrosLast = None # last firmware micros() seen, used to unwrap 32bit overflow
+        self.fwMicrosEpoch = 0
+
 
     # Method to connect to serial console of Arduino
    def connect(self):
@@ -96,6 +108,70 @@ class ArdumowerROSDriver:
                    self.processResponseMessage(line)
                elif line.startswith('$EV'):
                    self.processEventMessage(line)
+               elif line.startswith('$HB'):
+                   self.processHeartbeatMessage(line, rospy.get_time())
+
+       # keep clock offset up to date
+       if rospy.get_time() > self.timeNextHeartbeat:
+           self.timeNextHeartbeat = rospy.get_time() + self.heartbeatRate
+           self.sendHeartbeat()
+
+
+   # Method to unwrap firmware micros() (overflows every ~71 min) into continuous seconds
+   def unwrapMicros(self, micros):
+       if self.fwMicrosLast is None:
+           self.fwMicrosLast = micros
+       full = self.fwMicrosEpoch + micros
+       if micros - self.fwMicrosLast < -(1 << 31):
+           # micros() wrapped
+           self.fwMicrosEpoch += (1 << 32)
+           full = self.fwMicrosEpoch + micros
+           self.fwMicrosLast = micros
+       elif micros - self.fwMicrosLast > (1 << 31):
+           # sample taken before last wrap
+           full -= (1 << 32)
+       elif micros > self.fwMicrosLast:
+           self.fwMicrosLast = micros
+       return full / 1000000.0
+
+   # Method to convert a firmware capture timestamp (micros) into ROS time
+   # falls back to receive time as long as no clock offset is known
+   def firmwareToHostTime(self, micros):
+       try:
+           fwTime = self.unwrapMicros(int(micros))
+       except ValueError:
+           return rospy.Time.now()
+       if self.clockOffset is None:
+           return rospy.Time.now()
+       return rospy.Time.from_sec(fwTime + self.clockOffset)
+
+   # Method to send heartbeat with host time (t1)
+   def sendHeartbeat(self):
+       self.ROSMessageID+=1
+       cmd = '$HB|' + str(self.ROSMessageID) + '|' + repr(rospy.get_time()) + '\r\n'
+       self.port.write(cmd.encode('utf-8'))
+
+   # Method to process heartbeat response $HB|ID|t1|t2|t3 and update clock offset
+   # t1, t4 host time; t2, t3 firmware micros at receive/send
+   def processHeartbeatMessage(self, message, t4):
+       self.timeLastROSCommand = rospy.get_time()
+       items = message.split("|")
+       if len(items) < 5:
+           return
+       try:
+           t1 = float(items[2])
+       except ValueError:
+           return
+       t2 = self.unwrapMicros(int(items[3]))
+       t3 = self.unwrapMicros(int(items[4]))
+       delay = (t4 - t1) - (t3 - t2)
+       offset = ((t1 - t2) + (t4 - t3)) / 2.0
+       # use sample with smallest round trip delay of last heartbeats (least queuing jitter)
+       self.clockSamples.append((delay, offset))
+       self.clockSamples = self.clockSamples[-8:]
+       self.clockOffset = min(self.clockSamples)[1]
+       if DEBUG:
+           print ("clock offset", self.clockOffset, "delay", delay)
 
 
    # Method process Info messages from Arduino into corresponding
@@ -132,6 +208,8 @@ class ArdumowerROSDriver:
        # get message type
        # check message ID
        self.lastReceivedMessageID = items[1]
+       # capture time of sensor data (last item)
+       stamp = self.firmwareToHostTime(items[-1])
 
        if DEBUG:
            print (message)
@@ -139,7 +217,7 @@ class ArdumowerROSDriver:
        # Status message
        if items[2] == str(ArdumowerROSDriver.SEN_STATUS):
            msgStatus = msg.Status()
-           msgStatus.header.stamp = rospy.Time.now()
+           msgStatus.header.stamp = stamp
            msgStatus.loopPerSec = int(items[3])
            msgStatus.StateID = int(items[4])
            msgStatus.State = items[5]
@@ -150,7 +228,7 @@ class ArdumowerROSDriver:
           items[2] == str(ArdumowerROSDriver.SEN_CHG_CURRENT) or \
           items[2] == str(ArdumowerROSDriver.SEN_CHG_VOLTAGE):
            msgBattery = msg.battery()
-           msgBattery.header.stamp = rospy.Time.now()
+           msgBattery.header.stamp = stamp
            msgBattery.voltage = float(items[3])
            msgBattery.charge_voltage = float(items[4])
            msgBattery.charge_current = float(items[5])
@@ -160,7 +238,7 @@ class ArdumowerROSDriver:
        if items[2] == str(ArdumowerROSDriver.SEN_BUMPER_LEFT) or \
           items[2] == str(ArdumowerROSDriver.SEN_BUMPER_RIGHT):
            msgBumper = msg.bumper()
-           msgBumper.header.stamp = rospy.Time.now()
+           msgBumper.header.stamp = stamp
            msgBumper.bumperLeftCount = int(items[3])
            msgBumper.bumperRightCount = int(items[4])
            msgBumper.leftPressed = int(items[5])
@@ -173,7 +251,7 @@ class ArdumowerROSDriver:
            msgPeriLeft = msg.perimeter()
            msgPeriRight = msg.perimeter()
            msgPeri = msg.perimeters()
-           msgPeri.header.stamp = rospy.Time.now()
+           msgPeri.header.stamp = stamp
            msgPeriLeft.inside = int(items[3])
            msgPeriRight.inside = int(items[4])
            msgPeriLeft.magnitude = int(items[5])
@@ -192,7 +270,7 @@ class ArdumowerROSDriver:
           items[2] == str(ArdumowerROSDriver.SEN_MOTOR_MOW_RPM):
 
            msgMotor = msg.motor()
-           msgMotor.header.stamp = rospy.Time.now()
+           msgMotor.header.stamp = stamp
            msgMotor.leftPWM = int(float(items[3]))
            msgMotor.rightPWM = int(float(items[4]))
            msgMotor.motorLeftCurrent = float(items[7])
@@ -213,7 +291,7 @@ class ArdumowerROSDriver:
           items[2] == str(ArdumowerROSDriver.SEN_SONAR_LEFT) or \
           items[2] == str(ArdumowerROSDriver.SEN_SONAR_RIGHT):
            msgSonar = msg.sonar()
-           msgSonar.header.stamp = rospy.Time.now()
+           msgSonar.header.stamp = stamp
            msgSonar.distanceLeft = int(items[3])
            msgSonar.distanceCenter = int(items[4])
            msgSonar.distanceRight = int(items[5])
@@ -222,10 +300,38 @@ class ArdumowerROSDriver:
        # Odometry
        if items[2] == str(ArdumowerROSDriver.SEN_ODOM):
            msgOdom = msg.odometry()
-           msgOdom.header.stamp = rospy.Time.now()
+           msgOdom.header.stamp = stamp
            msgOdom.leftTicks = int(items[3])
            msgOdom.rightTicks = int(items[4])
+           msgOdom.leftRpm = float(items[5])
+           msgOdom.rightRpm = float(items[6])
            self.pubOdometry.publish(msgOdom)
+
+       # Pose (integrated by Ardumower)
+       if items[2] == str(ArdumowerROSDriver.SEN_POSE):
+           msgPose = msg.pose()
+           msgPose.header.stamp = stamp
+           msgPose.x = int(items[3]) / 1000.0
+           msgPose.y = int(items[4]) / 1000.0
+           msgPose.theta = int(items[5]) / 1000.0
+           msgPose.linear = int(items[6]) / 1000.0
+           msgPose.angular = int(items[7]) / 1000.0
+           self.pubPose.publish(msgPose)
+
+       # GPS (capture time: last received fix)
+       if items[2] == str(ArdumowerROSDriver.SEN_GPS):
+           msgGPS = msg.gps()
+           msgGPS.header.stamp = stamp
+           msgGPS.latitude = int(items[3])
+           msgGPS.longitude = int(items[4])
+           msgGPS.altitude = int(items[5]) / 100.0
+           msgGPS.hAcc = int(items[6])
+           msgGPS.vAcc = int(items[7])
+           msgGPS.satellites = int(items[8])
+           msgGPS.fixType = int(items[9])
+           msgGPS.east = int(items[10]) / 1000.0
+           msgGPS.north = int(items[11]) / 1000.0
+           self.pubGPS.publish(msgGPS)
            
 
    # Method process any incoming Event message which has been raised by Ardumower
@@ -236,6 +342,8 @@ class ArdumowerROSDriver:
            print (event)
        self.timeLastROSCommand = rospy.get_time()
        items = event.split("|")
+       # time when event was detected on Ardumower
+       self.lastEventStamp = self.firmwareToHostTime(items[-1])
 
        # determine type of event
        if items[1] == str(ArdumowerROSDriver.ROS_EV_NEW_STATE):
@@ -257,6 +365,31 @@ class ArdumowerROSDriver:
             '|' + str(enableMowMotor) + '\r\n'
        self.port.write(cmd.encode())   
 
+   # Method to set robot velocity, wheel speeds are closed-loop controlled by Ardumower
+   # linear in m/s, angular in rad/s
+   def setVelocity(self, linear, angular, enableMowMotor):
+       self.ROSMessageID+=1
+       cmd = '$V1|' + str(self.ROSMessageID) + '|' + str(int(linear * 1000)) + '|' + str(int(angular * 1000)) + \
+            '|' + str(int(enableMowMotor)) + '\r\n'
+       self.port.write(cmd.encode())
+
+   # Method to drive with given speed and heading, heading is held by Ardumower (IMU heading controller)
+   # linear in m/s, heading in rad (counter-clockwise, IMU frame)
+   def setHeading(self, linear, heading, enableMowMotor):
+       self.ROSMessageID+=1
+       cmd = '$H1|' + str(self.ROSMessageID) + '|' + str(int(linear * 1000)) + '|' + str(int(heading * 1000)) + \
+            '|' + str(int(enableMowMotor)) + '\r\n'
+       self.port.write(cmd.encode())
+
+   # Method to set velocity profile limits used by Ardumower to ramp velocity commands
+   # speeds in m/s, rad/s, accelerations in m/s^2, rad/s^2, jerks in m/s^3, rad/s^3 (0 = no limit)
+   def setVelocityLimits(self, linearMax, angularMax, linearAccel, angularAccel, linearJerk, angularJerk):
+       self.ROSMessageID+=1
+       cmd = '$VL|' + str(self.ROSMessageID) + '|' + str(int(linearMax * 1000)) + '|' + str(int(angularMax * 1000)) + \
+            '|' + str(int(linearAccel * 1000)) + '|' + str(int(angularAccel * 1000)) + \
+            '|' + str(int(linearJerk * 1000)) + '|' + str(int(angularJerk * 1000)) + '\r\n'
+       self.port.write(cmd.encode())
+
    # Method to poll a sensor
    # Create command for request string and send it by serial console to Arduino
    def pollSensor(self, sensorID):